@@ -0,0 +1,513 @@
+#include "async_io.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* -------------------------------------- */
+//    Class async_io_engine methods implementation
+async_io_engine::async_io_engine()
+{
+    pthread_mutex_init(&write_behind_latch, nullptr);
+    pthread_cond_init(&write_behind_done, nullptr);
+    init_double_linked_list_head(&write_behind_requests);
+    init_double_linked_list_head(&failed_write_behinds);
+    pthread_mutex_init(&completion_latch, nullptr);
+    pthread_cond_init(&completion_ready, nullptr);
+    init_double_linked_list_head(&completed_requests);
+    completer_stopping = false;
+    pthread_create(&completer, nullptr, run_completions, this);
+}
+
+async_io_engine::~async_io_engine()
+{
+    //Engines have no request in flight any more. The completion thread drains its queue before it quits.
+    pthread_mutex_lock(&completion_latch);
+    completer_stopping = true;
+    pthread_cond_signal(&completion_ready);
+    pthread_mutex_unlock(&completion_latch);
+    pthread_join(completer, nullptr);
+    pthread_cond_destroy(&completion_ready);
+    pthread_mutex_destroy(&completion_latch);
+    while(!double_linked_list_empty(&failed_write_behinds)){
+        struct io_request *req = container_of(failed_write_behinds.next, struct io_request, adjacent_write_behinds);
+        delete_double_linked_list_entry(&req->adjacent_write_behinds);
+        delete req;
+    }
+    pthread_cond_destroy(&write_behind_done);
+    pthread_mutex_destroy(&write_behind_latch);
+}
+
+void async_io_engine::complete_request(struct io_request *req)
+{
+    count_syscall(1);
+    if(req->opcode == IO_READ)
+        count_read(req->result);
+    else
+        count_write(req->result);
+    if(req->deferred){
+        pthread_mutex_lock(&completion_latch);
+        double_linked_list_add_tail(&req->adjacent_requests, &completed_requests);
+        pthread_cond_signal(&completion_ready);
+        pthread_mutex_unlock(&completion_latch);
+        return;
+    }
+    if(req->complete)
+        req->complete(req);
+}
+
+void *async_io_engine::run_completions(void *arg)
+{
+    class async_io_engine *engine = (class async_io_engine *)arg;
+
+    while(1){
+        pthread_mutex_lock(&engine->completion_latch);
+        while(double_linked_list_empty(&engine->completed_requests) && !engine->completer_stopping)
+            pthread_cond_wait(&engine->completion_ready, &engine->completion_latch);
+        if(double_linked_list_empty(&engine->completed_requests)){
+            pthread_mutex_unlock(&engine->completion_latch);
+            break;
+        }
+        struct io_request *req = container_of(engine->completed_requests.next, struct io_request, adjacent_requests);
+        delete_double_linked_list_entry(&req->adjacent_requests);
+        pthread_mutex_unlock(&engine->completion_latch);
+
+        if(req->complete)
+            req->complete(req);
+    }
+    return nullptr;
+}
+
+//Waiter shared by a group of requests submitted by 'submit_and_wait'.
+struct io_waiter {
+    pthread_mutex_t latch;
+    pthread_cond_t done;
+    int pending;
+};
+
+static void complete_waited_request(struct io_request *req)
+{
+    struct io_waiter *waiter = (struct io_waiter *)req->arg;
+    pthread_mutex_lock(&waiter->latch);
+    if(--waiter->pending == 0)
+        pthread_cond_signal(&waiter->done);
+    pthread_mutex_unlock(&waiter->latch);
+}
+
+i64 async_io_engine::submit_and_wait(struct io_request *reqs, int req_num)
+{
+    struct io_waiter waiter;
+    i64 ret = DB_SUCCESS;
+
+    pthread_mutex_init(&waiter.latch, nullptr);
+    pthread_cond_init(&waiter.done, nullptr);
+    waiter.pending = req_num;
+    for(int i = 0; i < req_num; ++i){
+        reqs[i].complete = complete_waited_request;
+        reqs[i].arg = &waiter;
+        reqs[i].deferred = false;
+        if(submit_request(&reqs[i]) != DB_SUCCESS){
+            //Requests not submitted will never complete.
+            pthread_mutex_lock(&waiter.latch);
+            waiter.pending -= req_num - i;
+            pthread_mutex_unlock(&waiter.latch);
+            ret = DB_ERROR;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&waiter.latch);
+    while(waiter.pending)
+        pthread_cond_wait(&waiter.done, &waiter.latch);
+    pthread_mutex_unlock(&waiter.latch);
+    pthread_cond_destroy(&waiter.done);
+    pthread_mutex_destroy(&waiter.latch);
+
+    for(int i = 0; i < req_num && ret == DB_SUCCESS; ++i){
+        if(reqs[i].result < 0 || (reqs[i].opcode == IO_WRITE && reqs[i].result != PAGE_SIZE))
+            ret = DB_ERROR;
+    }
+    return ret;
+}
+
+i64 async_io_engine::read_page(int fd, i64 page_no, char *page)
+{
+    struct io_request req;
+    req.opcode = IO_READ;
+    req.fd = fd;
+    req.page_no = page_no;
+    req.page = page;
+    return submit_and_wait(&req, 1);
+}
+
+i64 async_io_engine::read_pages(int fd, i64 page_no, char **pages, int page_num)
+{
+    struct io_request *reqs = new struct io_request [page_num];
+    for(int i = 0; i < page_num; ++i){
+        reqs[i].opcode = IO_READ;
+        reqs[i].fd = fd;
+        reqs[i].page_no = page_no + i;
+        reqs[i].page = pages[i];
+    }
+    i64 ret = submit_and_wait(reqs, page_num);
+    delete [] reqs;
+    return ret;
+}
+
+i64 async_io_engine::write_page(int fd, i64 page_no, char *page)
+{
+    struct io_request req;
+    req.opcode = IO_WRITE;
+    req.fd = fd;
+    req.page_no = page_no;
+    req.page = page;
+    return submit_and_wait(&req, 1);
+}
+
+i64 async_io_engine::write_pages(int fd, i64 page_no, char **pages, int page_num)
+{
+    //All pages of the run are in flight at once.
+    struct io_request *reqs = new struct io_request [page_num];
+    for(int i = 0; i < page_num; ++i){
+        reqs[i].opcode = IO_WRITE;
+        reqs[i].fd = fd;
+        reqs[i].page_no = page_no + i;
+        reqs[i].page = pages[i];
+    }
+    i64 ret = submit_and_wait(reqs, page_num);
+    delete [] reqs;
+    return ret;
+}
+
+void async_io_engine::complete_write_behind(struct io_request *req)
+{
+    class async_io_engine *engine = (class async_io_engine *)req->arg;
+
+    bool failed = (req->result != PAGE_SIZE);
+
+    free_page_buffers(req->page);
+    req->page = nullptr;
+    pthread_mutex_lock(&engine->write_behind_latch);
+    delete_double_linked_list_entry(&req->adjacent_write_behinds);
+    //The page is lost. Keep the request until the file is flushed or closed, which reports it.
+    if(failed)
+        double_linked_list_add_tail(&req->adjacent_write_behinds, &engine->failed_write_behinds);
+    pthread_cond_broadcast(&engine->write_behind_done);
+    pthread_mutex_unlock(&engine->write_behind_latch);
+
+    if(!failed)
+        delete req;
+}
+
+i64 async_io_engine::write_page_behind(int fd, i64 page_no, char *page)
+{
+    struct io_request *req = new struct io_request;
+    req->opcode = IO_WRITE;
+    req->fd = fd;
+    req->page_no = page_no;
+    req->page = page;
+    req->complete = complete_write_behind;
+    req->arg = this;
+    req->deferred = false;
+
+    pthread_mutex_lock(&write_behind_latch);
+    double_linked_list_add_tail(&req->adjacent_write_behinds, &write_behind_requests);
+    pthread_mutex_unlock(&write_behind_latch);
+
+    if(submit_request(req) != DB_SUCCESS){
+        //Fall back to a synchronous write.
+        i64 nbytes = pwrite(fd, page, PAGE_SIZE, page_no * PAGE_SIZE);
+        count_syscall(1);
+        count_write(nbytes);
+        pthread_mutex_lock(&write_behind_latch);
+        delete_double_linked_list_entry(&req->adjacent_write_behinds);
+        pthread_cond_broadcast(&write_behind_done);
+        pthread_mutex_unlock(&write_behind_latch);
+        free_page_buffers(page);
+        delete req;
+        return (nbytes == PAGE_SIZE) ? DB_SUCCESS : DB_ERROR;
+    }
+    return DB_SUCCESS;
+}
+
+i64 async_io_engine::wait_write_behind(int fd, i64 page_no)
+{
+    struct io_request *req;
+    struct double_linked_list_head *cursor, *next;
+    i64 ret = DB_SUCCESS;
+    bool pending;
+
+    pthread_mutex_lock(&write_behind_latch);
+    do{
+        pending = false;
+        double_linked_list_for_each_entry(req, &write_behind_requests, adjacent_write_behinds){
+            if(req->fd == fd && (page_no < 0 || req->page_no == page_no)){
+                pending = true;
+                break;
+            }
+        }
+        if(pending)
+            pthread_cond_wait(&write_behind_done, &write_behind_latch);
+    }while(pending);
+
+    //Failed writes are forgotten once reported for the whole file.
+    cursor = failed_write_behinds.next;
+    while(cursor != &failed_write_behinds){
+        next = cursor->next;
+        req = container_of(cursor, struct io_request, adjacent_write_behinds);
+        if(req->fd == fd && (page_no < 0 || req->page_no == page_no)){
+            ret = DB_ERROR;
+            if(page_no < 0){
+                delete_double_linked_list_entry(cursor);
+                delete req;
+            }
+        }
+        cursor = next;
+    }
+    pthread_mutex_unlock(&write_behind_latch);
+    return ret;
+}
+
+/* -------------------------------------- */
+//    Class uring_io_engine methods implementation
+i64 uring_io_engine::init(unsigned queue_depth)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    ring_fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+    if(ring_fd < 0)
+        return DB_ERROR;
+    this->queue_depth = params.sq_entries;
+
+    //Map submission ring, completion ring and submission queue entries.
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(cq_ring_size > sq_ring_size)
+            sq_ring_size = cq_ring_size;
+        cq_ring_size = sq_ring_size;
+    }
+    sq_ring = (char *)mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if(sq_ring == MAP_FAILED)
+        goto setup_error;
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        cq_ring = sq_ring;
+    }
+    else{
+        cq_ring = (char *)mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if(cq_ring == MAP_FAILED){
+            munmap(sq_ring, sq_ring_size);
+            goto setup_error;
+        }
+    }
+    sqes = (struct io_uring_sqe *)mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED){
+        if(cq_ring != sq_ring)
+            munmap(cq_ring, cq_ring_size);
+        munmap(sq_ring, sq_ring_size);
+        goto setup_error;
+    }
+
+    sq_head = (unsigned *)(sq_ring + params.sq_off.head);
+    sq_tail = (unsigned *)(sq_ring + params.sq_off.tail);
+    sq_mask = (unsigned *)(sq_ring + params.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq_ring + params.sq_off.array);
+    cq_head = (unsigned *)(cq_ring + params.cq_off.head);
+    cq_tail = (unsigned *)(cq_ring + params.cq_off.tail);
+    cq_mask = (unsigned *)(cq_ring + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+
+    pthread_mutex_init(&submit_latch, nullptr);
+    pthread_cond_init(&slot_available, nullptr);
+    in_flight = 0;
+    stopping = false;
+    pthread_create(&reaper, nullptr, reap_completions, this);
+    return DB_SUCCESS;
+
+setup_error:
+    close(ring_fd);
+    ring_fd = -1;
+    return DB_ERROR;
+}
+
+uring_io_engine::~uring_io_engine()
+{
+    if(ring_fd < 0)
+        return;
+
+    //Wait for requests in flight, then a no-op request without owner tells the reaper to quit.
+    pthread_mutex_lock(&submit_latch);
+    while(in_flight)
+        pthread_cond_wait(&slot_available, &submit_latch);
+    stopping = true;
+    pthread_mutex_unlock(&submit_latch);
+    push_request(nullptr, IORING_OP_NOP);
+    pthread_join(reaper, nullptr);
+
+    munmap(sqes, queue_depth * sizeof(struct io_uring_sqe));
+    if(cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    munmap(sq_ring, sq_ring_size);
+    close(ring_fd);
+    pthread_cond_destroy(&slot_available);
+    pthread_mutex_destroy(&submit_latch);
+}
+
+i64 uring_io_engine::push_request(struct io_request *req, unsigned char opcode)
+{
+    pthread_mutex_lock(&submit_latch);
+    //Never overflow the completion ring.
+    while(in_flight >= queue_depth)
+        pthread_cond_wait(&slot_available, &submit_latch);
+
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = (unsigned long long)req;
+    if(req){
+        req->iov.iov_base = req->page;
+        req->iov.iov_len = PAGE_SIZE;
+        sqe->fd = req->fd;
+        sqe->off = req->page_no * PAGE_SIZE;
+        sqe->addr = (unsigned long long)&req->iov;
+        sqe->len = 1;
+    }
+    sq_array[index] = index;
+    //Make the entry visible to the kernel before the tail moves.
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    in_flight++;
+
+    int ret;
+    do{
+        ret = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0);
+    }while(ret < 0 && errno == EINTR);
+    if(ret < 0){
+        //Take the entry back. The kernel has not consumed it.
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        in_flight--;
+        pthread_mutex_unlock(&submit_latch);
+        return DB_ERROR;
+    }
+    pthread_mutex_unlock(&submit_latch);
+    return DB_SUCCESS;
+}
+
+i64 uring_io_engine::submit_request(struct io_request *req)
+{
+    return push_request(req, (req->opcode == IO_READ) ? IORING_OP_READV : IORING_OP_WRITEV);
+}
+
+void *uring_io_engine::reap_completions(void *arg)
+{
+    class uring_io_engine *engine = (class uring_io_engine *)arg;
+    bool quit = false;
+
+    while(!quit){
+        int ret = syscall(__NR_io_uring_enter, engine->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(ret < 0 && errno != EINTR)
+            break;
+
+        unsigned head = *engine->cq_head;
+        unsigned tail = __atomic_load_n(engine->cq_tail, __ATOMIC_ACQUIRE);
+        while(head != tail){
+            struct io_uring_cqe *cqe = &engine->cqes[head & *engine->cq_mask];
+            struct io_request *req = (struct io_request *)cqe->user_data;
+            i64 result = cqe->res;
+            head++;
+            __atomic_store_n(engine->cq_head, head, __ATOMIC_RELEASE);
+
+            pthread_mutex_lock(&engine->submit_latch);
+            engine->in_flight--;
+            pthread_cond_broadcast(&engine->slot_available);
+            if(req == nullptr && engine->stopping)
+                quit = true;
+            pthread_mutex_unlock(&engine->submit_latch);
+
+            if(req){
+                req->result = result;
+                engine->complete_request(req);
+            }
+        }
+    }
+    return nullptr;
+}
+
+/* -------------------------------------- */
+//    Class thread_pool_io_engine methods implementation
+thread_pool_io_engine::thread_pool_io_engine(int worker_num)
+{
+    this->worker_num = worker_num;
+    stopping = false;
+    pthread_mutex_init(&queue_latch, nullptr);
+    pthread_cond_init(&queue_not_empty, nullptr);
+    init_double_linked_list_head(&request_queue);
+    workers = new pthread_t [worker_num];
+    for(int i = 0; i < worker_num; ++i){
+        pthread_create(&workers[i], nullptr, serve_requests, this);
+    }
+}
+
+thread_pool_io_engine::~thread_pool_io_engine()
+{
+    //Workers drain the queue before they quit.
+    pthread_mutex_lock(&queue_latch);
+    stopping = true;
+    pthread_cond_broadcast(&queue_not_empty);
+    pthread_mutex_unlock(&queue_latch);
+    for(int i = 0; i < worker_num; ++i){
+        pthread_join(workers[i], nullptr);
+    }
+    delete [] workers;
+    pthread_cond_destroy(&queue_not_empty);
+    pthread_mutex_destroy(&queue_latch);
+}
+
+i64 thread_pool_io_engine::submit_request(struct io_request *req)
+{
+    pthread_mutex_lock(&queue_latch);
+    double_linked_list_add_tail(&req->adjacent_requests, &request_queue);
+    pthread_cond_signal(&queue_not_empty);
+    pthread_mutex_unlock(&queue_latch);
+    return DB_SUCCESS;
+}
+
+void *thread_pool_io_engine::serve_requests(void *arg)
+{
+    class thread_pool_io_engine *engine = (class thread_pool_io_engine *)arg;
+
+    while(1){
+        pthread_mutex_lock(&engine->queue_latch);
+        while(double_linked_list_empty(&engine->request_queue) && !engine->stopping)
+            pthread_cond_wait(&engine->queue_not_empty, &engine->queue_latch);
+        if(double_linked_list_empty(&engine->request_queue)){
+            pthread_mutex_unlock(&engine->queue_latch);
+            break;
+        }
+        struct io_request *req = container_of(engine->request_queue.next, struct io_request, adjacent_requests);
+        delete_double_linked_list_entry(&req->adjacent_requests);
+        pthread_mutex_unlock(&engine->queue_latch);
+
+        if(req->opcode == IO_READ)
+            req->result = pread(req->fd, req->page, PAGE_SIZE, req->page_no * PAGE_SIZE);
+        else
+            req->result = pwrite(req->fd, req->page, PAGE_SIZE, req->page_no * PAGE_SIZE);
+        if(req->result < 0)
+            req->result = -errno;
+        engine->complete_request(req);
+    }
+    return nullptr;
+}
+
+class async_io_engine *create_async_io_engine(unsigned queue_depth)
+{
+    class uring_io_engine *uring = new class uring_io_engine();
+    if(uring->init(queue_depth) == DB_SUCCESS)
+        return uring;
+    delete uring;
+    return new class thread_pool_io_engine(4);
+}
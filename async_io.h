@@ -0,0 +1,155 @@
+#ifndef __ASYNC_IO_H__
+#define __ASYNC_IO_H__
+
+#include "io_backend.h"
+
+#include <pthread.h>
+
+/*
+    Asynchronous I/O engine design:
+        An asynchronous engine is an I/O backend that can keep many page reads and writes in flight. Each request
+        carries a completion routine which is called once the request is done.
+        Synchronous backend calls are served by submitting requests and waiting for them.
+
+    Completion thread:
+        Requests submitted by 'submit' are completed on a completion thread of their own, never on the thread that
+        reaps or serves requests. Their routines may take latches (e.g. a page cache shard latch) which are held by
+        threads waiting for synchronous requests, and those requests must still be reaped meanwhile.
+
+    I/O request:
+        Operation: Read or write.
+        File descriptor, page no. and page buffer.
+        Result: Bytes transferred, or -errno.
+        Completion routine and its argument.
+
+    Write behind:
+        A page written behind is handed over to the engine (the buffer is freed once written), so the caller does not
+        wait for the write. Until it completes, the page must not be read back from disk: readers call
+        'wait_write_behind' first. Pending writes behind are kept in a list.
+        A failed or short write behind is kept in a list of failed writes until a wait for all pages of its file
+        (flush, truncate or close) reports it.
+
+    Engines:
+        io_uring engine:     Requests are placed on the submission ring, a reaper thread waits for completions.
+                             The ring is driven through raw system calls, no library is required.
+        Thread pool engine:  Worker threads take requests from a queue and issue pread / pwrite.
+                             Used when io_uring is not available.
+*/
+
+enum io_opcode {IO_READ = 1, IO_WRITE};
+
+struct io_request {
+    enum io_opcode opcode;
+    int fd;
+    i64 page_no;
+    char *page;
+    i64 result;
+    void (*complete)(struct io_request *req);
+    void *arg;
+    bool deferred;                                           //Completed on the completion thread.
+    struct iovec iov;                                        //Used by the io_uring engine.
+    struct double_linked_list_head adjacent_requests;        //Request queue of the thread pool engine, then
+                                                             //completed requests queue.
+    struct double_linked_list_head adjacent_write_behinds;   //Pending writes behind.
+};
+
+class async_io_engine : public io_backend{
+private:
+    pthread_mutex_t write_behind_latch;
+    pthread_cond_t write_behind_done;
+    struct double_linked_list_head write_behind_requests;    //Pending writes behind
+    struct double_linked_list_head failed_write_behinds;     //Failed writes behind not reported yet
+
+    pthread_mutex_t completion_latch;
+    pthread_cond_t completion_ready;
+    struct double_linked_list_head completed_requests;       //Deferred requests waiting for their completion routine
+    bool completer_stopping;
+    pthread_t completer;
+
+    static void complete_write_behind(struct io_request *req);
+    static void *run_completions(void *arg);
+
+protected:
+    //Finish a request: update counters and call its completion routine, or queue a deferred request for the
+    //completion thread.
+    void complete_request(struct io_request *req);
+
+    //Submit a request to the engine. It returns once the request is queued.
+    virtual i64 submit_request(struct io_request *req) = 0;
+
+    //Submit requests and wait for all of them.
+    i64 submit_and_wait(struct io_request *reqs, int req_num);
+
+public:
+    async_io_engine();
+    virtual ~async_io_engine();
+
+    inline bool is_async() {return true;}
+    //Submit a request completed on the completion thread.
+    inline i64 submit(struct io_request *req)
+    {
+        req->deferred = true;
+        return submit_request(req);
+    }
+
+    i64 read_page(int fd, i64 page_no, char *page);
+    i64 read_pages(int fd, i64 page_no, char **pages, int page_num);
+    i64 write_page(int fd, i64 page_no, char *page);
+    i64 write_pages(int fd, i64 page_no, char **pages, int page_num);
+    i64 write_page_behind(int fd, i64 page_no, char *page);
+    i64 wait_write_behind(int fd, i64 page_no);
+};
+
+class uring_io_engine : public async_io_engine{
+private:
+    int ring_fd;
+    unsigned queue_depth;
+    char *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    pthread_mutex_t submit_latch;
+    pthread_cond_t slot_available;
+    unsigned in_flight;                     //Submitted but not reaped requests, limited by queue depth.
+    bool stopping;
+    pthread_t reaper;
+
+    static void *reap_completions(void *arg);
+    i64 push_request(struct io_request *req, unsigned char opcode);
+
+protected:
+    i64 submit_request(struct io_request *req);
+
+public:
+    uring_io_engine() : ring_fd(-1) {}
+    ~uring_io_engine();
+    //Set up the rings. Return DB_ERROR if io_uring is not supported.
+    i64 init(unsigned queue_depth);
+};
+
+class thread_pool_io_engine : public async_io_engine{
+private:
+    pthread_mutex_t queue_latch;
+    pthread_cond_t queue_not_empty;
+    struct double_linked_list_head request_queue;
+    pthread_t *workers;
+    int worker_num;
+    bool stopping;
+
+    static void *serve_requests(void *arg);
+
+protected:
+    i64 submit_request(struct io_request *req);
+
+public:
+    thread_pool_io_engine(int worker_num);
+    ~thread_pool_io_engine();
+};
+
+//Create an io_uring engine, or a thread pool engine if io_uring is not available.
+extern class async_io_engine *create_async_io_engine(unsigned queue_depth);
+
+#endif
@@ -0,0 +1,274 @@
+#include "compressed_cache.h"
+
+#include <stdlib.h>
+
+#define LZ_HASH_BITS 12
+
+static inline unsigned int load32(const unsigned char *p)
+{
+    unsigned int value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline int lz_hash(unsigned int sequence)
+{
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+//Write 'length' as extra length bytes (255 per byte, then the remainder).
+static inline unsigned char *write_length(unsigned char *op, int length)
+{
+    while(length >= 255){
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+int lz_compress(const char *src, int src_len, char *dst, int dst_capacity)
+{
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *op = (unsigned char *)dst, *op_end = (unsigned char *)dst + dst_capacity;
+    int table[1 << LZ_HASH_BITS];
+    int ip = 0, anchor = 0;
+
+    memset(table, -1, sizeof(table));
+    while(ip + MIN_MATCH_LENGTH <= src_len){
+        unsigned int sequence = load32(in + ip);
+        int h = lz_hash(sequence);
+        int ref = table[h];
+        table[h] = ip;
+        if(ref < 0 || ip - ref > 65535 || load32(in + ref) != sequence){
+            ip++;
+            continue;
+        }
+
+        int match_len = MIN_MATCH_LENGTH;
+        while(ip + match_len < src_len && in[ref + match_len] == in[ip + match_len])
+            match_len++;
+        int literal_len = ip - anchor;
+        //Token, extra lengths, literals and offset.
+        if(op + 1 + literal_len / 255 + 1 + literal_len + 2 + (match_len - MIN_MATCH_LENGTH) / 255 + 1 > op_end)
+            return 0;
+        unsigned char *token = op++;
+        *token = (unsigned char)(((literal_len < 15) ? literal_len : 15) << 4);
+        if(literal_len >= 15)
+            op = write_length(op, literal_len - 15);
+        memcpy(op, in + anchor, literal_len);
+        op += literal_len;
+        *op++ = (unsigned char)(ip - ref);
+        *op++ = (unsigned char)((ip - ref) >> 8);
+        int extra_len = match_len - MIN_MATCH_LENGTH;
+        *token |= (unsigned char)((extra_len < 15) ? extra_len : 15);
+        if(extra_len >= 15)
+            op = write_length(op, extra_len - 15);
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    //Last literals.
+    int literal_len = src_len - anchor;
+    if(op + 1 + literal_len / 255 + 1 + literal_len > op_end)
+        return 0;
+    *op++ = (unsigned char)(((literal_len < 15) ? literal_len : 15) << 4);
+    if(literal_len >= 15)
+        op = write_length(op, literal_len - 15);
+    memcpy(op, in + anchor, literal_len);
+    op += literal_len;
+    return op - (unsigned char *)dst;
+}
+
+i64 lz_decompress(const char *src, int src_len, char *dst, int dst_len)
+{
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *out = (unsigned char *)dst;
+    int ip = 0, op = 0;
+
+    while(ip < src_len){
+        int token = in[ip++];
+        int literal_len = token >> 4;
+        if(literal_len == 15){
+            int extra;
+            do{
+                if(ip >= src_len)
+                    return DB_ERROR;
+                extra = in[ip++];
+                literal_len += extra;
+            }while(extra == 255);
+        }
+        if(literal_len > src_len - ip || literal_len > dst_len - op)
+            return DB_ERROR;
+        memcpy(out + op, in + ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        //The last sequence has no match.
+        if(ip == src_len)
+            break;
+
+        if(ip + 2 > src_len)
+            return DB_ERROR;
+        int offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > op)
+            return DB_ERROR;
+        int match_len = token & 15;
+        if(match_len == 15){
+            int extra;
+            do{
+                if(ip >= src_len)
+                    return DB_ERROR;
+                extra = in[ip++];
+                match_len += extra;
+            }while(extra == 255);
+        }
+        match_len += MIN_MATCH_LENGTH;
+        if(match_len > dst_len - op)
+            return DB_ERROR;
+        //An overlapping match repeats the bytes just written, so it is copied in steps of at most 'offset' bytes.
+        unsigned char *match = out + op - offset, *match_end = out + op + match_len;
+        unsigned char *cp = out + op;
+        if(offset >= 8){
+            while(match_end - cp >= 8){
+                memcpy(cp, match, 8);
+                cp += 8;
+                match += 8;
+            }
+        }
+        while(cp < match_end)
+            *cp++ = *match++;
+        op += match_len;
+    }
+    return (op == dst_len) ? DB_SUCCESS : DB_ERROR;
+}
+
+/* -------------------------------------- */
+//    Class compressed_cache methods implementation
+compressed_cache::compressed_cache(i64 budget_bytes)
+{
+    this->budget_bytes = budget_bytes;
+    memset(&stats, 0, sizeof(stats));
+    stats.budget_bytes = budget_bytes;
+    init_double_linked_list_head(&lru);
+
+    //About one bucket per page, expecting pages to compress to a quarter.
+    i64 page_num = budget_bytes / (PAGE_SIZE / 4);
+    int bucket_num = 16;
+    while(bucket_num < page_num && bucket_num < (1 << 30))
+        bucket_num <<= 1;
+    bucket = new struct double_linked_list_head [bucket_num];
+    bucket_mask = bucket_num - 1;
+    for(int i = 0; i < bucket_num; ++i){
+        init_double_linked_list_head(&bucket[i]);
+    }
+}
+
+compressed_cache::~compressed_cache()
+{
+    while(!double_linked_list_empty(&lru)){
+        drop(container_of(lru.next, struct compressed_page, adjacent_pages_in_lru));
+    }
+    delete [] bucket;
+}
+
+struct compressed_page *compressed_cache::find(int fd, i64 page_no)
+{
+    struct compressed_page *entry;
+    double_linked_list_for_each_entry(entry, get_bucket(fd, page_no), adjacent_pages_in_hash_table){
+        if(entry->fd == fd && entry->page_no == page_no)
+            return entry;
+    }
+    return nullptr;
+}
+
+void compressed_cache::drop(struct compressed_page *entry)
+{
+    delete_double_linked_list_entry(&entry->adjacent_pages_in_hash_table);
+    delete_double_linked_list_entry(&entry->adjacent_pages_in_lru);
+    stats.page_num--;
+    stats.used_bytes -= sizeof(struct compressed_page) + entry->size;
+    free(entry);
+}
+
+void compressed_cache::put(int fd, i64 page_no, const char *page)
+{
+    char buf[max_compressed_size];
+
+    //The older copy is stale either way.
+    struct compressed_page *entry = find(fd, page_no);
+    if(entry)
+        drop(entry);
+
+    i64 start = monotonic_ns();
+    int size = lz_compress(page, PAGE_SIZE, buf, max_compressed_size);
+    stats.compress_ns += monotonic_ns() - start;
+    i64 entry_size = sizeof(struct compressed_page) + size;
+    if(size == 0 || entry_size > budget_bytes){
+        stats.reject_num++;
+        return;
+    }
+
+    //Make room by dropping the least recently entered pages.
+    while(stats.used_bytes + entry_size > budget_bytes){
+        drop(container_of(lru.next, struct compressed_page, adjacent_pages_in_lru));
+        stats.drop_num++;
+    }
+
+    entry = (struct compressed_page *)malloc(entry_size);
+    if(entry == nullptr)
+        return;
+    entry->fd = fd;
+    entry->page_no = page_no;
+    entry->size = size;
+    memcpy(entry->data, buf, size);
+    double_linked_list_add_head(&entry->adjacent_pages_in_hash_table, get_bucket(fd, page_no));
+    double_linked_list_add_tail(&entry->adjacent_pages_in_lru, &lru);
+    stats.page_num++;
+    stats.used_bytes += entry_size;
+    stats.store_num++;
+    stats.stored_bytes += PAGE_SIZE;
+    stats.compressed_bytes += size;
+}
+
+bool compressed_cache::take(int fd, i64 page_no, char *page)
+{
+    stats.lookup_num++;
+    struct compressed_page *entry = find(fd, page_no);
+    if(entry == nullptr)
+        return false;
+
+    i64 start = monotonic_ns();
+    i64 ret = lz_decompress(entry->data, entry->size, page, PAGE_SIZE);
+    stats.decompress_ns += monotonic_ns() - start;
+    drop(entry);
+    if(ret != DB_SUCCESS)
+        return false;
+    stats.hit_num++;
+    return true;
+}
+
+void compressed_cache::invalidate(int fd, i64 page_no)
+{
+    if(page_no != -1){
+        struct compressed_page *entry = find(fd, page_no);
+        if(entry)
+            drop(entry);
+        return;
+    }
+
+    invalidate_from(fd, 0);
+}
+
+void compressed_cache::invalidate_from(int fd, i64 page_no)
+{
+    struct double_linked_list_head *cursor = lru.next, *next;
+    while(cursor != &lru){
+        next = cursor->next;
+        struct compressed_page *entry = container_of(cursor, struct compressed_page, adjacent_pages_in_lru);
+        if(entry->fd == fd && entry->page_no >= page_no)
+            drop(entry);
+        cursor = next;
+    }
+}
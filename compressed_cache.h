@@ -0,0 +1,89 @@
+#ifndef __COMPRESSED_CACHE_H__
+#define __COMPRESSED_CACHE_H__
+
+#include "db.h"
+
+/*
+    Compressed page cache design:
+        A second tier behind the page cache. Pages evicted from the page cache are kept here compressed, so a miss
+        on them costs a decompression instead of a disk read. Each page cache shard owns one compressed cache,
+        protected by the shard latch.
+
+    Contents:
+        Compressed pages are always clean copies: a page enters on eviction (after a dirty page was written back)
+        and leaves when it is read back into the page cache, so a page is never cached twice. Entering replaces an
+        older copy of the page. Pages which do not compress to 'max_compressed_size' are not kept, and neither is
+        their older copy.
+        Compressed pages of a file are dropped when it is closed (its descriptor may be reused).
+
+    Memory budget:
+        Bytes of all entries (header included). Least recently entered pages are dropped to stay within it.
+        Hash table: (File descriptor, page no.) -> entry, a power of 2 number of buckets sized for the budget.
+
+    Compression:
+        Built-in LZ77 compressor producing LZ4 style sequences: a token (literal length, match length - 4), the
+        literals, a 2-byte match offset and extra length bytes (255 per byte) for long runs. Matches are found by
+        hashing 4-byte windows. The last sequence holds literals only.
+*/
+
+#define MIN_MATCH_LENGTH 4
+
+//Compress 'src_len' bytes into at most 'dst_capacity' bytes. Return the compressed size, or 0 if it does not fit.
+extern int lz_compress(const char *src, int src_len, char *dst, int dst_capacity);
+//Decompress into exactly 'dst_len' bytes. Return DB_ERROR if the input is malformed.
+extern i64 lz_decompress(const char *src, int src_len, char *dst, int dst_len);
+
+struct compressed_cache_stats {
+    i64 page_num;                   //Pages held.
+    i64 used_bytes;
+    i64 budget_bytes;
+    i64 lookup_num, hit_num;        //Misses of the page cache looked up here, and found.
+    i64 store_num;                  //Pages compressed and kept.
+    i64 reject_num;                 //Pages which did not compress well enough.
+    i64 drop_num;                   //Pages dropped to stay within the budget.
+    i64 compress_ns, decompress_ns; //Total time spent compressing and decompressing.
+    i64 stored_bytes;               //Bytes of pages kept, before and after compression.
+    i64 compressed_bytes;
+};
+
+struct compressed_page {
+    int fd;
+    int size;                                                   //Compressed size
+    i64 page_no;
+    struct double_linked_list_head adjacent_pages_in_hash_table;
+    struct double_linked_list_head adjacent_pages_in_lru;       //Least recently entered first
+    char data[];
+};
+
+class compressed_cache{
+private:
+    static const int max_compressed_size = PAGE_SIZE * 3 / 4;
+    struct double_linked_list_head *bucket;
+    int bucket_mask;
+    struct double_linked_list_head lru;
+    i64 budget_bytes;
+    struct compressed_cache_stats stats;
+
+    inline struct double_linked_list_head *get_bucket(int fd, i64 page_no)
+    {
+        return &bucket[page_hash(fd, page_no) & bucket_mask];
+    }
+    struct compressed_page *find(int fd, i64 page_no);
+    void drop(struct compressed_page *entry);
+
+public:
+    compressed_cache(i64 budget_bytes);
+    ~compressed_cache();
+    //Keep a compressed copy of a clean page, replacing an older one.
+    void put(int fd, i64 page_no, const char *page);
+    //Decompress the page into 'page' and drop it from here. Return false if it is not here.
+    bool take(int fd, i64 page_no, char *page);
+    inline bool contains(int fd, i64 page_no) {return find(fd, page_no) != nullptr;}
+    //Drop the page, or all pages of the file if 'page_no' is -1.
+    void invalidate(int fd, i64 page_no);
+    //Drop the pages of the file from 'page_no' on.
+    void invalidate_from(int fd, i64 page_no);
+    inline void get_stats(struct compressed_cache_stats *snapshot) {memcpy(snapshot, &stats, sizeof(stats));}
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include <iostream>
 
@@ -69,6 +70,26 @@ static inline void double_linked_list_add_tail(
 }
 
 
+static inline i64 monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+//64-bit hash of a page identity.
+inline unsigned long long page_hash(int fd, i64 page_no)
+{
+    unsigned long long key = (unsigned long long)page_no * 0x9E3779B97F4A7C15ULL ^ (unsigned int)fd;
+    //Finalizer of splitmix64: every input bit affects every output bit.
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    return key;
+}
+
 #define double_linked_list_entry(ptr, type, member) \
         container_of(ptr, type, member)
 
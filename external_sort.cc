@@ -0,0 +1,231 @@
+#include "external_sort.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+external_sorter::external_sorter(i64 entry_length, i64 key_length, key_compare_routine compare, i64 memory_budget)
+{
+    this->entry_length = entry_length;
+    this->key_length = key_length;
+    this->compare = compare;
+    this->capacity = memory_budget / (entry_length + 2 * sizeof(char *));
+    if(this->capacity < 2)
+        this->capacity = 2;
+    this->entries = new char [capacity * entry_length];
+    this->order = new char * [capacity];
+    this->merge_buf = new char * [capacity];
+    this->buffered_num = this->entry_num = this->output_pos = 0;
+
+    this->runs = nullptr;
+    this->run_num = this->run_capacity = 0;
+    this->heap = nullptr;
+    this->heap_size = 0;
+    this->last_run = -1;
+}
+
+external_sorter::~external_sorter()
+{
+    delete [] entries;
+    delete [] order;
+    delete [] merge_buf;
+    for(int i = 0; i < run_num; ++i){
+        close(runs[i].fd);
+        delete [] runs[i].buf;
+    }
+    free(runs);
+    delete [] heap;
+}
+
+void external_sorter::sort_buffer()
+{
+    for(i64 i = 0; i < buffered_num; ++i){
+        order[i] = entries + i * entry_length;
+    }
+
+    //Merge pairs of sorted blocks of 'width' entries, doubling the width.
+    for(i64 width = 1; width < buffered_num; width *= 2){
+        for(i64 low = 0; low < buffered_num; low += 2 * width){
+            i64 mid = (low + width < buffered_num) ? low + width : buffered_num;
+            i64 high = (low + 2 * width < buffered_num) ? low + 2 * width : buffered_num;
+            i64 a = low, b = mid, k = low;
+            //Blocks already in order.
+            if(mid == high || compare(order[mid - 1], order[mid], key_length) <= 0){
+                memcpy(merge_buf + low, order + low, (high - low) * sizeof(char *));
+                continue;
+            }
+            while(a < mid && b < high){
+                if(compare(order[b], order[a], key_length) < 0)
+                    merge_buf[k++] = order[b++];
+                else
+                    merge_buf[k++] = order[a++];
+            }
+            while(a < mid)
+                merge_buf[k++] = order[a++];
+            while(b < high)
+                merge_buf[k++] = order[b++];
+        }
+        char **swap = order;
+        order = merge_buf;
+        merge_buf = swap;
+    }
+}
+
+i64 external_sorter::write_run()
+{
+    char name[] = "sort_run_XXXXXX";
+    int fd = mkstemp(name);
+    if(fd < 0)
+        return DB_ERROR;
+    unlink(name);
+
+    if(run_num == run_capacity){
+        run_capacity = run_capacity ? run_capacity * 2 : 8;
+        struct sort_run *new_runs = (struct sort_run *)realloc(runs, run_capacity * sizeof(struct sort_run));
+        if(new_runs == nullptr){
+            close(fd);
+            return DB_ERROR;
+        }
+        runs = new_runs;
+    }
+    struct sort_run *run = &runs[run_num++];
+    run->fd = fd;
+    run->entry_num = buffered_num;
+    run->buf = nullptr;
+    run->buf_entry_num = run->buf_pos = 0;
+
+    //Gather sorted entries into a buffer and write it out when it is full.
+    sort_buffer();
+    i64 buf_capacity = (run_buffer_size / entry_length) ? run_buffer_size / entry_length : 1;
+    char *buf = new char [buf_capacity * entry_length];
+    for(i64 i = 0; i < buffered_num; i += buf_capacity){
+        i64 n = (buffered_num - i < buf_capacity) ? buffered_num - i : buf_capacity;
+        for(i64 j = 0; j < n; ++j){
+            memcpy(buf + j * entry_length, order[i + j], entry_length);
+        }
+        i64 done = 0, len = n * entry_length;
+        while(done < len){
+            ssize_t ret = write(fd, buf + done, len - done);
+            if(ret < 0 && errno == EINTR)
+                continue;
+            if(ret <= 0){
+                delete [] buf;
+                return DB_ERROR;
+            }
+            done += ret;
+        }
+    }
+    delete [] buf;
+    buffered_num = 0;
+    return DB_SUCCESS;
+}
+
+i64 external_sorter::fill_run_buffer(struct sort_run *run)
+{
+    i64 buf_capacity = (run_buffer_size / entry_length) ? run_buffer_size / entry_length : 1;
+    i64 n = (run->entry_num < buf_capacity) ? run->entry_num : buf_capacity;
+    i64 done = 0, len = n * entry_length;
+    while(done < len){
+        ssize_t ret = read(run->fd, run->buf + done, len - done);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            return DB_ERROR;
+        done += ret;
+    }
+    run->entry_num -= n;
+    run->buf_entry_num = n;
+    run->buf_pos = 0;
+    return DB_SUCCESS;
+}
+
+i64 external_sorter::add(const char *entry)
+{
+    if(buffered_num == capacity && write_run() != DB_SUCCESS)
+        return DB_ERROR;
+    memcpy(entries + buffered_num * entry_length, entry, entry_length);
+    buffered_num++;
+    entry_num++;
+    return DB_SUCCESS;
+}
+
+void external_sorter::sift_down(int i)
+{
+    while(true){
+        int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if(left < heap_size && run_less(heap[left], heap[smallest]))
+            smallest = left;
+        if(right < heap_size && run_less(heap[right], heap[smallest]))
+            smallest = right;
+        if(smallest == i)
+            return;
+        int swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+i64 external_sorter::sort()
+{
+    //Everything fits in memory.
+    if(run_num == 0){
+        sort_buffer();
+        output_pos = 0;
+        return DB_SUCCESS;
+    }
+
+    if(buffered_num && write_run() != DB_SUCCESS)
+        return DB_ERROR;
+    //The memory buffer is not needed any more, run buffers take its place.
+    delete [] entries;
+    delete [] order;
+    delete [] merge_buf;
+    entries = nullptr;
+    order = merge_buf = nullptr;
+
+    heap = new int [run_num];
+    heap_size = 0;
+    for(int i = 0; i < run_num; ++i){
+        i64 buf_capacity = (run_buffer_size / entry_length) ? run_buffer_size / entry_length : 1;
+        runs[i].buf = new char [buf_capacity * entry_length];
+        if(lseek(runs[i].fd, 0, SEEK_SET) < 0 || fill_run_buffer(&runs[i]) != DB_SUCCESS)
+            return DB_ERROR;
+        if(runs[i].buf_entry_num)
+            heap[heap_size++] = i;
+    }
+    for(int i = heap_size / 2 - 1; i >= 0; --i){
+        sift_down(i);
+    }
+    last_run = -1;
+    return DB_SUCCESS;
+}
+
+i64 external_sorter::next(char *&entry)
+{
+    entry = nullptr;
+    if(run_num == 0){
+        if(output_pos < buffered_num)
+            entry = order[output_pos++];
+        return DB_SUCCESS;
+    }
+
+    //Move past the entry returned last, now that the caller is done with it.
+    if(last_run >= 0){
+        struct sort_run *run = &runs[last_run];
+        if(++run->buf_pos == run->buf_entry_num){
+            if(run->entry_num == 0){
+                heap[0] = heap[--heap_size];
+            }
+            else if(fill_run_buffer(run) != DB_SUCCESS)
+                return DB_ERROR;
+        }
+        sift_down(0);
+        last_run = -1;
+    }
+
+    if(heap_size == 0)
+        return DB_SUCCESS;
+    last_run = heap[0];
+    entry = get_run_entry(last_run);
+    return DB_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#ifndef __EXTERNAL_SORT_H__
+#define __EXTERNAL_SORT_H__
+
+#include "db.h"
+
+/*
+    External sort design:
+        Sorts fixed length entries which start with their key, using a key comparison routine (such as the 'compare'
+        of an index key type). Entries are collected in a memory buffer. Each time it is full, it is sorted and
+        written to a run file. Once all entries are in, the runs are merged with a heap, each run being read through
+        its own buffer. Entries which all fit in memory are never written.
+
+    In-memory sort:
+        Bottom-up merge sort of entry pointers. Merging two blocks already in order is skipped, so sorted input
+        costs one comparison per entry. Equal keys keep their input order, in memory and across runs.
+
+    Run files:
+        Created in the current directory and unlinked right away, so they vanish with the sorter.
+*/
+
+//A stream of fixed length entries in key order.
+class sorted_stream{
+public:
+    virtual ~sorted_stream() {}
+    //Total number of entries of the stream.
+    virtual i64 get_entry_num() = 0;
+    //Point 'entry' to the next entry, valid until the next call. 'entry' is nullptr at the end.
+    virtual i64 next(char *&entry) = 0;
+};
+
+typedef int (*key_compare_routine)(const char *a, const char *b, i64 key_length);
+
+struct sort_run {
+    int fd;
+    i64 entry_num;          //Entries not read into the buffer yet.
+    char *buf;
+    i64 buf_entry_num;      //Entries in the buffer.
+    i64 buf_pos;            //Current entry in the buffer.
+};
+
+class external_sorter : public sorted_stream{
+private:
+    static const i64 run_buffer_size = 1 << 16;     //Read and write buffer of a run.
+    i64 entry_length, key_length;
+    key_compare_routine compare;
+
+    char *entries;                  //Memory buffer.
+    char **order, **merge_buf;      //Entry pointers, sorted in memory.
+    i64 capacity;                   //Entries the memory buffer holds.
+    i64 buffered_num;               //Entries in the memory buffer.
+    i64 entry_num;                  //Entries added.
+    i64 output_pos;                 //Next entry of the memory buffer to output, if there is no run.
+
+    struct sort_run *runs;
+    int run_num, run_capacity;
+    int *heap;                      //Runs by current entry, smallest first.
+    int heap_size;
+    int last_run;                   //Run of the entry returned last, advanced on the next call.
+
+    inline char *get_run_entry(int run) {return runs[run].buf + runs[run].buf_pos * entry_length;}
+    inline bool run_less(int a, int b)
+    {
+        int result = compare(get_run_entry(a), get_run_entry(b), key_length);
+        return result < 0 || (result == 0 && a < b);
+    }
+    void sift_down(int i);
+
+    //Sort the memory buffer into 'order'.
+    void sort_buffer();
+    //Sort the memory buffer and write it as a new run.
+    i64 write_run();
+    //Read the next entries of a run into its buffer.
+    i64 fill_run_buffer(struct sort_run *run);
+
+public:
+    //'memory_budget' bytes bound the memory buffer (entries and their pointers).
+    external_sorter(i64 entry_length, i64 key_length, key_compare_routine compare, i64 memory_budget);
+    ~external_sorter();
+    //Copy an entry in.
+    i64 add(const char *entry);
+    //Finish the input: sort what is in memory and prepare the merge. Entries are then read with 'next'.
+    i64 sort();
+    inline i64 get_entry_num() {return entry_num;}
+    inline int get_run_num() {return run_num;}
+    i64 next(char *&entry);
+};
+
+#endif
@@ -1,38 +1,62 @@
 #include "index.h"
+#include "record.h"
+
+#include <time.h>
+#include <sched.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 //     Class index_page methods implementation
-index_page::~index_page()
+i64 index_page::get_page(i64 page_no)
+{
+    i64 ret = index_paged_file->get_page(page_no, handle);
+    if(ret != DB_SUCCESS)
+        return ret;
+    this->page = handle.get_page();
+    this->page_no = page_no;
+    return DB_SUCCESS;
+}
+
+i64 index_page::allocate_page(i64 page_no)
 {
-    index_paged_file->unpin_page(page_no);
+    i64 ret = index_paged_file->allocate_page(page_no, handle);
+    if(ret != DB_SUCCESS)
+        return ret;
+    this->page = handle.get_page();
+    this->page_no = page_no;
+    return DB_SUCCESS;
 }
 
 i64 index_page::create_empty_node(enum index_page_flag flag, i64 page_no)
 {
     if(page_no <= 0)
         return DB_ERROR;
-    i64 ret = index_paged_file->get_page(page_no, this->page);
+    //The page comes zeroed and dirty. A page past the end of file is not read.
+    i64 ret = allocate_page(page_no);
     if(ret != DB_SUCCESS)
         return ret;
     
     index_node_page->index_node_header.flag = flag;
     index_node_page->index_node_header.curr_key_num = 0;
     index_node_page->index_node_header.rightmost_page_no = 0;
-    this->page_no = page_no;
-    index_paged_file->mark_page_dirty(page_no);
+    index_node_page->index_node_header.next_leaf_page_no = 0;
+    index_node_page->index_node_header.prev_leaf_page_no = 0;
 
     return DB_SUCCESS;
 }
 
 /* -------------------------------------- */
 //    Class index methods implementation
-i64 index::open_paged_index_file(char *table_name, char *index_column_name)
+i64 index::open_paged_index_file(char *table_name, char *index_column_name, enum paged_file_mode mode)
 {
     char index_file_name[(MAX_STRING_LENGTH + 1) * 2];
 
     strncpy(index_file_name, table_name, MAX_STRING_LENGTH);
     strncat(index_file_name, ":", MAX_STRING_LENGTH);
     strncat(index_file_name, index_column_name, MAX_STRING_LENGTH);
-    i64 ret = index_paged_file.open_paged_file(index_file_name, page_cache);
+    i64 ret = index_paged_file.open_paged_file(index_file_name, page_cache, mode);
     return ret;
 }
 
@@ -44,601 +68,2051 @@ i64 index::create_index(enum index_column_type index_column_type, char *table_na
         return DB_ERROR;
 
     //Get page 0 of index file and fill it with predefined info.
-    ret = index_paged_file.get_page(0, this->page);
+    ret = index_paged_file.get_page(0, header_handle);
     if(ret != DB_SUCCESS) return ret;
+    this->page = header_handle.get_page();
     strncpy(this->index_file_header->index_column_name, index_column_name, MAX_STRING_LENGTH);
     this->index_file_header->index_column_type = index_column_type;
     this->index_file_header->index_column_length = index_column_length;
-    this->index_file_header->slot_num_per_page = (PAGE_SIZE - sizeof(struct index_node_header))/(index_column_length + 2 * sizeof(i64));
+    if(index_column_type == FIXED_LENGTH_STRING)
+        this->index_file_header->slot_num_per_page = compact_page_capacity / (sizeof(unsigned short) + sizeof(struct index_compact_record));
+    else
+        this->index_file_header->slot_num_per_page = (PAGE_SIZE - sizeof(struct index_node_header))/(index_column_length + 2 * sizeof(i64));
     this->index_file_header->next_empty_page_no = 2;
     this->index_file_header->root_page_no = 1;
+    this->index_file_header->free_page_no = 0;
+    this->index_file_header->free_page_num = 0;
     //Mark file header page dirty.
-    index_paged_file.mark_page_dirty(0);
+    header_handle.mark_dirty();
+    key_search = get_key_search_routine();
+    rightmost_leaf_page_no = 0;
+    if(init_node_latches() != DB_SUCCESS)
+        return DB_ERROR;
 
     //Create an empty root page.
     class index_page index_node(&index_paged_file);
     return index_node.create_empty_node(Leaf, this->index_file_header->root_page_no);
 }
 
-i64 index::open_index(char *table_name, char *index_column_name)
+i64 index::open_index(char *table_name, char *index_column_name, enum paged_file_mode mode)
 {
     //Open index file
-    i64 ret = open_paged_index_file(table_name, index_column_name);
+    i64 ret = open_paged_index_file(table_name, index_column_name, mode);
     if(ret != DB_SUCCESS)
         return ret;
     
     //Get page 0 of index file.
-    index_paged_file.get_page(0, this->page);
-    return DB_SUCCESS;
+    ret = index_paged_file.get_page(0, header_handle);
+    if(ret != DB_SUCCESS)
+        return ret;
+    this->page = header_handle.get_page();
+    key_search = get_key_search_routine();
+    rightmost_leaf_page_no = 0;
+    return init_node_latches();
 }
 
 i64 index::close_index(){
+    rightmost_leaf_page_no = 0;
+    free_node_latches();
+    //Unpin the file header page before its file is closed.
+    header_handle.release();
     return index_paged_file.close_paged_file();
 }
 
 i64 index::insert(struct index_page_slot *index_slot)
 {
-    char *pos, *insert_pos;
+    i64 ret;
     class index_page *cursor = new class index_page(&index_paged_file);     //Cursor to iterate the tree.
-    cursor->page_no = index_file_header->root_page_no;
-    i64 ret = index_paged_file.get_page(cursor->page_no, cursor->page);
-    if(ret != DB_SUCCESS)
-        return ret;
+    struct index_path path;
+    path.operation = Inserting;
+    path.restructured = false;
 
-    //If root is empty, insert the very first slot on the root page.
-    if(!cursor->index_node_page->index_node_header.curr_key_num){
-        //Make pos point to the first slot on the root page.
-        pos = (char *)(cursor->index_node_page->index_slots);
-        //Fill the first slot.
-        fill_index_page_slot(pos, index_slot);
-        //Now the root has one element.
-        cursor->index_node_page->index_node_header.curr_key_num = 1;
-        //Mark the root page dirty as it has been modified.
-        index_paged_file.mark_page_dirty(cursor->page_no);
-        return DB_SUCCESS;
+    if(is_nan_key((const char *)(index_slot->index_column))){
+        delete cursor;
+        return DB_ERROR;
+    }
+    //Ascending keys go to the last leaf directly.
+    if((ret = append_to_rightmost_leaf(index_slot)) != INDEX_RESTART){
+        delete cursor;
+        return ret;
     }
 
-    //If the root is not empty.
-    else{
-        //Scurry to leaf node.
-        scurry_to_leaf(cursor, index_slot);
-        //Find the position to insert new key in the leaf node.
-        if((ret = find_position_for_new_slot(cursor, index_slot, insert_pos)) != DB_SUCCESS)
-            return ret;
-        
-        //If there is still some vacancy in the leaf node, insert it.
-        if(is_index_page_full(cursor) == false){
-            insert_index_slot_on_page(cursor, index_slot, insert_pos);
-        }
-        //Unfortunately, there is no vacancy in the leaf node, we have to split the node.
-        else{
-            class index_page *new_leaf = new class index_page(&index_paged_file);
-            new_leaf->create_empty_node(Leaf, index_file_header->next_empty_page_no);
-            index_file_header->next_empty_page_no++;    //We simply increment page number as we ignore the delete operation for now.
-            index_paged_file.mark_page_dirty(0);        //Mark page 0 dirty since we changed the 'next_empty_page_no'.
-            ret = fill_split_index_leaf_page(cursor, new_leaf, index_slot, insert_pos);
-            if(ret != DB_SUCCESS){
-                exit(-1); //Ignore the exception handling for now.
-            }
-
-            //If cursor's parent points to the root node, create a brand new root.
-            if(cursor->page_no == index_file_header->root_page_no){
-                class index_page *new_root = new class index_page(&index_paged_file);
-                new_root->create_empty_node(Internal, index_file_header->next_empty_page_no);
-                index_file_header->next_empty_page_no++;    //We simply increment page number as we ignore the delete operation for now.
-                ret = fill_new_root_page(new_root, cursor, new_leaf);
-                if(ret != DB_SUCCESS){
-                    exit(-1); //Ignore the exception handling for now.
-                }
-                delete new_root;
-            }
-
-            //Or else, insert the last key of split cursor to its parent. 
-            else{
-                class index_page *parent = new class index_page(&index_paged_file);
-                find_parent_index_page(cursor, parent);
-
-                ret = insert_to_parent_page(parent, new_leaf, cursor);
-
-                delete parent;
-            }
+    //Scurry to leaf node, recording the path, and insert there. Start again on a concurrent change.
+    do{
+        if((ret = scurry_to_leaf(cursor, (char *)(index_slot->index_column), &path)) == DB_SUCCESS)
+            ret = insert_to_leaf(&path, cursor, index_slot);
+        unlock_index_nodes(&path);
+        release_index_path(&path, path.depth);
+    }while(ret == INDEX_RESTART);
+    delete cursor;
+    return ret;
+}
 
-            delete new_leaf;
-        }
+i64 index::insert_to_leaf(struct index_path *path, class index_page *leaf, struct index_page_slot *index_slot)
+{
+    bool found;
+    const char *key = (const char *)(index_slot->index_column);
+    if(lock_index_node(path, leaf->page_no, path->leaf_version) == false)
+        return INDEX_RESTART;
+
+    //Duplicated key not permitted.
+    i64 pos = search_index_page(leaf, key, found);
+    if(found)
+        return DB_ERROR;
+    if(leaf->index_node_page->index_node_header.next_leaf_page_no == 0)
+        __atomic_store_n(&rightmost_leaf_page_no, leaf->page_no, __ATOMIC_RELAXED);
+
+    //A split changes the parent, which has room for the separator as full nodes are split on the way down, and the
+    //back link of the next leaf.
+    if(has_room_for_slot(leaf, key) == false){
+        struct index_path_node *parent = path->depth ? &path->nodes[path->depth - 1] : nullptr;
+        i64 next_leaf_page_no = leaf->index_node_page->index_node_header.next_leaf_page_no;
+        if((path->depth && lock_index_node(path, parent->page_no, parent->version) == false) ||
+           (next_leaf_page_no && lock_index_node(path, next_leaf_page_no, -1) == false))
+            return INDEX_RESTART;
     }
-    delete cursor;
+    return insert_to_node(path, path->depth, leaf, pos, index_slot, 0);
+}
+
+i64 index::append_to_rightmost_leaf(struct index_page_slot *index_slot)
+{
+    i64 ret = INDEX_RESTART;
+    bool found;
+    const char *key = (const char *)(index_slot->index_column);
+    i64 page_no = __atomic_load_n(&rightmost_leaf_page_no, __ATOMIC_RELAXED);
+    if(page_no == 0 || page_no >= index_file_header->next_empty_page_no)
+        return INDEX_RESTART;
+
+    //The last leaf holds the keys past the last separator, so past its own keys too (it must have some). Its page
+    //may have been freed since it was remembered, and be filled as a new node not linked yet: it is still the one
+    //remembered once locked only if it was not freed (freeing a page forgets it).
+    class index_page leaf(&index_paged_file);
+    struct index_path path;
+    path.locked_num = 0;
+    if(leaf.get_page(page_no) != DB_SUCCESS || lock_index_node(&path, page_no, -1) == false)
+        return INDEX_RESTART;
+    struct index_node_header *header = &leaf.index_node_page->index_node_header;
+    if(__atomic_load_n(&rightmost_leaf_page_no, __ATOMIC_RELAXED) == page_no &&
+       header->flag == Leaf && header->next_leaf_page_no == 0 && header->curr_key_num &&
+       search_index_page(&leaf, key, found) == header->curr_key_num && has_room_for_slot(&leaf, key))
+        ret = insert_index_slot_on_page(&leaf, header->curr_key_num, index_slot);
+    unlock_index_nodes(&path);
     return ret;
 }
 
 i64 index::search_key(struct index_page_slot *index_slot)
 {
-    i64 i, node_key_num;
+    i64 ret;
     class index_page *cursor = new class index_page(&index_paged_file);
-    i64 ret = index_paged_file.get_page(index_file_header->root_page_no, cursor->page);//Start from the root page.
-    cursor->page_no = index_file_header->root_page_no;
-    if(ret != DB_SUCCESS)
-        return ret;
-    
-    index_slot->page_no = -1; //To signal the caller that the specified index key is not found.
-    index_slot->slot_no = -1;
-    //If root is empty, return.
-    node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
-    if(!node_key_num)
-        return DB_SUCCESS;
-
-    //Scurry to leaf node.
-    if((ret = scurry_to_leaf(cursor, index_slot)) != DB_SUCCESS){
-        return ret;
-    }
+    struct index_path path;
+    path.operation = Searching;
 
-    //Here, we arrived at a leaf node.
-    node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
-
-    if(find_index_slot_on_page(cursor, index_slot)){
+    if(is_nan_key((const char *)(index_slot->index_column))){
+        index_slot->page_no = -1;
+        index_slot->slot_no = -1;
         delete cursor;
         return DB_SUCCESS;
     }
-
+    do{
+        index_slot->page_no = -1; //To signal the caller that the specified index key is not found.
+        index_slot->slot_no = -1;
+        //Scurry to leaf node. The slot found is the one of the key if the leaf did not change meanwhile.
+        if((ret = scurry_to_leaf(cursor, (char *)(index_slot->index_column), &path)) == DB_SUCCESS){
+            find_index_slot_on_page(cursor, index_slot);
+            if(validate_node_version(cursor->page_no, path.leaf_version) == false)
+                ret = INDEX_RESTART;
+        }
+        release_index_path(&path, path.depth);
+    }while(ret == INDEX_RESTART);
     delete cursor;
-    return DB_SUCCESS;
+    if(ret != DB_SUCCESS){
+        index_slot->page_no = -1;
+        index_slot->slot_no = -1;
+    }
+    return ret;
 }
 
 void index::fill_index_page_slot(char *pos, struct index_page_slot *index_slot)
 {
+    const char *key = (const char *)(index_slot->index_column);
+    i64 index_column_length = index_file_header->index_column_length;
     switch(index_file_header->index_column_type){
-        case FIXED_LENGTH_STRING:
-            strncpy(pos, (const char *)(index_slot->index_column), index_file_header->index_column_length);
+        case LONG_LONG:
+            long_long_key::copy(pos, key, index_column_length);
+        break;
+        case DOUBLE:
+            double_key::copy(pos, key, index_column_length);
         break;
         default:
-            memcpy(pos, index_slot->index_column, index_file_header->index_column_length);
+            fixed_length_string_key::copy(pos, key, index_column_length);
         break;
     }
-    i64 *tmp_pos = (i64 *)(pos + index_file_header->index_column_length);
+    i64 *tmp_pos = (i64 *)(pos + index_column_length);
     *tmp_pos++ = index_slot->page_no;
     *tmp_pos = index_slot->slot_no;
 }
 
-i64 index::scurry_to_leaf(class index_page *&cursor, struct index_page_slot *index_slot)
+inline char *index::get_node_key(class index_page *cursor, i64 i)
 {
-    i64 i, node_key_num, child_page_no, ret;
-    i64 *tmp_pos;
-    char *key = (char *)(index_slot->index_column);
-    char *pos = (char *)(cursor->index_node_page->index_slots);int j = 0;
-
-    while(cursor->index_node_page->index_node_header.flag == Internal){//cout<<j++<<"layer:"<<cursor->page_no<<endl;
-        pos = (char *)(cursor->index_node_page->index_slots);
-        node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
-        for(i = 0; i < node_key_num; ++i){
-            if(index_file_header->index_column_type == FIXED_LENGTH_STRING){
-                if(strncmp(key, pos, index_file_header->index_column_length) <= 0)
-                    break;
-            }
-            else{
-                if(memcmp(key, pos, index_file_header->index_column_length) <= 0)
-                    break;
-            }
-            pos += index_file_header->index_column_length + sizeof(i64) * 2;
-        }
-
-        tmp_pos = (i64 *)(pos + index_file_header->index_column_length);
-        if(i < node_key_num)
-            child_page_no = *tmp_pos;
-        else
-            child_page_no = cursor->index_node_page->index_node_header.rightmost_page_no;
+    return (char *)(cursor->index_node_page->index_slots) + i * index_file_header->index_column_length;
+}
 
-        cursor->index_paged_file->unpin_page(cursor->page_no);
-        cursor->page_no = child_page_no;
-        if((ret = cursor->index_paged_file->get_page(child_page_no,cursor->page)) != DB_SUCCESS)
-            return ret;
-    }
-    return DB_SUCCESS;
+inline i64 *index::get_node_rid(class index_page *cursor, i64 i)
+{
+    //The pointers follow the room for all keys of the page.
+    return (i64 *)((char *)(cursor->index_node_page->index_slots) +
+                   index_file_header->slot_num_per_page * index_file_header->index_column_length) + i * 2;
 }
 
-bool index::find_index_slot_on_page(class index_page *cursor, struct index_page_slot *index_slot)
+inline struct index_compact_record *index::get_compact_record(class index_page *cursor, i64 i)
 {
-    bool found = false;
-    i64 node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
-    char *key = (char *)index_slot->index_column;
-    char *pos = (char *)(cursor->index_node_page->index_slots);
+    return (struct index_compact_record *)(cursor->page + cursor->index_compact_page->slot_offsets[i]);
+}
 
-    for(i64 i = 0; i < node_key_num; ++i){
-        if(index_file_header->index_column_type == FIXED_LENGTH_STRING){
-            if(!strncmp(key, pos, index_file_header->index_column_length)){
-                found = true;
-                break;
-            }
-        }
-        else{
-            if(!memcmp(key, pos, index_file_header->index_column_length)){
-                found = true;
-                break;
-            }
-        }
-        pos += index_file_header->index_column_length + sizeof(i64) * 2;
-    }
-    if(found == true){
-        pos += index_file_header->index_column_length;
-        memcpy(&index_slot->page_no, pos, sizeof(i64) * 2);
-    }
-    return found;
+inline char *index::get_compact_prefix(class index_page *cursor)
+{
+    return cursor->page + PAGE_SIZE - cursor->index_compact_page->prefix_length;
 }
 
-i64 index::find_position_for_new_slot(class index_page *cursor, struct index_page_slot *index_slot, char *&insert_pos)
+inline i64 index::get_compact_suffix_length(class index_page *cursor, i64 i)
 {
-    int res;
-    i64 i;
-    i64 node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
-    char *key = (char *)index_slot->index_column;
-    char *pos = (char *)(cursor->index_node_page->index_slots);
+    i64 offset = cursor->index_compact_page->slot_offsets[i];
+    if(offset < (i64)sizeof(struct index_compact_page) || offset > PAGE_SIZE - (i64)sizeof(struct index_compact_record))
+        return -1;
+    i64 suffix_length = get_compact_record(cursor, i)->suffix_length;
+    return (offset + (i64)sizeof(struct index_compact_record) + suffix_length <= PAGE_SIZE) ? suffix_length : -1;
+}
 
-    for(i = 0; i < node_key_num; ++i){
-        if(index_file_header->index_column_type == FIXED_LENGTH_STRING){
-            res = strncmp(key, pos, index_file_header->index_column_length);
-            if(res < 0)
-                break;
-            else if(!res)
-                goto duplicated_key_error; //Duplicated key not permitted.
-        }
-        else{
-            res = memcmp(key, pos, index_file_header->index_column_length);
-            if(res < 0)
-                break;
-            else if(!res)
-                goto duplicated_key_error; //Duplicated key not permitted.
-        }
-        pos += index_file_header->index_column_length + sizeof(i64) * 2;
-    }
-    insert_pos = pos;
-    return DB_SUCCESS;
+inline i64 index::get_compact_page_used(class index_page *cursor)
+{
+    struct index_compact_page *compact_page = cursor->index_compact_page;
+    return compact_page->index_node_header.curr_key_num * sizeof(unsigned short) + compact_page->heap_length -
+           compact_page->garbage_length;
+}
 
-duplicated_key_error:
-    insert_pos = nullptr;
-    return DB_ERROR;
+//Length of the prefix shared by two strings.
+static inline i64 common_prefix_length(const char *a, i64 a_length, const char *b, i64 b_length)
+{
+    i64 length = (a_length < b_length) ? a_length : b_length, i;
+    for(i = 0; i < length && a[i] == b[i]; ++i);
+    return i;
 }
 
-inline bool index::is_index_page_full(class index_page *cursor)
+//Compare two strings of known lengths in the order strncmp gives their NUL padded keys.
+static inline int compare_key_bytes(const char *a, i64 a_length, const char *b, i64 b_length)
 {
-    return cursor->index_node_page->index_node_header.curr_key_num >= index_file_header->slot_num_per_page;
+    int res = memcmp(a, b, (a_length < b_length) ? a_length : b_length);
+    if(res)
+        return res;
+    return (a_length > b_length) - (a_length < b_length);
 }
 
-i64 index::insert_index_slot_on_page(class index_page *cursor, struct index_page_slot *index_slot, char *insert_pos)
+i64 index::get_compact_slots_size(char *slots, i64 num)
 {
-    if(is_index_page_full(cursor) == true)
-        return DB_ERROR;
-    
-    int i;
-    i64 node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
-    i64 index_slot_len = index_file_header->index_column_length + sizeof(i64) * 2;
-    i64 pos = (insert_pos - (char *)cursor->index_node_page->index_slots) / index_slot_len;
-    char *slot_pos = (char *)cursor->index_node_page->index_slots + node_key_num * index_slot_len;
-    //Right shift existed slots.
-    for(i = node_key_num; i > pos; --i){
-        memcpy(slot_pos, slot_pos - index_slot_len, index_slot_len);
-        slot_pos -= index_slot_len;
+    i64 index_column_length = index_file_header->index_column_length;
+    i64 index_slot_len = get_index_slot_len();
+    if(num == 0)
+        return 0;
+
+    //Keys are in order, so the prefix of the first and the last key is common to all of them.
+    char *last = slots + (num - 1) * index_slot_len;
+    i64 prefix_length = common_prefix_length(slots, strnlen(slots, index_column_length), last,
+                                             strnlen(last, index_column_length));
+    i64 size = prefix_length + num * (sizeof(unsigned short) + sizeof(struct index_compact_record));
+    for(i64 i = 0; i < num; ++i){
+        size += strnlen(slots + i * index_slot_len, index_column_length) - prefix_length;
     }
-    //Insert new slot.
-    fill_index_page_slot(insert_pos, index_slot);
+    return size;
+}
 
-    //Increment slot number of current page.
-    cursor->index_node_page->index_node_header.curr_key_num++;
-    index_paged_file.mark_page_dirty(cursor->page_no);
+//Node search routines of numeric keys (key_search_routine).
+#define SIMD_SEARCH_KEYS 32     //Keys counted with vector compares once a node is bisected down to them.
 
-    return DB_SUCCESS;
+//Halve the range with a conditional move instead of a branch, so nothing is mispredicted, until 'len' keys are
+//left. The position searched is between the first key left and the one after the last.
+template <class key_type>
+static inline const char *bisect_keys(const char *keys, i64 &len, const char *key, i64 min_len)
+{
+    const char *base = keys;
+    while(len > min_len){
+        i64 half = len / 2;
+        base = (key_type::compare(base + half * sizeof(long long), key, sizeof(long long)) < 0) ?
+               base + half * sizeof(long long) : base;
+        len -= half;
+    }
+    return base;
 }
 
-i64 index::fill_split_index_leaf_page(class index_page *cursor, class index_page *new_page, 
-                                 struct index_page_slot *index_slot, char *insert_pos)
+template <class key_type>
+static i64 search_keys_scalar(const char *keys, i64 key_num, const char *key)
 {
-    if(!cursor || !new_page || !index_slot || !insert_pos)
-        return DB_ERROR;
-
-    int i;
-    i64 index_slot_len = index_file_header->index_column_length + sizeof(i64) * 2;
-    i64 pos = (insert_pos - (char *)cursor->index_node_page->index_slots) / index_slot_len;
-    char *slot_pos = (char *)cursor->index_node_page->index_slots;
-    i64 total_key_num = index_file_header->slot_num_per_page + 1;
-
-    //Page cursor must be full, or the page should not be split.
-    if(cursor->index_node_page->index_node_header.curr_key_num < index_file_header->slot_num_per_page)
-        return DB_ERROR;
-
-    //Create a temporary buffer to store all page index slot including the new one.
-    char *buf = new char [index_slot_len * total_key_num];
-    if(buf == nullptr)
-        return DB_ERROR;
+    if(!key_num)
+        return 0;
+    i64 len = key_num;
+    const char *base = bisect_keys<key_type>(keys, len, key, 1);
+    return (base - keys) / sizeof(long long) + (key_type::compare(base, key, sizeof(long long)) < 0);
+}
 
-    char *buf_pos = buf;
-    //Fill the temporary buffer.
-    for(i = 0; i < total_key_num; ++i){
-        if(i < pos){
-            memcpy(buf_pos, slot_pos, index_slot_len);
-            slot_pos += index_slot_len;
-        }
-        else if(i == pos){
-            fill_index_page_slot(buf_pos, index_slot);
-        }
-        else{
-            memcpy(buf_pos, slot_pos, index_slot_len);
-            slot_pos += index_slot_len;
-        }
-        buf_pos += index_slot_len;
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,popcnt")))
+static i64 search_long_long_keys_avx2(const char *keys, i64 key_num, const char *key)
+{
+    i64 len = key_num, less = 0, i = 0;
+    const char *base = bisect_keys<long_long_key>(keys, len, key, SIMD_SEARCH_KEYS);
+    long long value;
+    memcpy(&value, key, sizeof(value));
+    __m256i target = _mm256_set1_epi64x(value);
+    for(; i + 4 <= len; i += 4){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(base + i * sizeof(long long)));
+        less += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(target, v))));
     }
-
-    i64 cursor_key_num = cursor->index_node_page->index_node_header.curr_key_num = total_key_num / 2;
-    i64 new_page_key_num = new_page->index_node_page->index_node_header.curr_key_num = total_key_num - cursor_key_num;
-    new_page->index_node_page->index_node_header.flag = Leaf;
-
-    buf_pos = buf;
-    slot_pos = (char *)cursor->index_node_page->index_slots;
-    memcpy(slot_pos, buf_pos, index_slot_len * cursor_key_num);
-
-    buf_pos +=  index_slot_len * cursor_key_num;
-    slot_pos = (char *)new_page->index_node_page->index_slots;
-    memcpy(slot_pos, buf_pos, index_slot_len * new_page_key_num);
-
-    //Mark modified pages dirty.
-    index_paged_file.mark_page_dirty(cursor->page_no);
-    index_paged_file.mark_page_dirty(new_page->page_no);
-
-    delete [] buf;
-    return DB_SUCCESS;
+    for(; i < len; ++i){
+        less += long_long_key::compare(base + i * sizeof(long long), key, sizeof(long long)) < 0;
+    }
+    return (base - keys) / sizeof(long long) + less;
 }
 
-i64 index::fill_split_index_internal_page(class index_page *parent, class index_page *new_parent, class index_page *new_child,
-                                 struct index_page_slot *index_slot, char *insert_pos)
+__attribute__((target("avx2,popcnt")))
+static i64 search_double_keys_avx2(const char *keys, i64 key_num, const char *key)
 {
-    if(!parent || !new_parent || !index_slot || !insert_pos)
-        return DB_ERROR;
-
-    int i;
-    i64 index_slot_len = index_file_header->index_column_length + sizeof(i64) * 2;
-    i64 pos = (insert_pos - (char *)parent->index_node_page->index_slots) / index_slot_len;
-    char *slot_pos = (char *)parent->index_node_page->index_slots;
-    i64 total_key_num = index_file_header->slot_num_per_page + 1;
-
-    //Page parent must be full, or the page should not be split.
-    if(parent->index_node_page->index_node_header.curr_key_num < index_file_header->slot_num_per_page)
-        return DB_ERROR;
-
-    //Create a temporary buffer to store all page index slot including the new one.
-    char *buf = new char [index_slot_len * (total_key_num)];
-    if(buf == nullptr)
-        return DB_ERROR;
+    i64 len = key_num, less = 0, i = 0;
+    const char *base = bisect_keys<double_key>(keys, len, key, SIMD_SEARCH_KEYS);
+    double value;
+    memcpy(&value, key, sizeof(value));
+    __m256d target = _mm256_set1_pd(value);
+    for(; i + 4 <= len; i += 4){
+        __m256d v = _mm256_loadu_pd((const double *)(base + i * sizeof(double)));
+        less += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(v, target, _CMP_LT_OQ)));
+    }
+    for(; i < len; ++i){
+        less += double_key::compare(base + i * sizeof(double), key, sizeof(double)) < 0;
+    }
+    return (base - keys) / sizeof(double) + less;
+}
 
-    char *buf_pos = buf;
-    //Fill the temporary buffer.
-    for(i = 0; i < total_key_num; ++i){
-        if(i < pos){
-            memcpy(buf_pos, slot_pos, index_slot_len);
-        }
-        else if(i == pos){
-            //Insert old sibling rightmost key and its corresponding page no.
-            fill_index_page_slot(buf_pos, index_slot);
-            buf_pos += index_slot_len;
+__attribute__((target("sse4.2,popcnt")))
+static i64 search_long_long_keys_sse42(const char *keys, i64 key_num, const char *key)
+{
+    i64 len = key_num, less = 0, i = 0;
+    const char *base = bisect_keys<long_long_key>(keys, len, key, SIMD_SEARCH_KEYS);
+    long long value;
+    memcpy(&value, key, sizeof(value));
+    __m128i target = _mm_set1_epi64x(value);
+    for(; i + 2 <= len; i += 2){
+        __m128i v = _mm_loadu_si128((const __m128i *)(base + i * sizeof(long long)));
+        less += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(target, v))));
+    }
+    if(i < len)
+        less += long_long_key::compare(base + i * sizeof(long long), key, sizeof(long long)) < 0;
+    return (base - keys) / sizeof(long long) + less;
+}
 
-            //All slots on parent page has been copied to the buffer, break.
-            if(i == index_file_header->slot_num_per_page)
-                break;
+__attribute__((target("sse4.2,popcnt")))
+static i64 search_double_keys_sse42(const char *keys, i64 key_num, const char *key)
+{
+    i64 len = key_num, less = 0, i = 0;
+    const char *base = bisect_keys<double_key>(keys, len, key, SIMD_SEARCH_KEYS);
+    double value;
+    memcpy(&value, key, sizeof(value));
+    __m128d target = _mm_set1_pd(value);
+    for(; i + 2 <= len; i += 2){
+        __m128d v = _mm_loadu_pd((const double *)(base + i * sizeof(double)));
+        less += __builtin_popcount(_mm_movemask_pd(_mm_cmplt_pd(v, target)));
+    }
+    if(i < len)
+        less += double_key::compare(base + i * sizeof(double), key, sizeof(double)) < 0;
+    return (base - keys) / sizeof(double) + less;
+}
+#endif
 
-            //Assign new sibling page no to the key at original 'insert_pos'.
-            memcpy(buf_pos, slot_pos, index_file_header->index_column_length);
-            i64 *new_sibling_page_no = (i64*)((char *)buf_pos + index_file_header->index_column_length);
-            *new_sibling_page_no = new_child->page_no;
-        }
-        else{
-            //All slots on parent page has been copied to the buffer, break.
-            if(i == index_file_header->slot_num_per_page) 
-                break;
-            memcpy(buf_pos, slot_pos, index_slot_len);
+i64 index::search_compact_page(class index_page *cursor, const char *key, bool &found, i64 from)
+{
+    i64 node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
+    i64 key_length = strnlen(key, index_file_header->index_column_length);
+    i64 prefix_length = cursor->index_compact_page->prefix_length;
+    i64 record_suffix_length;
+    int res = 1;
+
+    //The page may be changing (it is read without a latch): what does not lie within it ends the search, and the
+    //caller sees the change in the version of the node.
+    found = false;
+    if(prefix_length > compact_page_capacity)
+        return 0;
+
+    //The prefix is compared once: a key outside of it is less or greater than all keys of the node.
+    res = memcmp(key, get_compact_prefix(cursor), (key_length < prefix_length) ? key_length : prefix_length);
+    if(res == 0 && key_length < prefix_length)
+        res = -1;
+    if(res < 0)
+        return 0;
+    if(res > 0)
+        return node_key_num;
+
+    //Binary search down to a few slots which are scanned in order (cheaper than mispredicted branches and
+    //scattered cache lines).
+    const char *suffix = key + prefix_length;
+    i64 suffix_length = key_length - prefix_length;
+    i64 low = (from < node_key_num) ? from : node_key_num, high = node_key_num;
+    //Keys searched in order are near the slot of the previous one: gallop from it.
+    for(i64 step = linear_search_slots; from && low + step < high; step *= 2){
+        i64 mid = low + step;
+        if((record_suffix_length = get_compact_suffix_length(cursor, mid)) < 0)
+            return 0;
+        if(compare_key_bytes(get_compact_record(cursor, mid)->suffix, record_suffix_length, suffix, suffix_length) >= 0){
+            high = mid;
+            break;
         }
-        slot_pos += index_slot_len;
-        buf_pos += index_slot_len;
+        low = mid + 1;
+    }
+    while(high - low > linear_search_slots){
+        i64 mid = (low + high) / 2;
+        if((record_suffix_length = get_compact_suffix_length(cursor, mid)) < 0)
+            return 0;
+        if(compare_key_bytes(get_compact_record(cursor, mid)->suffix, record_suffix_length, suffix, suffix_length) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    res = 1;
+    for(; low < node_key_num; ++low){
+        if((record_suffix_length = get_compact_suffix_length(cursor, low)) < 0)
+            return 0;
+        if((res = compare_key_bytes(get_compact_record(cursor, low)->suffix, record_suffix_length, suffix, suffix_length)) >= 0)
+            break;
     }
+    found = (res == 0);
+    return low;
+}
 
-    i64 parent_key_num = parent->index_node_page->index_node_header.curr_key_num = total_key_num / 2;
-    i64 new_parent_key_num = new_parent->index_node_page->index_node_header.curr_key_num = total_key_num - parent_key_num;
-    new_parent->index_node_page->index_node_header.flag = Internal;
+i64 index::search_index_page(class index_page *cursor, const char *key, bool &found, i64 from)
+{
+    if(is_compact_index())
+        return search_compact_page(cursor, key, found, from);
 
-    buf_pos = buf;
-    slot_pos = (char *)parent->index_node_page->index_slots;
-    memcpy(slot_pos, buf_pos, index_slot_len * parent_key_num);
+    //Find the first slot not less than 'key' with the search chosen for the index.
+    i64 node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
+    if(from > node_key_num)
+        from = node_key_num;
+    i64 i = from + key_search(get_node_key(cursor, from), node_key_num - from, key);
+    if(i < node_key_num){
+        char *node_key = get_node_key(cursor, i);
+        found = (index_file_header->index_column_type == DOUBLE) ? double_key::compare(node_key, key, sizeof(double)) == 0 :
+                long_long_key::compare(node_key, key, sizeof(long long)) == 0;
+    }
+    else
+        found = false;
+    return i;
+}
 
-    buf_pos +=  index_slot_len * parent_key_num;
-    slot_pos = (char *)new_parent->index_node_page->index_slots;
-    memcpy(slot_pos, buf_pos, index_slot_len * new_parent_key_num);
+void index::get_slot_key(class index_page *cursor, i64 i, char *key)
+{
+    if(!is_compact_index()){
+        memcpy(key, get_node_key(cursor, i), index_file_header->index_column_length);
+        return;
+    }
+    struct index_compact_record *record = get_compact_record(cursor, i);
+    i64 prefix_length = cursor->index_compact_page->prefix_length;
+    memset(key, 0, index_file_header->index_column_length);
+    memcpy(key, get_compact_prefix(cursor), prefix_length);
+    memcpy(key + prefix_length, record->suffix, record->suffix_length);
+}
 
-    //Mark modified pages dirty.
-    index_paged_file.mark_page_dirty(parent->page_no);
-    index_paged_file.mark_page_dirty(new_parent->page_no);
+bool index::copy_slot_key(class index_page *cursor, i64 i, char *key)
+{
+    i64 index_column_length = index_file_header->index_column_length;
+    if(!is_compact_index()){
+        memcpy(key, get_node_key(cursor, i), index_column_length);
+        return true;
+    }
+    //The prefix and suffix read must make a key.
+    i64 prefix_length = cursor->index_compact_page->prefix_length;
+    i64 suffix_length = get_compact_suffix_length(cursor, i);
+    if(suffix_length < 0 || prefix_length + suffix_length > index_column_length)
+        return false;
+    memset(key, 0, index_column_length);
+    memcpy(key, cursor->page + PAGE_SIZE - prefix_length, prefix_length);
+    memcpy(key + prefix_length, get_compact_record(cursor, i)->suffix, suffix_length);
+    return true;
+}
 
-    delete [] buf;
-    return DB_SUCCESS;
+void index::get_slot_rid(class index_page *cursor, i64 i, struct index_page_slot *index_slot)
+{
+    if(!is_compact_index()){
+        i64 *rid = get_node_rid(cursor, i);
+        index_slot->page_no = rid[0];
+        index_slot->slot_no = rid[1];
+        return;
+    }
+    //A record which does not lie within the page is read from a page changing under a search.
+    if(get_compact_suffix_length(cursor, i) < 0){
+        index_slot->page_no = index_slot->slot_no = -1;
+        return;
+    }
+    struct index_compact_record *record = get_compact_record(cursor, i);
+    index_slot->page_no = record->page_no;
+    index_slot->slot_no = record->slot_no;
 }
 
-i64 index::fill_new_root_page(class index_page *root, class index_page *left_child, class index_page *right_child)
+inline i64 index::get_child_page_no(class index_page *node, i64 i)
 {
-    if(!root || !left_child || !right_child)
-        return DB_ERROR;
-    
-    i64 index_slot_len = index_file_header->index_column_length + sizeof(i64) * 2;
-    char *pos_root = (char *)root->index_node_page->index_slots;
+    if(i == node->index_node_page->index_node_header.curr_key_num)
+        return node->index_node_page->index_node_header.rightmost_page_no;
+    if(is_compact_index())
+        return (get_compact_suffix_length(node, i) < 0) ? 0 : get_compact_record(node, i)->page_no;
+    return get_node_rid(node, i)[0];
+}
 
-    root->index_node_page->index_node_header.curr_key_num = 1;
-    root->index_node_page->index_node_header.flag = Internal;
+inline void index::set_child_page_no(class index_page *node, i64 i, i64 page_no)
+{
+    if(i == node->index_node_page->index_node_header.curr_key_num)
+        node->index_node_page->index_node_header.rightmost_page_no = page_no;
+    else if(is_compact_index())
+        get_compact_record(node, i)->page_no = page_no;
+    else
+        get_node_rid(node, i)[0] = page_no;
+}
 
-    char *left_child_max_key = (char *)left_child->index_node_page->index_slots + \
-                               (left_child->index_node_page->index_node_header.curr_key_num - 1) * index_slot_len;
-    memcpy(pos_root, left_child_max_key, index_file_header->index_column_length);
-    pos_root += index_file_header->index_column_length;
-    *(i64 *)pos_root = left_child->page_no; 
-    root->index_node_page->index_node_header.rightmost_page_no = right_child->page_no;
+i64 index::scurry_to_leaf(class index_page *&cursor, const char *key, struct index_path *path)
+{
+    i64 i, child_page_no, version, ret;
+    bool found;
+
+    path->depth = 0;
+    path->right_edge_depth = 1;
+    path->locked_num = 0;
+    //The root is replaced only while it is locked, which moves its version on.
+    i64 page_no = __atomic_load_n(&index_file_header->root_page_no, __ATOMIC_ACQUIRE);
+    if((ret = cursor->get_page(page_no)) != DB_SUCCESS)
+        return ret;
+    version = read_node_version(page_no);
+    if(__atomic_load_n(&index_file_header->root_page_no, __ATOMIC_ACQUIRE) != page_no)
+        return INDEX_RESTART;
 
-    index_file_header->root_page_no = root->page_no;
-    index_paged_file.mark_page_dirty(0);
+    while(cursor->index_node_page->index_node_header.flag == Internal){
+        //A split or a fix below never goes past the parent.
+        if((path->operation == Inserting && is_index_page_full(cursor)) ||
+           (path->operation == Removing && path->depth && path->restructured == false && is_index_page_underfull(cursor)))
+            return restructure_on_descent(path, cursor, version, path->operation == Inserting &&
+                                          path->depth < path->right_edge_depth && search_index_page(cursor, key, found) ==
+                                          cursor->index_node_page->index_node_header.curr_key_num);
+
+        //The left pointer of the first key not less than ours, or the rightmost pointer. What was read is checked
+        //before the pointer is used, as a writer may be changing the node.
+        i = search_index_page(cursor, key, found);
+        child_page_no = get_child_page_no(cursor, i);
+        if(i == cursor->index_node_page->index_node_header.curr_key_num && path->right_edge_depth == path->depth + 1)
+            path->right_edge_depth++;
+        if(validate_node_version(cursor->page_no, version) == false)
+            return INDEX_RESTART;
+
+        //Record the node, keeping only it pinned, and descend with a new cursor.
+        if(path->depth == MAX_INDEX_TREE_HEIGHT)
+            return DB_ERROR;
+        release_index_path(path, path->depth);
+        struct index_path_node *node = &path->nodes[path->depth++];
+        node->page_no = cursor->page_no;
+        node->slot_i = i;
+        node->version = version;
+        node->page = cursor;
+        cursor = new class index_page(&index_paged_file);
+        if((ret = cursor->get_page(child_page_no)) != DB_SUCCESS)
+            return ret;
 
-    //Mark the new root page dirty.
-    index_paged_file.mark_page_dirty(root->page_no);
+        //The page is still the child if the parent did not change meanwhile (freeing a child changes its parent).
+        version = read_node_version(child_page_no);
+        if(validate_node_version(node->page_no, node->version) == false)
+            return INDEX_RESTART;
+    }
+    path->leaf_version = version;
     return DB_SUCCESS;
 }
 
-i64 index::find_parent_index_page(class index_page *child, class index_page *&parent)
+void index::release_index_path(struct index_path *path, i64 depth)
 {
-    i64 i, node_key_num, child_page_no, ret;
-    i64 *tmp_pos;
-    class index_page *cursor = new class index_page(&index_paged_file);
-    i64 cursor_parent_page_no = -1;
-    char *key = (char *)(child->index_node_page->index_slots); //First key on child index page
-    char *pos; 
+    for(i64 i = 0; i < depth; ++i){
+        delete path->nodes[i].page;
+        path->nodes[i].page = nullptr;
+    }
+}
 
-    if(cursor == nullptr)
-        return DB_ERROR;
+//Bits which order a key as the compare of its column type does. String keys ('key_length' bytes long) take their
+//first 8 bytes from 'skip' on (NUL padded): keys of the same bits are then compared whole, unless none is longer.
+static inline unsigned long long get_key_order_bits(enum index_column_type type, const char *key, i64 key_length,
+                                                    i64 skip, i64 length)
+{
+    unsigned long long bits;
+    if(type == LONG_LONG){
+        memcpy(&bits, key, sizeof(bits));
+        return bits ^ (1ULL << 63);
+    }
+    if(type == DOUBLE){
+        memcpy(&bits, key, sizeof(bits));
+        return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+    }
+    if(key_length <= skip)
+        return 0;
+    if(skip + 8 > length){
+        bits = 0;
+        for(i64 i = skip; i < skip + 8; ++i){
+            bits = (bits << 8) | ((i < key_length) ? (unsigned char)key[i] : 0);
+        }
+        return bits;
+    }
+    memcpy(&bits, key + skip, sizeof(bits));
+    bits = __builtin_bswap64(bits);
+    return (key_length < skip + 8) ? bits & (~0ULL << ((skip + 8 - key_length) * 8)) : bits;
+}
 
-    //Search from root page.
-    cursor->page_no = index_file_header->root_page_no;
-    index_paged_file.get_page(cursor->page_no, cursor->page);
+static int compare_index_probes(const void *a, const void *b, void *arg)
+{
+    return strncmp((const char *)(((struct index_probe *)a)->slot->index_column),
+                   (const char *)(((struct index_probe *)b)->slot->index_column), *(i64 *)arg);
+}
 
-    while(cursor->index_node_page->index_node_header.flag == Internal){
-        //If the child is an internal page.
-        if(child->page_no == cursor->page_no){
-            parent->page_no = cursor_parent_page_no;
-            index_paged_file.get_page(cursor_parent_page_no, parent->page);
-            delete cursor;
-            return DB_SUCCESS;
+void index::sort_index_probes(struct index_probe *probes, i64 num)
+{
+    enum index_column_type type = index_file_header->index_column_type;
+    i64 index_column_length = index_file_header->index_column_length;
+    i64 skip = 0, key_length = 0, max_key_length = 0, i, j;
+    bool sorted = true;
+
+    //String keys are ordered by the bytes after the prefix they all share.
+    if(type == FIXED_LENGTH_STRING){
+        const char *first = (const char *)(probes[0].slot->index_column);
+        skip = strnlen(first, index_column_length);
+        for(i = 1; i < num && skip; ++i){
+            const char *key = (const char *)(probes[i].slot->index_column);
+            skip = common_prefix_length(first, skip, key, strnlen(key, index_column_length));
         }
+    }
+    for(i = 0; i < num; ++i){
+        const char *key = (const char *)(probes[i].slot->index_column);
+        if(type == FIXED_LENGTH_STRING && (key_length = strnlen(key, index_column_length)) > max_key_length)
+            max_key_length = key_length;
+        probes[i].order = get_key_order_bits(type, key, key_length, skip, index_column_length);
+        if(i && probes[i - 1].order > probes[i].order)
+            sorted = false;
+    }
 
-        cursor_parent_page_no = cursor->page_no;
-        pos = (char *)(cursor->index_node_page->index_slots);
-        node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
-        for(i = 0; i < node_key_num; ++i){
-            if(index_file_header->index_column_type == FIXED_LENGTH_STRING){
-                if(strncmp(key, pos, index_file_header->index_column_length) <= 0)
-                    break;
+    //Batches often come sorted already. Few keys are sorted by insertion, more by a radix sort of their bits.
+    if(sorted == false && num <= batch_insertion_sort_keys){
+        for(i = 1; i < num; ++i){
+            struct index_probe probe = probes[i];
+            for(j = i; j && probes[j - 1].order > probe.order; --j)
+                probes[j] = probes[j - 1];
+            probes[j] = probe;
+        }
+    }
+    else if(sorted == false){
+        struct index_probe *buffer = new struct index_probe [num], *from = probes, *to = buffer, *swap;
+        i64 counts[8][256];
+        memset(counts, 0, sizeof(counts));
+        for(i = 0; i < num; ++i){
+            for(int b = 0; b < 8; ++b)
+                counts[b][(probes[i].order >> (b * 8)) & 0xff]++;
+        }
+        for(int b = 0; b < 8; ++b){
+            //A byte which all keys share does not change their order.
+            if(counts[b][(from[0].order >> (b * 8)) & 0xff] == num)
+                continue;
+            for(i = 0, j = 0; i < 256; ++i){
+                i64 count = counts[b][i];
+                counts[b][i] = j;
+                j += count;
             }
-            else{
-                if(memcmp(key, pos, index_file_header->index_column_length) <= 0)
-                    break;
+            for(i = 0; i < num; ++i){
+                to[counts[b][(from[i].order >> (b * 8)) & 0xff]++] = from[i];
             }
-            pos += index_file_header->index_column_length + sizeof(i64) * 2;
+            swap = from;
+            from = to;
+            to = swap;
         }
-
-        tmp_pos = (i64 *)(pos + index_file_header->index_column_length);
-        if(i < node_key_num)
-            child_page_no = *tmp_pos;
-        else
-            child_page_no = cursor->index_node_page->index_node_header.rightmost_page_no;
-
-        cursor->index_paged_file->unpin_page(cursor->page_no);
-        cursor->page_no = child_page_no;
-        if((ret = cursor->index_paged_file->get_page(child_page_no,cursor->page)) != DB_SUCCESS)
-            return ret;
+        if(from != probes)
+            memcpy(probes, from, num * sizeof(struct index_probe));
+        delete [] buffer;
     }
 
-    //If we reach here, the child must be a leaf.
-    if(child->page_no == cursor->page_no){
-        parent->page_no = cursor_parent_page_no;
-        index_paged_file.get_page(cursor_parent_page_no, parent->page);
+    //String keys of the same bits are ordered by the whole key, if some go past the bytes of the bits.
+    if(type == FIXED_LENGTH_STRING && max_key_length > skip + 8){
+        for(i = 0; i < num; i = j){
+            for(j = i + 1; j < num && probes[j].order == probes[i].order; ++j);
+            if(j - i > 1)
+                qsort_r(probes + i, j - i, sizeof(struct index_probe), compare_index_probes, &index_column_length);
+        }
     }
-
-    delete cursor;
-    return DB_SUCCESS;
 }
 
-i64 index::insert_to_parent_page(class index_page *parent, class index_page *new_sibling, class index_page *old_sibling)
+i64 index::search_keys(struct index_page_slot *index_slots, i64 num)
 {
-    //Find the position where the last key of old sibling should be inserted.
-    i64 ret, insert_pos_i;
-    char *insert_pos;
-    char *pos = (char *)(old_sibling->index_node_page->index_slots);
-    i64 index_slot_len = index_file_header->index_column_length + sizeof(i64) * 2;
-    pos += (old_sibling->index_node_page->index_node_header.curr_key_num - 1) * index_slot_len;
-
-    //We want to insert the old_siblings largest key to the parent.
-    struct index_page_slot rightmost_slot;
-    rightmost_slot.index_column = pos;
-    rightmost_slot.page_no = old_sibling->page_no;
-    rightmost_slot.slot_no = 0;
+    i64 ret = DB_SUCCESS, i;
+    bool found;
 
-    //Find the position to insert new key in this parent node.
-    if((ret = find_position_for_new_slot(parent, &rightmost_slot, insert_pos)) != DB_SUCCESS)
+    if(num <= 0)
+        return DB_SUCCESS;
+    //Too few keys to make up for sorting them and keeping bounds.
+    if(num <= batch_direct_search_keys){
+        for(i = 0; i < num && ret == DB_SUCCESS; ++i){
+            ret = search_key(&index_slots[i]);
+        }
+        for(; i < num; ++i){
+            index_slots[i].page_no = index_slots[i].slot_no = -1;
+        }
         return ret;
-
-    //Get insert position offset starting from 'index_slots'.
-    insert_pos_i = (insert_pos - (char *)parent->index_node_page->index_slots) / index_slot_len;
-    //If there is still some vacancy in this parent node, insert it.
-    if(is_index_page_full(parent) == false){
-        //If we have to insert new slot to the rightmost position of parent, change the rightmost page number to the new sibling's.        
-        if(insert_pos_i  == parent->index_node_page->index_node_header.curr_key_num){
-            parent->index_node_page->index_node_header.rightmost_page_no = new_sibling->page_no;
-            //cout<<parent->page_no<<' '<<parent->index_node_page->index_node_header.rightmost_page_no<<endl;
+    }
+    //Keys are searched in order.
+    struct index_batch batch;
+    struct index_probe few_probes[batch_insertion_sort_keys];
+    batch.probes = (num <= batch_insertion_sort_keys) ? few_probes : new struct index_probe [num];
+    for(i = 0; i < num; ++i){
+        batch.probes[i].slot = &index_slots[i];
+    }
+    sort_index_probes(batch.probes, num);
+    batch.probe_num = num;
+    batch.compare = get_key_compare_routine();
+    batch.height = batch.leaf_height = batch.prefetch_end = 0;
+    batch.read_bytes = -1;
+    batch.leaf_slot_i = 0;
+    batch.page_num = 0;
+    batch.bounds = new char [(MAX_INDEX_TREE_HEIGHT + 1) * index_file_header->index_column_length];
+
+    for(i = 0; i < num; ){
+        struct index_page_slot *probe = batch.probes[i].slot;
+        //Sorting scattered the slots and keys of the probes: fetch those of the next ones meanwhile.
+        if(i + batch_prefetch_distance * 2 < num)
+            __builtin_prefetch(batch.probes[i + batch_prefetch_distance * 2].slot);
+        if(i + batch_prefetch_distance < num)
+            __builtin_prefetch(batch.probes[i + batch_prefetch_distance].slot->index_column);
+        probe->page_no = -1;
+        probe->slot_no = -1;
+        if(is_nan_key((const char *)(probe->index_column))){
+            ++i;
+            continue;
         }
-        insert_index_slot_on_page(parent, &rightmost_slot, insert_pos);
-
-        //Adjust new sibling page no. in parent node if it is not at the rightmost position of parent.
-        if(insert_pos_i  < parent->index_node_page->index_node_header.curr_key_num){
-            //Change the page no. of next slot of 'insert_pos' to that of 'new_sibling'.
-            i64 *new_sibling_page_no = (i64 *)(insert_pos + index_slot_len + index_file_header->index_column_length);
-            *new_sibling_page_no = new_sibling->page_no;
+        //The slot found is the one of the key if the leaf did not change meanwhile. In a leaf kept, the key is not
+        //before the slot of the previous one.
+        if((ret = scurry_batch_to_leaf(&batch, i)) == DB_SUCCESS){
+            struct index_batch_node *leaf = &batch.nodes[batch.height - 1];
+            batch.leaf_slot_i = search_index_page(leaf->page, (const char *)(probe->index_column), found,
+                                                  batch.leaf_slot_i);
+            if(found)
+                get_slot_rid(leaf->page, batch.leaf_slot_i, probe);
+            if(validate_node_version(leaf->page->page_no, leaf->version) == false)
+                ret = INDEX_RESTART;
+        }
+        //Start again from the root on a concurrent change.
+        if(ret == INDEX_RESTART){
+            batch.height = 0;
+            continue;
         }
+        if(ret != DB_SUCCESS)
+            break;
+        ++i;
     }
 
-    //Unfortunately, there is no vacancy in the parent node, we have no choice but to split the parent as well.
+    //The keys left are not searched on an error.
+    for(; i < num; ++i){
+        batch.probes[i].slot->page_no = -1;
+        batch.probes[i].slot->slot_no = -1;
+    }
+    for(i = 0; i < batch.page_num; ++i){
+        delete batch.nodes[i].page;
+    }
+    delete [] batch.bounds;
+    if(batch.probes != few_probes)
+        delete [] batch.probes;
+    return ret;
+}
+
+i64 index::scurry_batch_to_leaf(struct index_batch *batch, i64 probe_i)
+{
+    i64 i, child_page_no, ret;
+    bool found;
+    i64 index_column_length = index_file_header->index_column_length;
+    const char *key = (const char *)(batch->probes[probe_i].slot->index_column);
+    struct index_batch_node *node;
+
+    //Go back up to the deepest node whose subtree may hold the key: keys come in order, so the key is not before it.
+    while(batch->height && batch->nodes[batch->height - 1].bound &&
+          batch->compare(key, batch->nodes[batch->height - 1].bound, index_column_length) > 0)
+        batch->height--;
+
+    //A node whose version did not change holds the same slots, and its subtree the same keys: any change of its
+    //bound changes the node too.
+    if(batch->height){
+        node = &batch->nodes[batch->height - 1];
+        if(validate_node_version(node->page->page_no, node->version) == false)
+            return INDEX_RESTART;
+    }
     else{
-        class index_page *new_parent = new class index_page(&index_paged_file); 
-        new_parent->create_empty_node(Internal, index_file_header->next_empty_page_no); 
-        index_file_header->next_empty_page_no++;    //We simply increment page number as we ignore the delete operation for now.
+        node = &batch->nodes[0];
+        if(batch->page_num == 0)
+            batch->nodes[batch->page_num++].page = new class index_page(&index_paged_file);
+        i64 page_no = __atomic_load_n(&index_file_header->root_page_no, __ATOMIC_ACQUIRE);
+        if((ret = node->page->get_page(page_no)) != DB_SUCCESS)
+            return ret;
+        node->version = read_node_version(page_no);
+        node->bound = nullptr;
+        batch->leaf_slot_i = 0;
+        if(__atomic_load_n(&index_file_header->root_page_no, __ATOMIC_ACQUIRE) != page_no)
+            return INDEX_RESTART;
+        batch->height = 1;
+    }
 
-        //If we have to insert new slot to the rightmost position of parent, change the rightmost page number of the new parent to the new sibling's. 
-        if(insert_pos_i == parent->index_node_page->index_node_header.curr_key_num){
-            new_parent->index_node_page->index_node_header.rightmost_page_no = new_sibling->page_no;
-        }
-        //Or, assign the rightmost page number of the old parent to the new one's.
-        else{
-            new_parent->index_node_page->index_node_header.rightmost_page_no = parent->index_node_page->index_node_header.rightmost_page_no;
+    while(node->page->index_node_page->index_node_header.flag == Internal){
+        class index_page *cursor = node->page;
+        if(batch->height > MAX_INDEX_TREE_HEIGHT)
+            return DB_ERROR;
+        struct index_batch_node *child = &batch->nodes[batch->height];
+
+        //The child of the key, bounded by the separator of its pointer (by the bound of the node for the rightmost
+        //pointer). What was read is checked before it is used.
+        i = search_index_page(cursor, key, found);
+        child_page_no = get_child_page_no(cursor, i);
+        if(i < cursor->index_node_page->index_node_header.curr_key_num){
+            child->bound = batch->bounds + batch->height * index_column_length;
+            if(copy_slot_key(cursor, i, child->bound) == false)
+                return INDEX_RESTART;
         }
+        else
+            child->bound = node->bound;
+        if(validate_node_version(cursor->page_no, node->version) == false)
+            return INDEX_RESTART;
+
+        //Read ahead the leaves of the keys under a parent of leaves, unless they were already.
+        if(batch->height + 1 == batch->leaf_height && probe_i >= batch->prefetch_end &&
+           index_paged_file.get_mode() != Mapped)
+            prefetch_index_children(batch, cursor, node->version, probe_i, node->bound);
+
+        if(batch->page_num == batch->height)
+            batch->nodes[batch->page_num++].page = new class index_page(&index_paged_file);
+        if((ret = child->page->get_page(child_page_no)) != DB_SUCCESS)
+            return ret;
+        //The page is still the child if the parent did not change meanwhile.
+        child->version = read_node_version(child_page_no);
+        if(validate_node_version(cursor->page_no, node->version) == false)
+            return INDEX_RESTART;
+        batch->height++;
+        batch->leaf_slot_i = 0;
+        node = child;
+    }
+    batch->leaf_height = batch->height;
+    return DB_SUCCESS;
+}
 
-        ret = fill_split_index_internal_page(parent, new_parent, new_sibling, &rightmost_slot, insert_pos);
-        if(ret != DB_SUCCESS){
-            exit(-1); //Ignore exception handling for now.
-        }
+void index::prefetch_index_children(struct index_batch *batch, class index_page *node, i64 version, i64 probe_i,
+                                    const char *bound)
+{
+    i64 page_nos[page_cache::max_readahead_pages];
+    i64 page_num = 0, i, j, k;
+    bool found;
+
+    //Only while leaves come from the disk: the file was read since the last time.
+    i64 read_bytes = index_paged_file.get_read_bytes();
+    if(read_bytes == batch->read_bytes)
+        return;
+    batch->read_bytes = read_bytes;
+
+    //Keys in order go to children in order, so a child taken again is the last one.
+    for(i = probe_i; i < batch->probe_num && page_num < page_cache::max_readahead_pages; ++i){
+        const char *key = (const char *)(batch->probes[i].slot->index_column);
+        if(bound && batch->compare(key, bound, index_file_header->index_column_length) > 0)
+            break;
+        i64 child_page_no = get_child_page_no(node, search_index_page(node, key, found));
+        if(page_num == 0 || page_nos[page_num - 1] != child_page_no)
+            page_nos[page_num++] = child_page_no;
+    }
+    batch->prefetch_end = i;
+    if(validate_node_version(node->page_no, version) == false)
+        return;
+
+    //Pages in a row are read by one request. Cached pages are skipped.
+    for(i = 1; i < page_num; ++i){
+        i64 page_no = page_nos[i];
+        for(j = i; j && page_nos[j - 1] > page_no; --j)
+            page_nos[j] = page_nos[j - 1];
+        page_nos[j] = page_no;
+    }
+    for(j = 0; j < page_num; j = k){
+        for(k = j + 1; k < page_num && page_nos[k] == page_nos[k - 1] + 1; ++k);
+        page_cache->readahead(&index_paged_file, page_nos[j], k - j);
+    }
+}
 
-        //Set parent rightmost page number to the one correspoinding to its current last key.
-        pos = (char *)(parent->index_node_page->index_slots);
-        pos += (parent->index_node_page->index_node_header.curr_key_num - 1) * index_slot_len + index_file_header->index_column_length;
-        parent->index_node_page->index_node_header.rightmost_page_no = *(i64 *)pos;
+i64 index::init_node_latches()
+{
+    free_node_latches();
+    node_latches = (i64 ***)calloc(max_node_latch_blocks, sizeof(i64 **));
+    if(node_latches == nullptr)
+        return DB_ERROR;
+    return add_node_latches(index_file_header->next_empty_page_no);
+}
 
-        //If cursor's parent points to the root node, create a brand new root.
-        if(parent->page_no == index_file_header->root_page_no){
-            class index_page *new_root = new class index_page(&index_paged_file);
-            new_root->create_empty_node(Internal, index_file_header->next_empty_page_no);
-            index_file_header->next_empty_page_no++;    //We simply increment page number as we ignore the delete operation for now.
-            ret = fill_new_root_page(new_root, parent, new_parent);
-            if(ret != DB_SUCCESS){
-                exit(-1); //Ignore exception handling for now.
-            }
-            delete new_root;
+void index::free_node_latches()
+{
+    if(node_latches == nullptr)
+        return;
+    for(i64 i = 0; i < max_node_latch_blocks && node_latches[i]; ++i){
+        for(i64 j = 0; j < (1 << node_latch_block_bits); ++j){
+            free(node_latches[i][j]);
         }
+        free(node_latches[i]);
+    }
+    free(node_latches);
+    node_latches = nullptr;
+    node_latch_page_num = 0;
+}
 
-        //Or else, insert the last key of split cursor to its parent. 
-        else{
-            class index_page *grand_parent = new class index_page(&index_paged_file);
-            find_parent_index_page(parent, grand_parent);
-
-            insert_to_parent_page(grand_parent, new_parent, parent);
-
-            delete grand_parent;
+i64 index::add_node_latches(i64 page_num)
+{
+    //Chunks are published once zeroed: a reader reaches a page only after the page was taken.
+    for(; node_latch_page_num < page_num; node_latch_page_num += 1 << node_latch_chunk_bits){
+        i64 chunk_i = node_latch_page_num >> node_latch_chunk_bits;
+        i64 block_i = chunk_i >> node_latch_block_bits;
+        if(block_i >= max_node_latch_blocks)
+            return DB_ERROR;
+        i64 **block = node_latches[block_i];
+        if(block == nullptr){
+            if((block = (i64 **)calloc(1 << node_latch_block_bits, sizeof(i64 *))) == nullptr)
+                return DB_ERROR;
+            __atomic_store_n(&node_latches[block_i], block, __ATOMIC_RELEASE);
         }
+        i64 *chunk = (i64 *)calloc(1 << node_latch_chunk_bits, sizeof(i64));
+        if(chunk == nullptr)
+            return DB_ERROR;
+        __atomic_store_n(&block[chunk_i & ((1 << node_latch_block_bits) - 1)], chunk, __ATOMIC_RELEASE);
+    }
+    return DB_SUCCESS;
+}
 
-        //Last key of current parent is meaningless, so we ignore it by decreasing the key number by 1.
-        parent->index_node_page->index_node_header.curr_key_num--;
+i64 *index::get_node_latch(i64 page_no)
+{
+    i64 chunk_i = page_no >> node_latch_chunk_bits;
+    i64 **block = __atomic_load_n(&node_latches[chunk_i >> node_latch_block_bits], __ATOMIC_ACQUIRE);
+    i64 *chunk = __atomic_load_n(&block[chunk_i & ((1 << node_latch_block_bits) - 1)], __ATOMIC_ACQUIRE);
+    return chunk + (page_no & ((1 << node_latch_chunk_bits) - 1));
+}
 
-        delete new_parent;
+i64 index::read_node_version(i64 page_no)
+{
+    i64 *latch = get_node_latch(page_no), version;
+    for(int spin = 0; (version = __atomic_load_n(latch, __ATOMIC_ACQUIRE)) & 1; ++spin){
+        if(spin >= max_latch_spins)
+            sched_yield();
     }
-    return ret;
+    return version;
 }
 
+inline bool index::validate_node_version(i64 page_no, i64 version)
+{
+    //The node is read before its version is read again.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(get_node_latch(page_no), __ATOMIC_RELAXED) == version;
+}
 
-// Test stub
-//#define CREAT_INDEX_FILE
+bool index::lock_index_node(struct index_path *path, i64 page_no, i64 version)
+{
+    i64 *latch = get_node_latch(page_no);
+    if(path->locked_num == MAX_LOCKED_INDEX_NODES)
+        return false;
+    if(version == -1 && ((version = __atomic_load_n(latch, __ATOMIC_ACQUIRE)) & 1))
+        return false;
+    if(__atomic_compare_exchange_n(latch, &version, version + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) == false)
+        return false;
+    path->locked_page_nos[path->locked_num++] = page_no;
+    return true;
+}
+
+void index::unlock_index_nodes(struct index_path *path)
+{
+    for(i64 i = 0; i < path->locked_num; ++i){
+        __atomic_add_fetch(get_node_latch(path->locked_page_nos[i]), 1, __ATOMIC_RELEASE);
+    }
+    path->locked_num = 0;
+}
+
+i64 index::lock_index_sibling(struct index_path *path, i64 depth, class index_page *node)
+{
+    i64 ret;
+    struct index_path_node *path_node = &path->nodes[depth - 1];
+    class index_page sibling(&index_paged_file);
+    i64 sibling_page_no = get_child_page_no(path_node->page, (path_node->slot_i > 0) ? path_node->slot_i - 1 : 1);
+    if(lock_index_node(path, sibling_page_no, -1) == false)
+        return INDEX_RESTART;
+    if(node->index_node_page->index_node_header.flag != Leaf)
+        return DB_SUCCESS;
+
+    //The right one of the pair is the node, or the sibling if the node is the first child.
+    class index_page *right = node;
+    if(path_node->slot_i == 0){
+        if((ret = sibling.get_page(sibling_page_no)) != DB_SUCCESS)
+            return ret;
+        right = &sibling;
+    }
+    i64 next_leaf_page_no = right->index_node_page->index_node_header.next_leaf_page_no;
+    if(next_leaf_page_no && lock_index_node(path, next_leaf_page_no, -1) == false)
+        return INDEX_RESTART;
+    return DB_SUCCESS;
+}
+
+i64 index::restructure_on_descent(struct index_path *path, class index_page *node, i64 version, bool append)
+{
+    i64 ret = DB_SUCCESS, depth = path->depth;
+    struct index_path_node *parent = depth ? &path->nodes[depth - 1] : nullptr;
+
+    //Lock the parent and the node at the versions they were read at, so the parent still points to the node.
+    if((depth && lock_index_node(path, parent->page_no, parent->version) == false) ||
+       lock_index_node(path, node->page_no, version) == false)
+        return INDEX_RESTART;
+
+    if(path->operation == Inserting){
+        char *slots = new char [node->index_node_page->index_node_header.curr_key_num * get_index_slot_len()];
+        i64 num = expand_index_page(node, slots);
+        ret = split_index_node(path, depth, node, slots, num, node->index_node_page->index_node_header.rightmost_page_no,
+                               append);
+        delete [] slots;
+    }
+    //A node whose parent has no other child stays as it is.
+    else if(parent->page->index_node_page->index_node_header.curr_key_num == 0)
+        path->restructured = true;
+    else if((ret = lock_index_sibling(path, depth, node)) == DB_SUCCESS){
+        path->restructured = true;
+        ret = fix_underflow(path, depth, node);
+    }
+    return (ret == DB_SUCCESS) ? INDEX_RESTART : ret;
+}
+
+bool index::find_index_slot_on_page(class index_page *cursor, struct index_page_slot *index_slot)
+{
+    bool found;
+    i64 i = search_index_page(cursor, (char *)(index_slot->index_column), found);
+
+    if(found == true)
+        get_slot_rid(cursor, i, index_slot);
+    return found;
+}
+
+inline bool index::is_index_page_full(class index_page *cursor)
+{
+    //A key outside of the prefix may take it all from the other records.
+    if(is_compact_index())
+        return get_compact_page_used(cursor) + (i64)(sizeof(unsigned short) + sizeof(struct index_compact_record)) +
+               index_file_header->index_column_length + cursor->index_compact_page->prefix_length *
+               cursor->index_node_page->index_node_header.curr_key_num > compact_page_capacity;
+    return cursor->index_node_page->index_node_header.curr_key_num >= index_file_header->slot_num_per_page;
+}
+
+bool index::has_room_for_slot(class index_page *cursor, const char *key)
+{
+    if(!is_compact_index())
+        return !is_index_page_full(cursor);
+
+    //A key outside of the prefix shortens it, and every record grows by what the prefix loses.
+    i64 node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
+    i64 key_length = strnlen(key, index_file_header->index_column_length);
+    i64 prefix_length = cursor->index_compact_page->prefix_length;
+    i64 new_prefix_length = common_prefix_length(key, key_length, get_compact_prefix(cursor), prefix_length);
+    i64 size = get_compact_page_used(cursor) + (prefix_length - new_prefix_length) * (node_key_num - 1) +
+               sizeof(unsigned short) + sizeof(struct index_compact_record) + key_length - new_prefix_length;
+    return size <= compact_page_capacity;
+}
+
+bool index::is_index_page_underfull(class index_page *cursor)
+{
+    if(is_compact_index())
+        return get_compact_page_used(cursor) * 2 < compact_page_capacity;
+    return cursor->index_node_page->index_node_header.curr_key_num < index_file_header->slot_num_per_page / 2;
+}
+
+bool index::is_index_page_above_min(class index_page *cursor)
+{
+    if(is_compact_index())
+        return (get_compact_page_used(cursor) - (i64)(sizeof(unsigned short) + sizeof(struct index_compact_record)) -
+                index_file_header->index_column_length) * 2 >= compact_page_capacity;
+    return cursor->index_node_page->index_node_header.curr_key_num > index_file_header->slot_num_per_page / 2;
+}
+
+bool index::index_slots_fit(char *slots, i64 num)
+{
+    if(is_compact_index())
+        return get_compact_slots_size(slots, num) <= compact_page_capacity;
+    return num <= index_file_header->slot_num_per_page;
+}
+
+i64 index::insert_index_slot_on_page(class index_page *cursor, i64 pos, struct index_page_slot *index_slot)
+{
+    if(has_room_for_slot(cursor, (char *)(index_slot->index_column)) == false)
+        return DB_ERROR;
+
+    i64 node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
+    i64 index_slot_len = get_index_slot_len();
+    if(!is_compact_index()){
+        //Right shift existed keys and pointers, and insert new slot.
+        i64 index_column_length = index_file_header->index_column_length;
+        char *key_pos = get_node_key(cursor, pos);
+        i64 *rid = get_node_rid(cursor, pos);
+        memmove(key_pos + index_column_length, key_pos, (node_key_num - pos) * index_column_length);
+        memmove(rid + 2, rid, (node_key_num - pos) * sizeof(i64) * 2);
+        memcpy(key_pos, index_slot->index_column, index_column_length);
+        rid[0] = index_slot->page_no;
+        rid[1] = index_slot->slot_no;
+        cursor->index_node_page->index_node_header.curr_key_num++;
+        cursor->mark_dirty();
+        return DB_SUCCESS;
+    }
+
+    struct index_compact_page *compact_page = cursor->index_compact_page;
+    const char *key = (const char *)(index_slot->index_column);
+    i64 key_length = strnlen(key, index_file_header->index_column_length);
+    i64 prefix_length = compact_page->prefix_length;
+    i64 record_length = sizeof(struct index_compact_record) + key_length - prefix_length;
+    i64 free_length = PAGE_SIZE - compact_page->heap_length - sizeof(struct index_compact_page) -
+                      (node_key_num + 1) * sizeof(unsigned short);
+    //The page is rewritten if the key is outside of its prefix, or if the room is in garbage.
+    if(key_length < prefix_length || memcmp(key, get_compact_prefix(cursor), prefix_length) || free_length < record_length){
+        char *slots = new char [(node_key_num + 1) * index_slot_len];
+        expand_index_page(cursor, slots);
+        memmove(slots + (pos + 1) * index_slot_len, slots + pos * index_slot_len, (node_key_num - pos) * index_slot_len);
+        fill_index_page_slot(slots + pos * index_slot_len, index_slot);
+        i64 ret = fill_index_page(cursor, slots, node_key_num + 1);
+        delete [] slots;
+        return ret;
+    }
+
+    compact_page->heap_length += record_length;
+    struct index_compact_record *record = (struct index_compact_record *)(cursor->page + PAGE_SIZE - compact_page->heap_length);
+    record->page_no = index_slot->page_no;
+    record->slot_no = index_slot->slot_no;
+    record->suffix_length = key_length - prefix_length;
+    memcpy(record->suffix, key + prefix_length, key_length - prefix_length);
+    memmove(&compact_page->slot_offsets[pos + 1], &compact_page->slot_offsets[pos], (node_key_num - pos) * sizeof(unsigned short));
+    compact_page->slot_offsets[pos] = PAGE_SIZE - compact_page->heap_length;
+    compact_page->index_node_header.curr_key_num++;
+    cursor->mark_dirty();
+    return DB_SUCCESS;
+}
+
+void index::remove_index_slot_on_page(class index_page *cursor, i64 i)
+{
+    i64 node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
+    if(!is_compact_index()){
+        //Left shift the keys and pointers after it.
+        i64 index_column_length = index_file_header->index_column_length;
+        char *key_pos = get_node_key(cursor, i);
+        i64 *rid = get_node_rid(cursor, i);
+        memmove(key_pos, key_pos + index_column_length, (node_key_num - i - 1) * index_column_length);
+        memmove(rid, rid + 2, (node_key_num - i - 1) * sizeof(i64) * 2);
+    }
+    else{
+        //The record becomes garbage, unless it is the lowest one.
+        struct index_compact_page *compact_page = cursor->index_compact_page;
+        struct index_compact_record *record = get_compact_record(cursor, i);
+        i64 record_length = sizeof(struct index_compact_record) + record->suffix_length;
+        if(compact_page->slot_offsets[i] == PAGE_SIZE - compact_page->heap_length)
+            compact_page->heap_length -= record_length;
+        else
+            compact_page->garbage_length += record_length;
+        memmove(&compact_page->slot_offsets[i], &compact_page->slot_offsets[i + 1], (node_key_num - i - 1) * sizeof(unsigned short));
+    }
+    cursor->index_node_page->index_node_header.curr_key_num--;
+    cursor->mark_dirty();
+}
+
+i64 index::expand_index_page(class index_page *cursor, char *slots)
+{
+    i64 node_key_num = cursor->index_node_page->index_node_header.curr_key_num;
+    i64 index_column_length = index_file_header->index_column_length;
+    i64 index_slot_len = get_index_slot_len();
+    struct index_page_slot index_slot;
+    for(i64 i = 0; i < node_key_num; ++i){
+        char *slot = slots + i * index_slot_len;
+        get_slot_key(cursor, i, slot);
+        get_slot_rid(cursor, i, &index_slot);
+        ((i64 *)(slot + index_column_length))[0] = index_slot.page_no;
+        ((i64 *)(slot + index_column_length))[1] = index_slot.slot_no;
+    }
+    return node_key_num;
+}
+
+i64 index::fill_index_page(class index_page *cursor, char *slots, i64 num)
+{
+    i64 index_column_length = index_file_header->index_column_length;
+    i64 index_slot_len = get_index_slot_len();
+    if(index_slots_fit(slots, num) == false)
+        return DB_ERROR;
+    cursor->index_node_page->index_node_header.curr_key_num = num;
+    cursor->mark_dirty();
+    if(!is_compact_index()){
+        for(i64 i = 0; i < num; ++i){
+            char *slot = slots + i * index_slot_len;
+            i64 *rid = get_node_rid(cursor, i);
+            memcpy(get_node_key(cursor, i), slot, index_column_length);
+            rid[0] = ((i64 *)(slot + index_column_length))[0];
+            rid[1] = ((i64 *)(slot + index_column_length))[1];
+        }
+        return DB_SUCCESS;
+    }
+
+    //The prefix goes at the end of the page, the records below it.
+    struct index_compact_page *compact_page = cursor->index_compact_page;
+    char *last = slots + (num - 1) * index_slot_len;
+    i64 prefix_length = num ? common_prefix_length(slots, strnlen(slots, index_column_length), last,
+                                                   strnlen(last, index_column_length)) : 0;
+    i64 heap_offset = PAGE_SIZE - prefix_length;
+    memcpy(cursor->page + heap_offset, slots, prefix_length);
+    for(i64 i = 0; i < num; ++i){
+        char *slot = slots + i * index_slot_len;
+        i64 suffix_length = strnlen(slot, index_column_length) - prefix_length;
+        heap_offset -= sizeof(struct index_compact_record) + suffix_length;
+        struct index_compact_record *record = (struct index_compact_record *)(cursor->page + heap_offset);
+        record->page_no = ((i64 *)(slot + index_column_length))[0];
+        record->slot_no = ((i64 *)(slot + index_column_length))[1];
+        record->suffix_length = suffix_length;
+        memcpy(record->suffix, slot + prefix_length, suffix_length);
+        compact_page->slot_offsets[i] = heap_offset;
+    }
+    compact_page->prefix_length = prefix_length;
+    compact_page->heap_length = PAGE_SIZE - heap_offset;
+    compact_page->garbage_length = 0;
+    return DB_SUCCESS;
+}
+
+i64 index::replace_index_key(class index_page *cursor, i64 i, const char *key)
+{
+    i64 index_column_length = index_file_header->index_column_length;
+    if(!is_compact_index()){
+        memcpy(get_node_key(cursor, i), key, index_column_length);
+        cursor->mark_dirty();
+        return DB_SUCCESS;
+    }
+
+    //The key may be longer, or outside of the prefix: rewrite the page.
+    i64 index_slot_len = get_index_slot_len();
+    char *slots = new char [cursor->index_node_page->index_node_header.curr_key_num * index_slot_len];
+    i64 num = expand_index_page(cursor, slots);
+    memcpy(slots + i * index_slot_len, key, index_column_length);
+    i64 ret = fill_index_page(cursor, slots, num);
+    delete [] slots;
+    return ret;
+}
+
+i64 index::get_split_point(char *slots, i64 num, enum index_page_flag flag)
+{
+    //An internal node keeps at least one key.
+    i64 min_k = (flag == Leaf) ? 1 : 2, k;
+    if(!is_compact_index())
+        k = num / 2;
+    else{
+        //Half of the bytes, then keep both sides within a page (prefixes only shrink them).
+        i64 index_column_length = index_file_header->index_column_length;
+        i64 index_slot_len = get_index_slot_len();
+        i64 total = 0, left = 0;
+        for(i64 i = 0; i < num; ++i){
+            total += sizeof(struct index_compact_record) + sizeof(unsigned short) + strnlen(slots + i * index_slot_len, index_column_length);
+        }
+        for(k = 0; k < num - 1 && left * 2 < total; ++k){
+            left += sizeof(struct index_compact_record) + sizeof(unsigned short) + strnlen(slots + k * index_slot_len, index_column_length);
+        }
+        while(k > min_k && !index_slots_fit(slots, (flag == Leaf) ? k : k - 1))
+            k--;
+        while(k < num - 1 && !index_slots_fit(slots + k * index_slot_len, num - k))
+            k++;
+    }
+    if(k < min_k)
+        k = min_k;
+    if(k > num - 1)
+        k = num - 1;
+    return k;
+}
+
+void index::make_separator(const char *left_key, const char *right_key, char *separator)
+{
+    i64 index_column_length = index_file_header->index_column_length;
+    if(!is_compact_index()){
+        memcpy(separator, left_key, index_column_length);
+        return;
+    }
+
+    //The first key of the right node, cut after the first byte differing from the last key of the left node, is
+    //still greater than the left keys and less than the right ones unless nothing is cut.
+    i64 left_length = strnlen(left_key, index_column_length), right_length = strnlen(right_key, index_column_length);
+    i64 length = common_prefix_length(left_key, left_length, right_key, right_length) + 1;
+    memset(separator, 0, index_column_length);
+    if(length < right_length)
+        memcpy(separator, right_key, length);
+    else
+        memcpy(separator, left_key, left_length);
+}
+
+i64 index::fill_split_pages(char *slots, i64 num, i64 k, i64 rightmost_page_no, class index_page *left,
+                            class index_page *right, char *separator)
+{
+    i64 ret;
+    i64 index_column_length = index_file_header->index_column_length;
+    i64 index_slot_len = get_index_slot_len();
+    char *pivot = slots + (k - 1) * index_slot_len;
+
+    if(left->index_node_page->index_node_header.flag == Leaf){
+        if((ret = fill_index_page(left, slots, k)) != DB_SUCCESS)
+            return ret;
+        make_separator(pivot, pivot + index_slot_len, separator);
+    }
+    //The pivot slot goes up: its key separates the nodes, its pointer is the rightmost one of the left node.
+    else{
+        if((ret = fill_index_page(left, slots, k - 1)) != DB_SUCCESS)
+            return ret;
+        left->index_node_page->index_node_header.rightmost_page_no = *(i64 *)(pivot + index_column_length);
+        right->index_node_page->index_node_header.rightmost_page_no = rightmost_page_no;
+        memcpy(separator, pivot, index_column_length);
+    }
+    return fill_index_page(right, slots + k * index_slot_len, num - k);
+}
+
+i64 index::insert_to_node(struct index_path *path, i64 depth, class index_page *node, i64 pos,
+                          struct index_page_slot *index_slot, i64 right_page_no)
+{
+    i64 ret;
+    struct index_node_header *header = &node->index_node_page->index_node_header;
+    enum index_page_flag flag = header->flag;
+
+    //If there is still some vacancy in the node, insert it.
+    if(has_room_for_slot(node, (char *)(index_slot->index_column))){
+        if((ret = insert_index_slot_on_page(node, pos, index_slot)) != DB_SUCCESS)
+            return ret;
+        if(flag == Internal)
+            set_child_page_no(node, pos + 1, right_page_no);
+        return DB_SUCCESS;
+    }
+
+    //Unfortunately, there is no vacancy in the node, we have to split it: all slots and the new one are divided
+    //between the node and a new right sibling.
+    i64 index_slot_len = get_index_slot_len();
+    i64 node_key_num = header->curr_key_num;
+    i64 rightmost_page_no = header->rightmost_page_no;
+    char *slots = new char [(node_key_num + 1) * index_slot_len];
+    expand_index_page(node, slots);
+    memmove(slots + (pos + 1) * index_slot_len, slots + pos * index_slot_len, (node_key_num - pos) * index_slot_len);
+    fill_index_page_slot(slots + pos * index_slot_len, index_slot);
+    if(flag == Internal){
+        if(pos == node_key_num)
+            rightmost_page_no = right_page_no;
+        else
+            *(i64 *)(slots + (pos + 1) * index_slot_len + index_file_header->index_column_length) = right_page_no;
+    }
+    //Past all keys of a node on the right edge of the tree (a leaf is there if it is the last one).
+    bool append = pos == node_key_num &&
+                  ((flag == Leaf) ? header->next_leaf_page_no == 0 : depth < path->right_edge_depth);
+    ret = split_index_node(path, depth, node, slots, node_key_num + 1, rightmost_page_no, append);
+    delete [] slots;
+    return ret;
+}
+
+i64 index::split_index_node(struct index_path *path, i64 depth, class index_page *node, char *slots, i64 num,
+                            i64 rightmost_page_no, bool append)
+{
+    i64 ret;
+    struct index_node_header *header = &node->index_node_page->index_node_header;
+    enum index_page_flag flag = header->flag;
+    char separator[MAX_STRING_LENGTH + 1];
+    class index_page new_node(&index_paged_file);
+    //Ascending keys would leave the node half empty for good: it keeps its slots (for an internal node, all but the
+    //last key, which goes up) and the new node takes the rest.
+    i64 k = append ? num - 1 : get_split_point(slots, num, flag);
+    if((ret = create_index_node(&new_node, flag)) != DB_SUCCESS ||
+       (ret = fill_split_pages(slots, num, k, rightmost_page_no, node, &new_node, separator)) != DB_SUCCESS)
+        return ret;
+
+    //Link the new leaf into the leaf list, right after 'node'.
+    if(flag == Leaf){
+        struct index_node_header *new_header = &new_node.index_node_page->index_node_header;
+        new_header->next_leaf_page_no = header->next_leaf_page_no;
+        new_header->prev_leaf_page_no = node->page_no;
+        header->next_leaf_page_no = new_node.page_no;
+        if(new_header->next_leaf_page_no){
+            class index_page next_leaf(&index_paged_file);
+            if((ret = next_leaf.get_page(new_header->next_leaf_page_no)) != DB_SUCCESS)
+                return ret;
+            next_leaf.index_node_page->index_node_header.prev_leaf_page_no = new_node.page_no;
+            next_leaf.mark_dirty();
+        }
+    }
+
+    //The separator and the node go to the parent, and the pointer after them to the new node.
+    struct index_page_slot separator_slot;
+    separator_slot.index_column = separator;
+    separator_slot.page_no = node->page_no;
+    separator_slot.slot_no = 0;
+
+    //If the node is the root, create a brand new root. Readers see it once it is complete.
+    if(depth == 0){
+        class index_page new_root(&index_paged_file);
+        if((ret = create_index_node(&new_root, Internal)) != DB_SUCCESS ||
+           (ret = insert_index_slot_on_page(&new_root, 0, &separator_slot)) != DB_SUCCESS)
+            return ret;
+        new_root.index_node_page->index_node_header.rightmost_page_no = new_node.page_no;
+        __atomic_store_n(&index_file_header->root_page_no, new_root.page_no, __ATOMIC_RELEASE);
+        header_handle.mark_dirty();
+        return DB_SUCCESS;
+    }
+
+    //The parent is still pinned from the descent.
+    struct index_path_node *parent = &path->nodes[depth - 1];
+    if(parent->page == nullptr){
+        parent->page = new class index_page(&index_paged_file);
+        if((ret = parent->page->get_page(parent->page_no)) != DB_SUCCESS)
+            return ret;
+    }
+    return insert_to_node(path, depth - 1, parent->page, parent->slot_i, &separator_slot, new_node.page_no);
+}
+
+i64 index::create_index_node(class index_page *node, enum index_page_flag flag)
+{
+    i64 ret;
+    pthread_mutex_lock(&alloc_latch);
+    i64 page_no = index_file_header->free_page_no;
+
+    //Take the first free page, whose header links to the next one.
+    if(page_no){
+        if((ret = node->get_page(page_no)) != DB_SUCCESS){
+            pthread_mutex_unlock(&alloc_latch);
+            return ret;
+        }
+        index_file_header->free_page_no = node->index_node_page->index_node_header.next_leaf_page_no;
+        index_file_header->free_page_num--;
+    }
+    //A page past the used ones needs a latch first.
+    else if(add_node_latches(index_file_header->next_empty_page_no + 1) == DB_SUCCESS)
+        page_no = index_file_header->next_empty_page_no++;
+    else{
+        pthread_mutex_unlock(&alloc_latch);
+        return DB_ERROR;
+    }
+    //Mark page 0 dirty since we changed the free list or 'next_empty_page_no'.
+    header_handle.mark_dirty();
+    pthread_mutex_unlock(&alloc_latch);
+    return node->create_empty_node(flag, page_no);
+}
+
+void index::free_index_node(class index_page *node)
+{
+    struct index_node_header *header = &node->index_node_page->index_node_header;
+    i64 page_no = node->page_no;
+    header->flag = Free;
+    header->curr_key_num = 0;
+    header->rightmost_page_no = 0;
+    header->prev_leaf_page_no = 0;
+    pthread_mutex_lock(&alloc_latch);
+    header->next_leaf_page_no = index_file_header->free_page_no;
+    node->mark_dirty();
+
+    index_file_header->free_page_no = node->page_no;
+    index_file_header->free_page_num++;
+    header_handle.mark_dirty();
+    pthread_mutex_unlock(&alloc_latch);
+    //The page may be taken again for any node, so it is not the last leaf any more.
+    __atomic_compare_exchange_n(&rightmost_leaf_page_no, &page_no, 0, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+i64 index::fix_underflow(struct index_path *path, i64 depth, class index_page *node)
+{
+    i64 ret;
+
+    //The parent is still pinned from the descent.
+    struct index_path_node *path_node = &path->nodes[depth - 1];
+    if(path_node->page == nullptr){
+        path_node->page = new class index_page(&index_paged_file);
+        if((ret = path_node->page->get_page(path_node->page_no)) != DB_SUCCESS)
+            return ret;
+    }
+    class index_page *parent = path_node->page;
+    struct index_node_header *parent_header = &parent->index_node_page->index_node_header;
+    if(parent_header->curr_key_num == 0)
+        return DB_SUCCESS;
+
+    //Pair the node with its left sibling, or with its right one if it is the first child.
+    i64 left_i = (path_node->slot_i > 0) ? path_node->slot_i - 1 : 0;
+    class index_page sibling(&index_paged_file);
+    if((ret = sibling.get_page(get_child_page_no(parent, (path_node->slot_i > 0) ? left_i : 1))) != DB_SUCCESS)
+        return ret;
+    class index_page *left = (path_node->slot_i > 0) ? &sibling : node;
+    class index_page *right = (path_node->slot_i > 0) ? node : &sibling;
+    struct index_node_header *left_header = &left->index_node_page->index_node_header;
+    struct index_node_header *right_header = &right->index_node_page->index_node_header;
+
+    //Expand the slots of both, with the separator between them for internal nodes, whose rightmost pointer of
+    //'left' becomes its left pointer.
+    i64 index_column_length = index_file_header->index_column_length;
+    i64 index_slot_len = get_index_slot_len();
+    char *slots = new char [(left_header->curr_key_num + right_header->curr_key_num + 1) * index_slot_len];
+    i64 num = expand_index_page(left, slots);
+    if(left_header->flag == Internal){
+        char *slot = slots + num++ * index_slot_len;
+        get_slot_key(parent, left_i, slot);
+        ((i64 *)(slot + index_column_length))[0] = left_header->rightmost_page_no;
+        ((i64 *)(slot + index_column_length))[1] = 0;
+    }
+    num += expand_index_page(right, slots + num * index_slot_len);
+
+    if(index_slots_fit(slots, num) == false){
+        //Even out the slots. Their separator changes, which a compact parent may have no room for: the node is
+        //then left below the minimum.
+        char separator[MAX_STRING_LENGTH + 1];
+        i64 k = get_split_point(slots, num, left_header->flag);
+        char *pivot = slots + (k - 1) * index_slot_len;
+        if(left_header->flag == Leaf)
+            make_separator(pivot, pivot + index_slot_len, separator);
+        else
+            memcpy(separator, pivot, index_column_length);
+        if(replace_index_key(parent, left_i, separator) == DB_SUCCESS)
+            ret = fill_split_pages(slots, num, k, right_header->rightmost_page_no, left, right, separator);
+        delete [] slots;
+        return ret;
+    }
+
+    //Merge 'right' into 'left': the pointer to 'right' takes 'left', and the separator between them goes.
+    ret = fill_index_page(left, slots, num);
+    delete [] slots;
+    if(ret != DB_SUCCESS)
+        return ret;
+    if(left_header->flag == Internal)
+        left_header->rightmost_page_no = right_header->rightmost_page_no;
+    else{
+        //Unlink 'right' from the leaf list.
+        left_header->next_leaf_page_no = right_header->next_leaf_page_no;
+        if(right_header->next_leaf_page_no){
+            class index_page next_leaf(&index_paged_file);
+            if((ret = next_leaf.get_page(right_header->next_leaf_page_no)) != DB_SUCCESS)
+                return ret;
+            next_leaf.index_node_page->index_node_header.prev_leaf_page_no = left->page_no;
+            next_leaf.mark_dirty();
+        }
+    }
+    set_child_page_no(parent, left_i + 1, left->page_no);
+    remove_index_slot_on_page(parent, left_i);
+    free_index_node(right);
+
+    //A root left with a single child is replaced by it.
+    if(depth == 1 && parent_header->curr_key_num == 0){
+        __atomic_store_n(&index_file_header->root_page_no, left->page_no, __ATOMIC_RELEASE);
+        header_handle.mark_dirty();
+        free_index_node(parent);
+    }
+    return DB_SUCCESS;
+}
+
+i64 index::remove(void *key)
+{
+    i64 ret;
+    class index_page *cursor = new class index_page(&index_paged_file);
+    struct index_path path;
+    path.operation = Removing;
+    path.restructured = false;
+
+    if(is_nan_key((const char *)key)){
+        delete cursor;
+        return DB_ERROR;
+    }
+
+    //Scurry to leaf node, recording the path, and remove the key there. Start again on a concurrent change.
+    do{
+        if((ret = scurry_to_leaf(cursor, (char *)key, &path)) == DB_SUCCESS)
+            ret = remove_from_leaf(&path, cursor, (char *)key);
+        unlock_index_nodes(&path);
+        release_index_path(&path, path.depth);
+    }while(ret == INDEX_RESTART);
+    delete cursor;
+    return ret;
+}
+
+i64 index::remove_from_leaf(struct index_path *path, class index_page *leaf, const char *key)
+{
+    i64 ret;
+    bool found;
+    if(lock_index_node(path, leaf->page_no, path->leaf_version) == false)
+        return INDEX_RESTART;
+    i64 i = search_index_page(leaf, key, found);
+    if(found == false)
+        return DB_ERROR;
+
+    //The root may hold any number of keys. A leaf which may fall below the minimum is fixed with a sibling, so the
+    //parent and the sibling are locked before anything changes.
+    i64 depth = path->depth;
+    bool fixing = depth && is_index_page_above_min(leaf) == false;
+    if(fixing){
+        struct index_path_node *parent = &path->nodes[depth - 1];
+        if(lock_index_node(path, parent->page_no, parent->version) == false)
+            return INDEX_RESTART;
+        fixing = (parent->page->index_node_page->index_node_header.curr_key_num > 0);
+        if(fixing && (ret = lock_index_sibling(path, depth, leaf)) != DB_SUCCESS)
+            return ret;
+    }
+    remove_index_slot_on_page(leaf, i);
+    if(fixing && is_index_page_underfull(leaf))
+        return fix_underflow(path, depth, leaf);
+    return DB_SUCCESS;
+}
+
+i64 index::move_index_node(class index_page *node, i64 page_no)
+{
+    i64 ret;
+    if(page_no <= 0)
+        return DB_ERROR;
+
+    class index_page new_node(&index_paged_file);
+    if((ret = new_node.allocate_page(page_no)) != DB_SUCCESS)
+        return ret;
+    memcpy(new_node.page, node->page, PAGE_SIZE);
+
+    //The neighbour leaves link to the new page.
+    struct index_node_header *header = &new_node.index_node_page->index_node_header;
+    if(header->flag == Leaf){
+        class index_page neighbour(&index_paged_file);
+        if(header->prev_leaf_page_no){
+            if((ret = neighbour.get_page(header->prev_leaf_page_no)) != DB_SUCCESS)
+                return ret;
+            neighbour.index_node_page->index_node_header.next_leaf_page_no = page_no;
+            neighbour.mark_dirty();
+        }
+        if(header->next_leaf_page_no){
+            if((ret = neighbour.get_page(header->next_leaf_page_no)) != DB_SUCCESS)
+                return ret;
+            neighbour.index_node_page->index_node_header.prev_leaf_page_no = page_no;
+            neighbour.mark_dirty();
+        }
+    }
+    new_node.release();
+    return node->get_page(page_no);
+}
+
+i64 index::relocate_index_nodes(class index_page *node, i64 end, i64 *dest, i64 &dest_i)
+{
+    i64 ret, child_page_no;
+    bool leaf_children = false;
+    class index_page child(&index_paged_file);
+
+    for(i64 i = 0; i <= node->index_node_page->index_node_header.curr_key_num; ++i){
+        child_page_no = get_child_page_no(node, i);
+        //Leaves staying in place are not read.
+        if(leaf_children && child_page_no < end)
+            continue;
+        if((ret = child.get_page(child_page_no)) != DB_SUCCESS)
+            return ret;
+        leaf_children = (child.index_node_page->index_node_header.flag == Leaf);
+        if(child_page_no >= end){
+            if((ret = move_index_node(&child, dest[dest_i++])) != DB_SUCCESS)
+                return ret;
+            set_child_page_no(node, i, child.page_no);
+            node->mark_dirty();
+        }
+        if(!leaf_children && (ret = relocate_index_nodes(&child, end, dest, dest_i)) != DB_SUCCESS)
+            return ret;
+    }
+    return DB_SUCCESS;
+}
+
+i64 index::compact()
+{
+    i64 ret, page_no, dest_num = 0, dest_i = 0;
+    if(index_file_header->free_page_num == 0)
+        return DB_SUCCESS;
+    rightmost_leaf_page_no = 0;
+
+    //The used pages fit below 'end'. The free pages there receive the nodes past it, as many as there are.
+    i64 end = index_file_header->next_empty_page_no - index_file_header->free_page_num;
+    i64 *dest = new i64 [index_file_header->free_page_num + 1];
+    class index_page node(&index_paged_file);
+    for(page_no = index_file_header->free_page_no; page_no; page_no = node.index_node_page->index_node_header.next_leaf_page_no){
+        if((ret = node.get_page(page_no)) != DB_SUCCESS){
+            delete [] dest;
+            return ret;
+        }
+        if(page_no < end)
+            dest[dest_num++] = page_no;
+    }
+    //Page 0 is never a destination: running out of them is an error.
+    dest[dest_num] = 0;
+
+    //The free pages are used up or cut off from here on, even if the moves fail.
+    index_file_header->free_page_no = 0;
+    index_file_header->free_page_num = 0;
+    header_handle.mark_dirty();
+
+    ret = node.get_page(index_file_header->root_page_no);
+    if(ret == DB_SUCCESS && node.page_no >= end && (ret = move_index_node(&node, dest[dest_i++])) == DB_SUCCESS)
+        index_file_header->root_page_no = node.page_no;
+    if(ret == DB_SUCCESS && node.index_node_page->index_node_header.flag == Internal)
+        ret = relocate_index_nodes(&node, end, dest, dest_i);
+    node.release();
+    delete [] dest;
+    if(ret != DB_SUCCESS)
+        return ret;
+
+    //No node is left from 'end' on.
+    index_file_header->next_empty_page_no = end;
+    return index_paged_file.truncate_paged_file(end);
+}
+
+key_compare_routine index::get_key_compare_routine()
+{
+    switch(index_file_header->index_column_type){
+        case LONG_LONG:
+            return long_long_key::compare;
+        case DOUBLE:
+            return double_key::compare;
+        default:
+            return fixed_length_string_key::compare;
+    }
+}
+
+key_search_routine index::get_key_search_routine()
+{
+    bool is_double = (index_file_header->index_column_type == DOUBLE);
+    if(is_compact_index())
+        return nullptr;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        return is_double ? search_double_keys_avx2 : search_long_long_keys_avx2;
+    if(__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        return is_double ? search_double_keys_sse42 : search_long_long_keys_sse42;
+#endif
+    return is_double ? search_keys_scalar<double_key> : search_keys_scalar<long_long_key>;
+}
+
+bool index::fits_build_node(struct index_build *build, char *slots, i64 num, enum index_page_flag flag)
+{
+    //The last child of an internal node is its rightmost pointer. A node takes at least one key (two for internal
+    //nodes) whatever the fill factor.
+    i64 key_num = (flag == Leaf) ? num : num - 1;
+    i64 min_key_num = (flag == Leaf) ? 1 : 2;
+    if(!is_compact_index()){
+        i64 per_node = (i64)(index_file_header->slot_num_per_page * build->fill_factor);
+        return key_num <= ((per_node > min_key_num) ? per_node : min_key_num);
+    }
+    i64 size = get_compact_slots_size(slots, key_num);
+    return size <= compact_page_capacity && (key_num <= min_key_num || size <= compact_page_capacity * build->fill_factor);
+}
+
+i64 index::write_build_node(struct index_build *build, i64 level_i, char *slots, i64 num, const char *next_key)
+{
+    i64 ret;
+    i64 index_column_length = index_file_header->index_column_length;
+    i64 index_slot_len = get_index_slot_len();
+    struct index_build_level *level = &build->levels[level_i];
+    char *last = slots + (num - 1) * index_slot_len;
+    char up_slot[MAX_STRING_LENGTH + 1 + sizeof(i64) * 2];
+
+    class index_page *node = new class index_page(&index_paged_file);
+    if(level_i == 0 && level->node_num == 0)
+        ret = node->create_empty_node(Leaf, index_file_header->root_page_no);
+    else
+        ret = create_index_node(node, level_i ? Internal : Leaf);
+    if(ret == DB_SUCCESS)
+        ret = fill_index_page(node, slots, level_i ? num - 1 : num);
+    if(ret != DB_SUCCESS){
+        delete node;
+        return ret;
+    }
+    level->node_num++;
+
+    //A leaf goes up with its separator from the next leaf, and is linked after the previous one.
+    if(level_i == 0){
+        if(next_key)
+            make_separator(last, next_key, up_slot);
+        else
+            memcpy(up_slot, last, index_column_length);
+        if(level->last_leaf){
+            node->index_node_page->index_node_header.prev_leaf_page_no = level->last_leaf->page_no;
+            level->last_leaf->index_node_page->index_node_header.next_leaf_page_no = node->page_no;
+            level->last_leaf->mark_dirty();
+            delete level->last_leaf;
+        }
+        level->last_leaf = node;
+    }
+    //The last child is the rightmost one, and the largest key of the node is that of the last child.
+    else{
+        node->index_node_page->index_node_header.rightmost_page_no = *(i64 *)(last + index_column_length);
+        memcpy(up_slot, last, index_column_length);
+    }
+    ((i64 *)(up_slot + index_column_length))[0] = node->page_no;
+    ((i64 *)(up_slot + index_column_length))[1] = 0;
+    if(level_i)
+        delete node;
+    return add_to_build_level(build, level_i + 1, up_slot);
+}
+
+i64 index::add_to_build_level(struct index_build *build, i64 level_i, const char *slot)
+{
+    i64 ret;
+    i64 index_slot_len = get_index_slot_len();
+    if(level_i == build->level_num){
+        if(level_i == MAX_INDEX_TREE_HEIGHT)
+            return DB_ERROR;
+        //Room for a complete node held back, and one being filled.
+        struct index_build_level *new_level = &build->levels[build->level_num++];
+        new_level->slots = new char [(index_file_header->slot_num_per_page * 2 + 4) * index_slot_len];
+        new_level->slot_num = new_level->pending_num = new_level->node_num = 0;
+        new_level->last_leaf = nullptr;
+    }
+
+    struct index_build_level *level = &build->levels[level_i];
+    i64 current_num = level->slot_num - level->pending_num;
+    char *current = level->slots + level->pending_num * index_slot_len;
+    memcpy(current + current_num * index_slot_len, slot, index_slot_len);
+    if(current_num == 0 || fits_build_node(build, current, current_num + 1, level_i ? Internal : Leaf)){
+        level->slot_num++;
+        return DB_SUCCESS;
+    }
+
+    //The slot starts the next node, so the current one is complete, and the one held back can be written.
+    if(level->pending_num){
+        if((ret = write_build_node(build, level_i, level->slots, level->pending_num, current)) != DB_SUCCESS)
+            return ret;
+        memmove(level->slots, current, (current_num + 1) * index_slot_len);
+    }
+    level->pending_num = current_num;
+    level->slot_num = current_num + 1;
+    return DB_SUCCESS;
+}
+
+i64 index::finish_build(struct index_build *build)
+{
+    i64 ret;
+    i64 index_slot_len = get_index_slot_len();
+
+    //Levels are added above while the ones below are finished.
+    for(i64 level_i = 0; level_i < build->level_num; ++level_i){
+        struct index_build_level *level = &build->levels[level_i];
+        enum index_page_flag flag = level_i ? Internal : Leaf;
+
+        //A level of a single node is the root (a single child is the root itself).
+        if(level->node_num == 0 && level->pending_num == 0){
+            if(level_i && level->slot_num == 1){
+                index_file_header->root_page_no = *(i64 *)(level->slots + index_file_header->index_column_length);
+                header_handle.mark_dirty();
+                return DB_SUCCESS;
+            }
+            if((ret = write_build_node(build, level_i, level->slots, level->slot_num, nullptr)) != DB_SUCCESS)
+                return ret;
+            continue;
+        }
+
+        //The last two nodes: one if they fit in it, or divided evenly.
+        if(level->pending_num && !fits_build_node(build, level->slots, level->slot_num, flag)){
+            i64 k = get_split_point(level->slots, level->slot_num, flag);
+            char *next = level->slots + k * index_slot_len;
+            if((ret = write_build_node(build, level_i, level->slots, k, next)) != DB_SUCCESS ||
+               (ret = write_build_node(build, level_i, next, level->slot_num - k, nullptr)) != DB_SUCCESS)
+                return ret;
+        }
+        else if((ret = write_build_node(build, level_i, level->slots, level->slot_num, nullptr)) != DB_SUCCESS)
+            return ret;
+    }
+    return DB_ERROR;
+}
+
+i64 index::bulk_load(class sorted_stream *slots, double fill_factor)
+{
+    i64 ret;
+    i64 index_slot_len = get_index_slot_len();
+    key_compare_routine compare = get_key_compare_routine();
+
+    if(fill_factor <= 0 || fill_factor > 1)
+        return DB_ERROR;
+    //Only an empty index is built.
+    class index_page root(&index_paged_file);
+    if((ret = root.get_page(index_file_header->root_page_no)) != DB_SUCCESS)
+        return ret;
+    if(root.index_node_page->index_node_header.flag != Leaf || root.index_node_page->index_node_header.curr_key_num)
+        return DB_ERROR;
+    root.release();
+
+    i64 slot_num = slots->get_entry_num();
+    if(slot_num == 0)
+        return DB_SUCCESS;
+
+    //Fill the leaves in order. A complete leaf adds its separator to the level above.
+    struct index_build build;
+    build.level_num = 0;
+    build.fill_factor = fill_factor;
+    char *slot, *last_key = new char [index_slot_len];
+    i64 loaded_num = 0;
+    while((ret = slots->next(slot)) == DB_SUCCESS && slot){
+        //Duplicated key not permitted, and the slots must be in order (which a NaN key is not).
+        if(++loaded_num > slot_num || is_nan_key(slot) ||
+           (loaded_num > 1 && compare(last_key, slot, index_file_header->index_column_length) >= 0)){
+            ret = DB_ERROR;
+            break;
+        }
+        memcpy(last_key, slot, index_slot_len);
+        if((ret = add_to_build_level(&build, 0, slot)) != DB_SUCCESS)
+            break;
+    }
+
+    //The stream must hold as many slots as it announced.
+    if(ret == DB_SUCCESS && loaded_num != slot_num)
+        ret = DB_ERROR;
+    if(ret == DB_SUCCESS)
+        ret = finish_build(&build);
+    for(i64 i = 0; i < build.level_num; ++i){
+        delete [] build.levels[i].slots;
+        delete build.levels[i].last_leaf;
+    }
+    delete [] last_key;
+    return ret;
+}
+
+struct index_build_scan {
+    class index *idx;
+    class external_sorter *sorter;
+    char *slot;
+};
+
+i64 index::collect_index_slot(void *arg, const char *content, i64 page_no, i64 slot_no)
+{
+    struct index_build_scan *scan = (struct index_build_scan *)arg;
+    struct index_page_slot index_slot;
+    index_slot.index_column = (void *)content;
+    index_slot.page_no = page_no;
+    index_slot.slot_no = slot_no;
+    scan->idx->fill_index_page_slot(scan->slot, &index_slot);
+    return scan->sorter->add(scan->slot);
+}
+
+i64 index::build_index(class record *table, i64 column_no, double fill_factor, i64 memory_budget)
+{
+    i64 ret;
+    struct column_meta *column = table->get_column_meta(column_no);
+    if(column == nullptr || column->type != index_file_header->index_column_type ||
+       column->length != index_file_header->index_column_length)
+        return DB_ERROR;
+
+    class external_sorter sorter(get_index_slot_len(), index_file_header->index_column_length, get_key_compare_routine(),
+                                 memory_budget);
+    char *slot = new char [get_index_slot_len()];
+    struct index_build_scan scan = {this, &sorter, slot};
+    ret = table->scan_column(column_no, collect_index_slot, &scan);
+    delete [] slot;
+    if(ret != DB_SUCCESS || (ret = sorter.sort()) != DB_SUCCESS)
+        return ret;
+    return bulk_load(&sorter, fill_factor);
+}
+
+/* -------------------------------------- */
+//    Class index_cursor methods implementation
+index_cursor::index_cursor(class index *idx)
+{
+    this->idx = idx;
+    this->leaf = new class index_page(&idx->index_paged_file);
+    this->pos = 0;
+}
+
+index_cursor::~index_cursor()
+{
+    delete leaf;
+}
+
+void index_cursor::close()
+{
+    leaf->release();
+}
+
+i64 index_cursor::seek(void *key)
+{
+    i64 ret;
+
+    //No key: go down the leftmost pointers.
+    if(key == nullptr){
+        if((ret = leaf->get_page(idx->index_file_header->root_page_no)) != DB_SUCCESS)
+            return ret;
+        while(leaf->index_node_page->index_node_header.flag == Internal){
+            if((ret = leaf->get_page(idx->get_child_page_no(leaf, 0))) != DB_SUCCESS)
+                return ret;
+        }
+        pos = 0;
+        return DB_SUCCESS;
+    }
+
+    //A NaN key has no place among the others.
+    if(idx->is_nan_key((const char *)key))
+        return DB_ERROR;
+    struct index_path path;
+    bool found;
+    path.operation = Searching;
+    do{
+        ret = idx->scurry_to_leaf(leaf, (char *)key, &path);
+        idx->release_index_path(&path, path.depth);
+    }while(ret == INDEX_RESTART);
+    if(ret != DB_SUCCESS)
+        return ret;
+    pos = idx->search_index_page(leaf, (char *)key, found);
+    return DB_SUCCESS;
+}
+
+i64 index_cursor::seek_to_last()
+{
+    i64 ret = leaf->get_page(idx->index_file_header->root_page_no);
+    if(ret != DB_SUCCESS)
+        return ret;
+    while(leaf->index_node_page->index_node_header.flag == Internal){
+        if((ret = leaf->get_page(leaf->index_node_page->index_node_header.rightmost_page_no)) != DB_SUCCESS)
+            return ret;
+    }
+    pos = leaf->index_node_page->index_node_header.curr_key_num;
+    return DB_SUCCESS;
+}
+
+void index_cursor::copy_slot(struct index_page_slot *index_slot)
+{
+    idx->get_slot_key(leaf, pos, (char *)(index_slot->index_column));
+    idx->get_slot_rid(leaf, pos, index_slot);
+}
+
+i64 index_cursor::next(struct index_page_slot *index_slot)
+{
+    i64 ret;
+    if(leaf->page == nullptr)
+        return DB_ERROR;
+    //Past the last slot of this leaf: move to the next leaf. Getting it unpins this one.
+    while(pos >= leaf->index_node_page->index_node_header.curr_key_num){
+        i64 next_leaf_page_no = leaf->index_node_page->index_node_header.next_leaf_page_no;
+        if(!next_leaf_page_no){
+            index_slot->page_no = -1;
+            index_slot->slot_no = -1;
+            return DB_SUCCESS;
+        }
+        if((ret = leaf->get_page(next_leaf_page_no)) != DB_SUCCESS)
+            return ret;
+        pos = 0;
+    }
+    copy_slot(index_slot);
+    pos++;
+    return DB_SUCCESS;
+}
+
+i64 index_cursor::prev(struct index_page_slot *index_slot)
+{
+    i64 ret;
+    if(leaf->page == nullptr)
+        return DB_ERROR;
+    while(pos <= 0){
+        i64 prev_leaf_page_no = leaf->index_node_page->index_node_header.prev_leaf_page_no;
+        if(!prev_leaf_page_no){
+            index_slot->page_no = -1;
+            index_slot->slot_no = -1;
+            return DB_SUCCESS;
+        }
+        if((ret = leaf->get_page(prev_leaf_page_no)) != DB_SUCCESS)
+            return ret;
+        pos = leaf->index_node_page->index_node_header.curr_key_num;
+    }
+    pos--;
+    copy_slot(index_slot);
+    return DB_SUCCESS;
+}
+
+
+// Test stub
+//#define CREAT_INDEX_FILE
 //#define INSERT_INDEX_SLOT
 
 void index_test(){
@@ -725,4 +2199,1013 @@ void index_test2()
     }
 
     idx2.close_index();
-}
\ No newline at end of file
+}
+
+//Concurrent point lookups through a sharded page cache.
+struct index_search_thread_arg{
+    class index *idx;
+    i64 key_num;
+    i64 lookup_num;
+    i64 seed;
+    i64 not_found;
+};
+
+static void *index_search_thread(void *arg)
+{
+    struct index_search_thread_arg *search_arg = (struct index_search_thread_arg *)arg;
+    struct index_page_slot index_slot;
+    long long key;
+
+    index_slot.index_column = &key;
+    search_arg->not_found = 0;
+    for(i64 i = 0; i < search_arg->lookup_num; ++i){
+        key = (search_arg->seed + i * 7919) % search_arg->key_num;
+        search_arg->idx->search_key(&index_slot);
+        if(index_slot.slot_no != key)
+            search_arg->not_found++;
+    }
+    return nullptr;
+}
+
+void index_concurrency_test()
+{
+    const int max_thread_num = 16;
+    const i64 key_num = 0x4000, lookup_num = 0x10000;
+    char idx_name[] = "Key";
+    char tbl_name[] = "Bench";
+    class page_cache page_cache(1024, Fifo, 16);
+    class index idx(&page_cache);
+    struct index_page_slot index_slot;
+    long long key;
+
+    idx.create_index(LONG_LONG, tbl_name, idx_name, sizeof(long long));
+    idx.close_index();
+    idx.open_index(tbl_name, idx_name);
+    index_slot.index_column = &key;
+    for(key = 0; key < key_num; ++key){
+        index_slot.page_no = key / 10;
+        index_slot.slot_no = key;
+        idx.insert(&index_slot);
+    }
+
+    pthread_t threads[max_thread_num];
+    struct index_search_thread_arg args[max_thread_num];
+    for(int thread_num = 1; thread_num <= max_thread_num; thread_num *= 2){
+        struct timespec start, end;
+        i64 not_found = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int i = 0; i < thread_num; ++i){
+            args[i].idx = &idx;
+            args[i].key_num = key_num;
+            args[i].lookup_num = lookup_num;
+            args[i].seed = i * 131;
+            pthread_create(&threads[i], nullptr, index_search_thread, &args[i]);
+        }
+        for(int i = 0; i < thread_num; ++i){
+            pthread_join(threads[i], nullptr);
+            not_found += args[i].not_found;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        cout<<thread_num<<" threads: "<<(thread_num * lookup_num) / seconds<<" lookups/s, "
+            <<not_found<<" not found"<<endl;
+    }
+
+    idx.close_index();
+}
+
+struct index_update_thread_arg{
+    class index *idx;
+    enum index_column_type type;
+    i64 key_num;
+    i64 op_num;
+    int thread_i, thread_num;
+    i64 seed;
+    i64 errors;
+};
+
+//Key 'key_value' of an index of type 'type'.
+static void fill_update_key(enum index_column_type type, long long key_value, char *key)
+{
+    if(type == LONG_LONG)
+        memcpy(key, &key_value, sizeof(key_value));
+    else
+        snprintf(key, MAX_STRING_LENGTH + 1, "key%010lld", key_value);
+}
+
+//Inserts and removes the odd keys of a thread (those of 'thread_i' modulo the thread number), and checks its own
+//keys and the even keys, which are never removed, after each change.
+static void *index_update_thread(void *arg)
+{
+    struct index_update_thread_arg *update_arg = (struct index_update_thread_arg *)arg;
+    class index *idx = update_arg->idx;
+    i64 own_key_num = update_arg->key_num / 2 / update_arg->thread_num;
+    bool *present = new bool [own_key_num]();
+    struct index_page_slot index_slot;
+    char key[MAX_STRING_LENGTH + 1];
+    unsigned int seed = update_arg->seed;
+
+    index_slot.index_column = key;
+    update_arg->errors = 0;
+    for(i64 i = 0; i < update_arg->op_num; ++i){
+        i64 own_i = rand_r(&seed) % own_key_num;
+        long long key_value = (own_i * update_arg->thread_num + update_arg->thread_i) * 2 + 1;
+        fill_update_key(update_arg->type, key_value, key);
+        if(present[own_i]){
+            if(idx->remove(key) != DB_SUCCESS)
+                update_arg->errors++;
+        }
+        else{
+            index_slot.page_no = key_value / 10;
+            index_slot.slot_no = key_value;
+            if(idx->insert(&index_slot) != DB_SUCCESS)
+                update_arg->errors++;
+        }
+        present[own_i] = !present[own_i];
+        idx->search_key(&index_slot);
+        if((index_slot.slot_no == key_value) != present[own_i])
+            update_arg->errors++;
+
+        key_value = (rand_r(&seed) % (update_arg->key_num / 2)) * 2;
+        fill_update_key(update_arg->type, key_value, key);
+        idx->search_key(&index_slot);
+        if(index_slot.slot_no != key_value)
+            update_arg->errors++;
+    }
+
+    //Remove what is left, merging nodes while others do the same.
+    for(i64 own_i = 0; own_i < own_key_num; ++own_i){
+        if(present[own_i] == false)
+            continue;
+        fill_update_key(update_arg->type, (own_i * update_arg->thread_num + update_arg->thread_i) * 2 + 1, key);
+        if(idx->remove(key) != DB_SUCCESS)
+            update_arg->errors++;
+    }
+    delete [] present;
+    return nullptr;
+}
+
+//Concurrent inserts, removes and searches from 1 to 16 threads, checked by every thread and at the end.
+void index_concurrent_update_test()
+{
+    const int max_thread_num = 16;
+    const i64 key_num = 0x10000, op_num = 0x8000;
+    enum index_column_type types[] = {LONG_LONG, FIXED_LENGTH_STRING};
+    const char *type_names[] = {"LONG_LONG", "FIXED_LENGTH_STRING"};
+    i64 key_lengths[] = {sizeof(long long), 32};
+    char idx_name[] = "Update";
+    char tbl_name[] = "Bench";
+    class page_cache page_cache(2048, Fifo, 16);
+    class index idx(&page_cache);
+    struct index_page_slot index_slot;
+    char key[MAX_STRING_LENGTH + 1];
+    i64 errors = 0;
+
+    pthread_t threads[max_thread_num];
+    struct index_update_thread_arg args[max_thread_num];
+    for(size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t){
+        for(int thread_num = 1; thread_num <= max_thread_num; thread_num *= 2){
+            struct timespec start, end;
+            i64 thread_errors = 0, count = 0;
+
+            idx.create_index(types[t], tbl_name, idx_name, key_lengths[t]);
+            index_slot.index_column = key;
+            for(long long key_value = 0; key_value < key_num; key_value += 2){
+                fill_update_key(types[t], key_value, key);
+                index_slot.page_no = key_value / 10;
+                index_slot.slot_no = key_value;
+                idx.insert(&index_slot);
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for(int i = 0; i < thread_num; ++i){
+                args[i].idx = &idx;
+                args[i].type = types[t];
+                args[i].key_num = key_num;
+                args[i].op_num = op_num;
+                args[i].thread_i = i;
+                args[i].thread_num = thread_num;
+                args[i].seed = i * 131 + 7;
+                pthread_create(&threads[i], nullptr, index_update_thread, &args[i]);
+            }
+            for(int i = 0; i < thread_num; ++i){
+                pthread_join(threads[i], nullptr);
+                thread_errors += args[i].errors;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            //Only the even keys are left, in order.
+            {
+                class index_cursor cursor(&idx);
+                cursor.seek(nullptr);
+                for(; cursor.next(&index_slot) == DB_SUCCESS && index_slot.page_no != -1; ++count){
+                    if(index_slot.slot_no != count * 2)
+                        thread_errors++;
+                }
+            }
+            if(count != key_num / 2)
+                thread_errors++;
+            errors += thread_errors;
+
+            //Each operation is an insert or a remove, and two searches.
+            double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            cout<<type_names[t]<<", "<<thread_num<<" threads: "<<(thread_num * op_num) / seconds<<" updates/s, "
+                <<(thread_num * op_num * 3) / seconds<<" operations/s, "<<idx.get_page_num()<<" pages, "
+                <<thread_errors<<" errors"<<endl;
+            idx.close_index();
+        }
+    }
+    cout<<errors<<" errors."<<endl;
+}
+
+//Point lookups on an index opened through the page cache and mapped with mmap.
+void index_mmap_test()
+{
+    const i64 key_num = 0x10000, lookup_num = 0x40000;
+    enum paged_file_mode modes[] = {Buffered, Mapped};
+    const char *mode_names[] = {"Buffered", "Mapped"};
+    char idx_name[] = "Key";
+    char tbl_name[] = "Mmap";
+    class page_cache page_cache(1024);
+    class index idx(&page_cache);
+    struct index_page_slot index_slot;
+    long long key;
+
+    idx.create_index(LONG_LONG, tbl_name, idx_name, sizeof(long long));
+    idx.close_index();
+    idx.open_index(tbl_name, idx_name);
+    index_slot.index_column = &key;
+    for(key = 0; key < key_num; ++key){
+        index_slot.page_no = key / 10;
+        index_slot.slot_no = key;
+        idx.insert(&index_slot);
+    }
+    idx.close_index();
+
+    for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m){
+        struct timespec start, end;
+        i64 not_found = 0;
+
+        idx.open_index(tbl_name, idx_name, modes[m]);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(i64 i = 0; i < lookup_num; ++i){
+            key = (i * 7919) % key_num;
+            idx.search_key(&index_slot);
+            if(index_slot.slot_no != key)
+                not_found++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        idx.close_index();
+
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        cout<<mode_names[m]<<": "<<lookup_num / seconds<<" lookups/s, "<<not_found<<" not found"<<endl;
+    }
+}
+
+//Fill the key of a benchmark slot. Numeric keys are negative for the first half.
+static void fill_bench_key(enum index_column_type type, long long key_value, i64 key_num, char *key)
+{
+    memset(key, 0, MAX_STRING_LENGTH + 1);
+    if(type == FIXED_LENGTH_STRING){
+        snprintf(key, MAX_STRING_LENGTH + 1, "fruit%08lld", key_value);
+    }
+    else if(type == DOUBLE){
+        double double_value = (key_value - key_num / 2) * 0.5;
+        memcpy(key, &double_value, sizeof(double_value));
+    }
+    else{
+        key_value -= key_num / 2;
+        memcpy(key, &key_value, sizeof(key_value));
+    }
+}
+
+//Insert and search throughput of numeric and string indexes.
+void index_search_bench()
+{
+    const i64 key_num = 0x8000;
+    enum index_column_type types[] = {LONG_LONG, DOUBLE, FIXED_LENGTH_STRING};
+    const char *type_names[] = {"LONG_LONG", "DOUBLE", "FIXED_LENGTH_STRING"};
+    i64 key_lengths[] = {sizeof(long long), sizeof(double), MAX_STRING_LENGTH + 1};
+    char tbl_name[] = "Bench";
+    char idx_name[] = "Search";
+    class page_cache page_cache(8192);
+
+    for(size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t){
+        class index idx(&page_cache);
+        struct index_page_slot index_slot;
+        char key[MAX_STRING_LENGTH + 1];
+        struct timespec start, end;
+        double insert_seconds, search_seconds;
+        i64 not_found = 0;
+
+        idx.create_index(types[t], tbl_name, idx_name, key_lengths[t]);
+        index_slot.index_column = key;
+        //Keys are inserted and searched in a scattered order.
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(i64 i = 0; i < key_num; ++i){
+            long long key_value = (i * 7919) % key_num;
+            fill_bench_key(types[t], key_value, key_num, key);
+            index_slot.page_no = key_value / 10;
+            index_slot.slot_no = key_value;
+            idx.insert(&index_slot);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        insert_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(i64 i = 0; i < key_num; ++i){
+            long long key_value = (i * 4001) % key_num;
+            fill_bench_key(types[t], key_value, key_num, key);
+            idx.search_key(&index_slot);
+            if(index_slot.slot_no != key_value)
+                not_found++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        search_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        i64 page_num = idx.get_page_num();
+        idx.close_index();
+
+        cout<<type_names[t]<<": "<<key_num / insert_seconds<<" inserts/s, "<<key_num / search_seconds<<" searches/s, "
+            <<page_num<<" pages, "<<not_found<<" not found"<<endl;
+    }
+}
+
+//Ordered scans, a range scan and a backward scan with a cursor, through a page cache of a few pages.
+void index_range_test()
+{
+    const i64 key_num = 0x4000;
+    char tbl_name[] = "Range";
+    char idx_name[] = "Num";
+    char str_idx_name[] = "Name";
+    class page_cache page_cache(8);
+    class index idx(&page_cache);
+    struct index_page_slot index_slot;
+    long long key, prev_key;
+    i64 count, bad = 0;
+
+    //Negative and positive keys, inserted in a scattered order.
+    idx.create_index(LONG_LONG, tbl_name, idx_name, sizeof(long long));
+    index_slot.index_column = &key;
+    for(i64 i = 0; i < key_num; ++i){
+        key = (i * 7919) % key_num - key_num / 2;
+        index_slot.page_no = key + key_num;
+        index_slot.slot_no = i;
+        idx.insert(&index_slot);
+    }
+
+    {
+        class index_cursor cursor(&idx);
+        //Full scan in ascending order.
+        cursor.seek(nullptr);
+        for(count = 0; cursor.next(&index_slot) == DB_SUCCESS && index_slot.page_no != -1; ++count){
+            if(key != count - key_num / 2 || index_slot.page_no != key + key_num)
+                bad++;
+        }
+        cout<<"Ascending: "<<count<<" keys"<<endl;
+        //BETWEEN -100 AND 99.
+        long long lower = -100;
+        cursor.seek(&lower);
+        for(count = 0; cursor.next(&index_slot) == DB_SUCCESS && index_slot.page_no != -1 && key < 100; ++count){
+            if(key != lower + count)
+                bad++;
+        }
+        cout<<"Range [-100, 100): "<<count<<" keys"<<endl;
+        //Keys less than -8000, from the largest one down.
+        lower = -8000;
+        cursor.seek(&lower);
+        for(count = 0, prev_key = lower; cursor.prev(&index_slot) == DB_SUCCESS && index_slot.page_no != -1; ++count){
+            if(key >= prev_key)
+                bad++;
+            prev_key = key;
+        }
+        cout<<"Below -8000: "<<count<<" keys"<<endl;
+        //Full scan in descending order.
+        cursor.seek_to_last();
+        for(count = 0; cursor.prev(&index_slot) == DB_SUCCESS && index_slot.page_no != -1; ++count){
+            if(key != key_num / 2 - 1 - count)
+                bad++;
+        }
+        cout<<"Descending: "<<count<<" keys"<<endl;
+    }
+    idx.close_index();
+
+    //Prefix scan of a string index.
+    char name[MAX_STRING_LENGTH + 1], prefix[] = "fruit001";
+    idx.create_index(FIXED_LENGTH_STRING, tbl_name, str_idx_name, MAX_STRING_LENGTH + 1);
+    index_slot.index_column = name;
+    for(i64 i = 0; i < 0x1000; ++i){
+        memset(name, 0, sizeof(name));
+        snprintf(name, sizeof(name), "fruit%04lld", (i * 7919) % 0x1000);
+        index_slot.page_no = i;
+        index_slot.slot_no = i;
+        idx.insert(&index_slot);
+    }
+    {
+        class index_cursor cursor(&idx);
+        memset(name, 0, sizeof(name));
+        strcpy(name, prefix);
+        cursor.seek(name);
+        for(count = 0; cursor.next(&index_slot) == DB_SUCCESS && index_slot.page_no != -1 &&
+                       !strncmp(name, prefix, strlen(prefix)); ++count);
+        cout<<"Prefix "<<prefix<<": "<<count<<" keys"<<endl;
+        if(count != 10)
+            bad++;
+    }
+    idx.close_index();
+    cout<<bad<<" keys out of order."<<endl;
+}
+
+//Repeated inserts against bulk loads of the same keys (sorted in memory and through run files), then an index
+//built from a table column.
+void index_bulk_load_test()
+{
+    const i64 key_num = 0x10000;
+    char tbl_name[] = "Bulk";
+    char insert_idx_name[] = "Inserted";
+    char load_idx_name[] = "Loaded";
+    class page_cache page_cache(64);
+    class index idx(&page_cache);
+    struct index_page_slot index_slot;
+    long long key;
+    char slot[sizeof(long long) + sizeof(i64) * 2];
+    i64 bad = 0, start;
+
+    //Keys in a scattered order.
+    start = monotonic_ns();
+    idx.create_index(LONG_LONG, tbl_name, insert_idx_name, sizeof(long long));
+    index_slot.index_column = &key;
+    for(i64 i = 0; i < key_num; ++i){
+        key = (i * 7919) % key_num;
+        index_slot.page_no = key / 10;
+        index_slot.slot_no = key;
+        idx.insert(&index_slot);
+    }
+    idx.close_index();
+    i64 insert_ns = monotonic_ns() - start;
+
+    for(i64 memory_budget = 16 << 20; memory_budget >= (256 << 10); memory_budget >>= 6){
+        start = monotonic_ns();
+        idx.create_index(LONG_LONG, tbl_name, load_idx_name, sizeof(long long));
+        class external_sorter sorter(sizeof(slot), sizeof(long long), long_long_key::compare, memory_budget);
+        for(i64 i = 0; i < key_num; ++i){
+            key = (i * 7919) % key_num;
+            memcpy(slot, &key, sizeof(key));
+            ((i64 *)(slot + sizeof(key)))[0] = key / 10;
+            ((i64 *)(slot + sizeof(key)))[1] = key;
+            sorter.add(slot);
+        }
+        sorter.sort();
+        if(idx.bulk_load(&sorter) != DB_SUCCESS)
+            bad++;
+        i64 load_ns = monotonic_ns() - start;
+        cout<<"Repeated inserts: "<<insert_ns / 1000000<<" ms, bulk load ("<<sorter.get_run_num()<<" runs): "\
+            <<load_ns / 1000000<<" ms, "<<(double)insert_ns / load_ns<<" times faster"<<endl;
+
+        for(i64 i = 0; i < key_num; ++i){
+            key = i;
+            idx.search_key(&index_slot);
+            if(index_slot.page_no != key / 10 || index_slot.slot_no != key)
+                bad++;
+        }
+        class index_cursor cursor(&idx);
+        cursor.seek(nullptr);
+        i64 count;
+        for(count = 0; cursor.next(&index_slot) == DB_SUCCESS && index_slot.page_no != -1; ++count){
+            if(key != count)
+                bad++;
+        }
+        if(count != key_num)
+            bad++;
+        cursor.close();
+        idx.close_index();
+    }
+
+    //Index on a table column.
+    class record table(&page_cache);
+    struct column_meta col_meta[] = {
+        {"Name", FIXED_LENGTH_STRING, 32},
+        {"Serial", LONG_LONG, sizeof(long long)},
+    };
+    char name[32];
+    long long serial;
+    struct record_slot_attribute slot_attrs[] = {
+        {name, FIXED_LENGTH_STRING, 32},
+        {&serial, LONG_LONG, sizeof(long long)},
+    };
+    i64 page_no, slot_no, record_num = 0x4000;
+    table.create_record(tbl_name, col_meta, 2);
+    for(i64 i = 0; i < record_num; ++i){
+        serial = (i * 7919) % record_num - record_num / 2;
+        memset(name, 0, sizeof(name));
+        snprintf(name, sizeof(name), "crate%06lld", serial + record_num / 2);
+        table.insert_record(slot_attrs, 2, page_no, slot_no);
+    }
+    idx.create_index(FIXED_LENGTH_STRING, tbl_name, col_meta[0].name, 32);
+    if(idx.build_index(&table, 0, 1.0) != DB_SUCCESS)
+        bad++;
+    index_slot.index_column = name;
+    for(i64 i = 0; i < record_num; ++i){
+        memset(name, 0, sizeof(name));
+        snprintf(name, sizeof(name), "crate%06lld", i);
+        idx.search_key(&index_slot);
+        if(index_slot.page_no < 0 || table.get_record(slot_attrs, 2, index_slot.page_no, index_slot.slot_no) != DB_SUCCESS ||
+           serial != i - record_num / 2)
+            bad++;
+    }
+    idx.close_index();
+    idx.create_index(LONG_LONG, tbl_name, col_meta[1].name, sizeof(long long));
+    if(idx.build_index(&table, 1) != DB_SUCCESS)
+        bad++;
+    index_slot.index_column = &key;
+    for(key = -record_num / 2; key < record_num / 2; ++key){
+        idx.search_key(&index_slot);
+        if(index_slot.page_no < 0 || table.get_record(slot_attrs, 2, index_slot.page_no, index_slot.slot_no) != DB_SUCCESS ||
+           serial != key)
+            bad++;
+    }
+    idx.close_index();
+    table.close_record();
+    cout<<bad<<" keys not found."<<endl;
+}
+
+//Removes in a scattered order (with borrows, merges and a shrinking tree), inserts into the freed pages, and
+//compactions of the emptied file.
+void index_remove_test()
+{
+    const i64 key_num = 0x8000;
+    char tbl_name[] = "Remove";
+    char idx_name[] = "Num";
+    char str_idx_name[] = "Name";
+    char file_name[] = "Remove:Num";
+    class page_cache page_cache(16);
+    class index idx(&page_cache);
+    struct index_page_slot index_slot;
+    struct stat file_stat;
+    long long key;
+    i64 count, bad = 0, page_num, free_page_num;
+
+    idx.create_index(LONG_LONG, tbl_name, idx_name, sizeof(long long));
+    index_slot.index_column = &key;
+    for(i64 i = 0; i < key_num; ++i){
+        key = (i * 7919) % key_num;
+        index_slot.page_no = key / 10;
+        index_slot.slot_no = key;
+        idx.insert(&index_slot);
+    }
+    page_num = idx.get_page_num();
+
+    //Keep every fourth key.
+    for(i64 i = 0; i < key_num; ++i){
+        key = (i * 4099) % key_num;
+        if(key % 4 && idx.remove(&key) != DB_SUCCESS)
+            bad++;
+    }
+    key = 1;
+    if(idx.remove(&key) != DB_ERROR)
+        bad++;
+    for(i64 i = 0; i < key_num; ++i){
+        key = i;
+        idx.search_key(&index_slot);
+        if((i % 4 == 0) != (index_slot.slot_no == i))
+            bad++;
+    }
+    {
+        class index_cursor cursor(&idx);
+        cursor.seek(nullptr);
+        for(count = 0; cursor.next(&index_slot) == DB_SUCCESS && index_slot.page_no != -1; ++count){
+            if(key != count * 4)
+                bad++;
+        }
+        if(count != key_num / 4)
+            bad++;
+    }
+    free_page_num = idx.get_free_page_num();
+    cout<<"Pages: "<<page_num<<" after inserts, "<<free_page_num<<" of them free after removes"<<endl;
+
+    //Inserts take the freed pages first.
+    for(i64 i = 0; i < key_num; ++i){
+        key = (i * 7919) % key_num;
+        index_slot.page_no = key / 10;
+        index_slot.slot_no = key;
+        if(key % 4 && idx.insert(&index_slot) != DB_SUCCESS)
+            bad++;
+    }
+    cout<<"Pages: "<<idx.get_page_num()<<" after inserts again, "<<idx.get_free_page_num()<<" of them free"<<endl;
+    //More pages come from the free list than from the end of the file.
+    if(idx.get_page_num() - page_num >= free_page_num - idx.get_free_page_num())
+        bad++;
+
+    //Keep every 64th key, and compact.
+    for(key = 0; key < key_num; ++key){
+        if(key % 64 && idx.remove(&key) != DB_SUCCESS)
+            bad++;
+    }
+    page_num = idx.get_page_num();
+    if(idx.compact() != DB_SUCCESS)
+        bad++;
+    stat(file_name, &file_stat);
+    cout<<"Pages: "<<page_num<<" before compaction, "<<idx.get_page_num()<<" after, file size "<<file_stat.st_size<<endl;
+    if(file_stat.st_size != idx.get_page_num() * PAGE_SIZE || idx.get_page_num() >= page_num)
+        bad++;
+    for(i64 i = 0; i < key_num; ++i){
+        key = i;
+        idx.search_key(&index_slot);
+        if((i % 64 == 0) != (index_slot.slot_no == i))
+            bad++;
+    }
+    {
+        class index_cursor cursor(&idx);
+        cursor.seek_to_last();
+        for(count = 0; cursor.prev(&index_slot) == DB_SUCCESS && index_slot.page_no != -1; ++count){
+            if(key != key_num - 64 - count * 64)
+                bad++;
+        }
+        if(count != key_num / 64)
+            bad++;
+    }
+
+    //Remove the rest: the tree shrinks to an empty root, which takes inserts again.
+    for(key = 0; key < key_num; key += 64){
+        if(idx.remove(&key) != DB_SUCCESS)
+            bad++;
+    }
+    idx.compact();
+    cout<<"Pages: "<<idx.get_page_num()<<" when empty"<<endl;
+    if(idx.get_page_num() != 2)
+        bad++;
+    key = 5;
+    index_slot.page_no = index_slot.slot_no = 5;
+    idx.insert(&index_slot);
+    index_slot.page_no = -1;
+    idx.search_key(&index_slot);
+    if(index_slot.slot_no != 5)
+        bad++;
+    idx.close_index();
+
+    //Long string keys, which differ early, make a tree of few slots per node, so internal nodes borrow and merge
+    //as well.
+    char name[MAX_STRING_LENGTH + 1];
+    idx.create_index(FIXED_LENGTH_STRING, tbl_name, str_idx_name, MAX_STRING_LENGTH + 1);
+    index_slot.index_column = name;
+    for(i64 i = 0; i < 0x2000; ++i){
+        memset(name, 0, sizeof(name));
+        snprintf(name, sizeof(name), "%06lld", (i * 7919) % 0x2000);
+        memset(name + 6, 'x', 200);
+        index_slot.page_no = index_slot.slot_no = (i * 7919) % 0x2000;
+        idx.insert(&index_slot);
+    }
+    for(i64 i = 0; i < 0x2000; ++i){
+        if((i * 4099) % 0x2000 % 16 == 0)
+            continue;
+        memset(name, 0, sizeof(name));
+        snprintf(name, sizeof(name), "%06lld", (i * 4099) % 0x2000);
+        memset(name + 6, 'x', 200);
+        if(idx.remove(name) != DB_SUCCESS)
+            bad++;
+    }
+    page_num = idx.get_page_num();
+    idx.compact();
+    for(i64 i = 0; i < 0x2000; ++i){
+        memset(name, 0, sizeof(name));
+        snprintf(name, sizeof(name), "%06lld", i);
+        memset(name + 6, 'x', 200);
+        idx.search_key(&index_slot);
+        if((i % 16 == 0) != (index_slot.slot_no == i))
+            bad++;
+    }
+    {
+        class index_cursor cursor(&idx);
+        cursor.seek(nullptr);
+        for(count = 0; cursor.next(&index_slot) == DB_SUCCESS && index_slot.page_no != -1; ++count){
+            if(index_slot.slot_no != count * 16)
+                bad++;
+        }
+        if(count != 0x2000 / 16)
+            bad++;
+    }
+    cout<<"String index pages: "<<page_num<<" before compaction, "<<idx.get_page_num()<<" after"<<endl;
+    idx.close_index();
+    cout<<bad<<" errors."<<endl;
+}
+
+void index_key_search_test()
+{
+    const i64 key_num = (PAGE_SIZE - sizeof(struct index_node_header)) / (sizeof(long long) + sizeof(i64) * 2);
+    const i64 round_num = 200000;
+    struct{
+        const char *name;
+        key_search_routine long_long_search, double_search;
+        bool supported;
+    } routines[] = {
+        {"scalar", search_keys_scalar<long_long_key>, search_keys_scalar<double_key>, true},
+#if defined(__x86_64__) || defined(__i386__)
+        {"sse4.2", search_long_long_keys_sse42, search_double_keys_sse42,
+         __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")},
+        {"avx2", search_long_long_keys_avx2, search_double_keys_avx2,
+         __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")},
+#endif
+    };
+    long long long_long_keys[key_num], long_long_probe;
+    double double_keys[key_num], double_probe;
+    struct timespec start, end;
+    i64 bad = 0, sum;
+
+    //Every node size, probed at each key, between keys and past both ends (keys are spaced by 4, from a negative one).
+    for(i64 num = 0; num <= key_num; ++num){
+        for(i64 i = 0; i < num; ++i){
+            long_long_keys[i] = i * 4 - num * 2;
+            double_keys[i] = (i * 4 - num * 2) / 8.0;
+        }
+        for(i64 p = -2; p < num * 4 + 2; ++p){
+            long_long_probe = p - num * 2;
+            double_probe = (p - num * 2) / 8.0;
+            i64 expected = (p <= 0) ? 0 : (p + 3) / 4;
+            if(expected > num)
+                expected = num;
+            for(size_t r = 0; r < sizeof(routines) / sizeof(routines[0]); ++r){
+                if(!routines[r].supported)
+                    continue;
+                if(routines[r].long_long_search((char *)long_long_keys, num, (char *)&long_long_probe) != expected ||
+                   routines[r].double_search((char *)double_keys, num, (char *)&double_probe) != expected)
+                    bad++;
+            }
+        }
+    }
+
+    //Searches of a full node.
+    for(i64 i = 0; i < key_num; ++i){
+        long_long_keys[i] = i * 4;
+    }
+    for(size_t r = 0; r < sizeof(routines) / sizeof(routines[0]); ++r){
+        if(!routines[r].supported){
+            cout<<routines[r].name<<": not supported"<<endl;
+            continue;
+        }
+        sum = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(i64 i = 0; i < round_num; ++i){
+            long_long_probe = (i * 7919) % (key_num * 4);
+            sum += routines[r].long_long_search((char *)long_long_keys, key_num, (char *)&long_long_probe);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        cout<<routines[r].name<<": "<<seconds * 1e9 / round_num<<" ns per search of "<<key_num<<" keys ("<<sum<<")"<<endl;
+    }
+    cout<<bad<<" errors."<<endl;
+}
+
+//Batched searches checked against the keys (even keys are in the index, odd ones are not), with their cost per key
+//against single searches, then while other threads insert and remove the odd keys.
+void index_batch_search_test()
+{
+    const i64 key_num = 0x40000, probe_num = 0x40000;
+    const i64 batch_sizes[] = {1, 16, 256, 4096, 65536};
+    enum index_column_type types[] = {LONG_LONG, FIXED_LENGTH_STRING};
+    const char *type_names[] = {"LONG_LONG", "FIXED_LENGTH_STRING"};
+    i64 key_lengths[] = {sizeof(long long), 32};
+    char idx_name[] = "Batch";
+    char tbl_name[] = "Bench";
+    class page_cache page_cache(4096, Fifo, 16);
+    class index idx(&page_cache);
+    struct index_page_slot *index_slots = new struct index_page_slot [probe_num];
+    long long *key_values = new long long [probe_num];
+    char *keys = new char [probe_num * 32];
+    struct timespec start, end;
+    unsigned int seed = 17;
+    i64 bad = 0;
+
+    for(size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t){
+        idx.create_index(types[t], tbl_name, idx_name, key_lengths[t]);
+        //Keys packed as in the buffer of a join.
+        for(i64 i = 0; i < probe_num; ++i){
+            index_slots[i].index_column = keys + i * key_lengths[t];
+        }
+        for(long long key_value = 0; key_value < key_num; key_value += 2){
+            fill_update_key(types[t], key_value, (char *)(index_slots[0].index_column));
+            index_slots[0].page_no = key_value / 10;
+            index_slots[0].slot_no = key_value;
+            idx.insert(&index_slots[0]);
+        }
+
+        //Scattered keys, present or not, some of them twice.
+        for(i64 i = 0; i < probe_num; ++i){
+            key_values[i] = rand_r(&seed) % key_num;
+            fill_update_key(types[t], key_values[i], (char *)(index_slots[i].index_column));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(i64 i = 0; i < probe_num; ++i){
+            idx.search_key(&index_slots[i]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double single_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / probe_num;
+        cout<<type_names[t]<<", single searches: "<<single_ns<<" ns per key"<<endl;
+
+        for(size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); ++b){
+            for(i64 i = 0; i < probe_num; ++i){
+                index_slots[i].page_no = index_slots[i].slot_no = -2;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for(i64 i = 0; i < probe_num; i += batch_sizes[b]){
+                if(idx.search_keys(&index_slots[i], batch_sizes[b]) != DB_SUCCESS)
+                    bad++;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            for(i64 i = 0; i < probe_num; ++i){
+                if(index_slots[i].slot_no != ((key_values[i] % 2) ? -1 : key_values[i]) ||
+                   index_slots[i].page_no != ((key_values[i] % 2) ? -1 : key_values[i] / 10))
+                    bad++;
+            }
+            double batch_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / probe_num;
+            cout<<type_names[t]<<", batches of "<<batch_sizes[b]<<": "<<batch_ns<<" ns per key ("
+                <<single_ns / batch_ns<<"x)"<<endl;
+        }
+
+        //Keys already in order, each in the index.
+        for(i64 i = 0; i < probe_num; ++i){
+            key_values[i] = (i * 2) % key_num;
+            fill_update_key(types[t], key_values[i], (char *)(index_slots[i].index_column));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(idx.search_keys(index_slots, probe_num) != DB_SUCCESS)
+            bad++;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        for(i64 i = 0; i < probe_num; ++i){
+            if(index_slots[i].slot_no != key_values[i])
+                bad++;
+        }
+        cout<<type_names[t]<<", sorted batch: "
+            <<((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / probe_num<<" ns per key"<<endl;
+
+        //The even keys are found while other threads change the odd ones.
+        const int thread_num = 2;
+        pthread_t threads[thread_num];
+        struct index_update_thread_arg args[thread_num];
+        for(int i = 0; i < thread_num; ++i){
+            args[i].idx = &idx;
+            args[i].type = types[t];
+            args[i].key_num = key_num;
+            args[i].op_num = 0x10000;
+            args[i].thread_i = i;
+            args[i].thread_num = thread_num;
+            args[i].seed = i * 131 + 7;
+            pthread_create(&threads[i], nullptr, index_update_thread, &args[i]);
+        }
+        for(int round = 0; round < 16; ++round){
+            for(i64 i = 0; i < probe_num; ++i){
+                key_values[i] = (rand_r(&seed) % (key_num / 2)) * 2;
+                fill_update_key(types[t], key_values[i], (char *)(index_slots[i].index_column));
+            }
+            if(idx.search_keys(index_slots, probe_num) != DB_SUCCESS)
+                bad++;
+            for(i64 i = 0; i < probe_num; ++i){
+                if(index_slots[i].slot_no != key_values[i])
+                    bad++;
+            }
+        }
+        for(int i = 0; i < thread_num; ++i){
+            pthread_join(threads[i], nullptr);
+            bad += args[i].errors;
+        }
+        idx.close_index();
+    }
+
+    delete [] index_slots;
+    delete [] key_values;
+    delete [] keys;
+    cout<<bad<<" errors."<<endl;
+}
+
+struct index_append_thread_arg{
+    class index *idx;
+    enum index_column_type type;
+    long long *next_key_value;      //Shared by the threads, each takes the next key.
+    i64 key_num;
+    i64 errors;
+};
+
+//Inserts the keys taken in order from the shared counter, so the threads append to the last leaf together.
+static void *index_append_thread(void *arg)
+{
+    struct index_append_thread_arg *append_arg = (struct index_append_thread_arg *)arg;
+    struct index_page_slot index_slot;
+    char key[MAX_STRING_LENGTH + 1];
+    long long key_value;
+    index_slot.index_column = key;
+    append_arg->errors = 0;
+    while((key_value = __atomic_fetch_add(append_arg->next_key_value, 1, __ATOMIC_RELAXED)) < append_arg->key_num){
+        fill_update_key(append_arg->type, key_value, key);
+        index_slot.page_no = key_value / 10;
+        index_slot.slot_no = key_value;
+        if(append_arg->idx->insert(&index_slot) != DB_SUCCESS)
+            append_arg->errors++;
+    }
+    return nullptr;
+}
+
+//Ascending keys against scattered ones: inserts per second and how full the pages are. The ascending keys are then
+//removed in order, and appended again by several threads at once.
+void index_sequential_insert_test()
+{
+    const int thread_num = 4;
+    const i64 key_num = 0x40000;
+    enum index_column_type types[] = {LONG_LONG, FIXED_LENGTH_STRING};
+    const char *type_names[] = {"LONG_LONG", "FIXED_LENGTH_STRING"};
+    const char *order_names[] = {"ascending", "scattered"};
+    i64 key_lengths[] = {sizeof(long long), 32};
+    char idx_name[] = "Sequential";
+    char tbl_name[] = "Bench";
+    class page_cache page_cache(4096, Fifo, 16);
+    class index idx(&page_cache);
+    struct index_page_slot index_slot;
+    char key[MAX_STRING_LENGTH + 1];
+    struct timespec start, end;
+    i64 errors = 0;
+
+    index_slot.index_column = key;
+    for(size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t){
+        for(int order = 0; order < 2; ++order){
+            idx.create_index(types[t], tbl_name, idx_name, key_lengths[t]);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for(i64 i = 0; i < key_num; ++i){
+                long long key_value = order ? (i * 7919) % key_num : i;
+                fill_update_key(types[t], key_value, key);
+                index_slot.page_no = key_value / 10;
+                index_slot.slot_no = key_value;
+                if(idx.insert(&index_slot) != DB_SUCCESS)
+                    errors++;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            //All keys, in order.
+            i64 count = 0;
+            {
+                class index_cursor cursor(&idx);
+                cursor.seek(nullptr);
+                for(; cursor.next(&index_slot) == DB_SUCCESS && index_slot.page_no != -1; ++count){
+                    if(index_slot.slot_no != count)
+                        errors++;
+                }
+            }
+            if(count != key_num)
+                errors++;
+
+            //Pages besides the file header, and for numeric keys the share of slots used over all of them.
+            double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            i64 page_num = idx.get_page_num() - 1;
+            cout<<type_names[t]<<", "<<order_names[order]<<": "<<key_num / seconds<<" inserts/s, "<<page_num<<" pages";
+            if(types[t] == LONG_LONG)
+                cout<<", "<<(double)key_num / (page_num * idx.get_slot_num_per_page())<<" used";
+            cout<<endl;
+
+            if(order == 0){
+                for(long long key_value = 0; key_value < key_num; ++key_value){
+                    fill_update_key(types[t], key_value, key);
+                    if(idx.remove(key) != DB_SUCCESS)
+                        errors++;
+                }
+                class index_cursor cursor(&idx);
+                cursor.seek(nullptr);
+                if(cursor.next(&index_slot) != DB_SUCCESS || index_slot.page_no != -1)
+                    errors++;
+            }
+            idx.close_index();
+        }
+
+        //Threads taking the keys in turn: the keys arrive nearly in order.
+        pthread_t threads[thread_num];
+        struct index_append_thread_arg args[thread_num];
+        long long next_key_value = 0;
+        idx.create_index(types[t], tbl_name, idx_name, key_lengths[t]);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int i = 0; i < thread_num; ++i){
+            args[i].idx = &idx;
+            args[i].type = types[t];
+            args[i].next_key_value = &next_key_value;
+            args[i].key_num = key_num;
+            pthread_create(&threads[i], nullptr, index_append_thread, &args[i]);
+        }
+        for(int i = 0; i < thread_num; ++i){
+            pthread_join(threads[i], nullptr);
+            errors += args[i].errors;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        i64 count = 0;
+        {
+            class index_cursor cursor(&idx);
+            cursor.seek(nullptr);
+            for(; cursor.next(&index_slot) == DB_SUCCESS && index_slot.page_no != -1; ++count){
+                if(index_slot.slot_no != count)
+                    errors++;
+            }
+        }
+        if(count != key_num)
+            errors++;
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        cout<<type_names[t]<<", "<<thread_num<<" threads ascending: "<<key_num / seconds<<" inserts/s, "
+            <<idx.get_page_num() - 1<<" pages"<<endl;
+        idx.close_index();
+    }
+    cout<<errors<<" errors."<<endl;
+}
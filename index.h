@@ -5,9 +5,10 @@
         Index column name
         Index column type
         Index column length
-        Number of slots per page
+        Number of slots per page (the most a compact page may hold, for string keys)
         Next empty page number
         Root page number
+        First free page number (0 if none) and number of free pages
 
     Index page (node): 
         A page is a node in B+ tree.
@@ -17,32 +18,129 @@
 
         -------------------------
         Index page header:
-            Flag: Leaf page, Internal page.
+            Flag: Leaf page, Internal page, Free page.
             Right most page no.
             Number of used indice on current page
+            Next and previous leaf page no. (Leaf page only, 0 if none): leaves form a list in key order.
+                                            (Free page: next free page no. in the first, 0 if none.)
         -------------------------
-        Index page contents: (Index slots)
-            Index column | Page no.     (Left pointer)            | Slot no. (Left pointer)
-                           (Table file page no. for leaf page;
-                            Index file page no. for node page.)
+        Index page contents (LONG_LONG and DOUBLE keys):
+            Index column 0 | Index column 1 | ... (room for 'slots per page' keys)
+            Page no. 0 | Slot no. 0 | Page no. 1 | Slot no. 1 | ...
+                         (Page no.: table file page no. for leaf page (with the slot no.);
+                          index file page no. of the left child for node page.)
+        Keys are stored apart from their pointers, so the keys of a node are contiguous: a search reads a third of
+        the cache lines, and compares several keys at once with vector instructions (AVX2 or SSE4.2, chosen when
+        the index is opened from the features of the CPU, with a scalar fallback). A node is bisected down to a
+        few keys, and the keys less than the searched one are counted among them.
+
+    Compact page (FIXED_LENGTH_STRING keys):
+        String keys are mostly shorter than their column, and keys of a node tend to share a prefix, so a string
+        index page is slotted: an array of record offsets (in key order) grows up after the header, and records
+        fill the page from its end down:
+            Header | Prefix length | Heap length | Garbage length | Offset 0 | ... | Offset n-1 -> ... <- Records | Prefix
+            Record: Page no. | Slot no. | Suffix length | Suffix
+        A key is stored up to its first NUL, without the prefix common to all keys of the node, which is stored
+        once. Removed records leave garbage, reclaimed when the page is rewritten.
+        A node is full when the bytes of its slots do not fit any more, and below the minimum when they take less
+        than half of the page. Separators promoted by a leaf split are cut to the shortest prefix of the right
+        node's first key which is still greater than the left node's last key.
+        Pages are restructured (split, merged, balanced, or rewritten with a shorter prefix) through expanded
+        slots, laid out as the slots of a fixed page, so these operations are shared by both layouts.
+
+    Key order:
+        LONG_LONG and DOUBLE keys are stored in native byte order and compared as numbers, FIXED_LENGTH_STRING keys
+        with strncmp. Comparing, copying and searching are specialized per key type at compile time (key type
+        traits below); the column type is dispatched once per node, or once per index for the search of a node.
+
+    Insert path:
+        An insert records the internal nodes it descends through (page no., version and the position of the child
+        pointer taken), so a split goes to the parent recorded instead of searching it from the root. A full
+        internal node is split on the way down, so the parent of a node always has room for the separator of its
+        split, and a split never goes further up. Only the parent of the current node stays pinned.
+        Ascending keys (as an auto-increment primary key) go to the last leaf. Inserts remember it, and a key greater
+        than all keys of that leaf, while it is still the last one and has room, is appended to it without going
+        down the tree. A node on the right edge of the tree split for a key past all of its keys keeps all its
+        slots, and its new right sibling starts with that key alone, so ascending keys fill pages up instead of
+        leaving them half empty.
+
+    Bulk load:
+        An empty index is built bottom-up from slots in key order, either a stream sorted by the caller or the keys
+        of a table column, sorted by an external sort. Leaves are filled in order and linked, and each completed
+        node adds its largest key (its separator, for a leaf) to the level above, so every page is written once.
+        Nodes are filled up to a fill factor of their slots (of their bytes, on compact pages), leaving room for
+        later inserts. Each level holds a complete node back until the next one is complete, so the last two
+        nodes of a level are divided evenly and none is left nearly empty.
+
+    Deletion:
+        A remove takes the same recorded path as an insert. A node but the root falling below half of its slots
+        borrows slots from a sibling under the same parent (through the parent for internal nodes, whose separator
+        key rotates), or is merged with it when both fit in one page, which removes a key from the parent. A parent
+        left below the minimum is fixed the same way by a later remove, when it meets the parent on its way down
+        (once per remove), so a fix never goes further up than the parent. A root left with a single child is
+        replaced by it. Separator keys are upper bounds of their subtree, so removing a largest key needs no update
+        above.
+
+    Concurrency (optimistic lock coupling):
+        Threads share one index object, and search, insert and remove run concurrently. Every node has a latch
+        which is a version, odd while a writer holds the node. Latches live in memory only, in chunks of a two
+        level table indexed by page no. The chunks of the pages in use are allocated when the index is opened, and
+        the table grows as pages are taken past them, so no two pages share a latch.
+        Searches take no latch: a node is read while its version is even, and the version is checked again
+        before the child pointer read is used, and once the child's version is read (a child freed or moved
+        changes its parent). A search which sees a version changed starts again from the root. Readers never
+        block writers; they wait only for a node that is being written.
+        Inserts and removes go down the same way, then lock the leaf at the version they read. Changes of the
+        structure lock the parent as well, and the sibling or the next leaf they touch. Nodes are locked only if
+        their versions did not change, never waiting, so there is no deadlock: when one fails, the operation
+        unlocks its nodes and starts again. Splits and fixes on the way down also start the operation again.
+        The root is replaced only while it is locked. Taking and freeing pages is serialized by a mutex.
+        Cursors, bulk loads and compaction need the index for themselves.
+
+    Batched search:
+        A batch of keys (a join or an IN list) is searched in key order, radix sorted on bits which order the keys
+        (so sorting does not go through the keys' slots) unless the batch comes sorted. Each key
+        goes back up only to the deepest node of the previous key's way whose subtree may hold it (keys are
+        bounded by the separator above each node), and down from there, so keys in the same leaf share the whole
+        way down. The nodes of the way stay pinned for the batch. A node kept is used again only if its version
+        did not change, which also keeps its bound; otherwise the key starts again from the root. Before the
+        leaves under a node are visited, the leaves of the next keys under it are read ahead through the page
+        cache, adjacent pages by a single request, as long as leaves come from the disk.
+
+    Free pages:
+        Pages freed by merges are kept in a list through their headers, headed in the file header, and splits take
+        pages from it before extending the file.
+
+    Compaction:
+        Moves the nodes past the space the used pages need into free pages below it, fixing the pointer of the
+        parent (or the root page no.) and the leaf list, then truncates the file. The index is available before and
+        after, but must not be used by others during a compaction.
+
+    Index cursor:
+        Streams index slots in key order, from the position found by 'seek', forward or backward along the leaf
+        list. The position lies between two slots of a leaf, which is the only page the cursor keeps pinned.
+        The index must not be modified while a cursor is in use.
 */
 
-//TODO: Index slot deletion
-
 #ifndef __INDEX_H__
 #define __INDEX_H__
 
 #include "db.h"
 #include "page_cache.h"
+#include "external_sort.h"
 
 enum index_column_type {LONG_LONG = 0x81, DOUBLE, FIXED_LENGTH_STRING};
-enum index_page_flag {Leaf = 1, Internal};
+enum index_page_flag {Leaf = 1, Internal, Free};
+
+class record;
 
 /*Individual index node page header*/
 struct index_node_header{
     enum index_page_flag flag;
     i64 rightmost_page_no;
     i64 curr_key_num;
+    i64 next_leaf_page_no;
+    i64 prev_leaf_page_no;
 };
 
 /*Index page layout*/
@@ -51,6 +149,125 @@ struct index_node_page{
     i64 index_slots[0];
 };
 
+/*Compact index page layout (FIXED_LENGTH_STRING keys). A zeroed page is an empty node.*/
+struct index_compact_page{
+    struct index_node_header index_node_header;
+    unsigned short prefix_length;       //Prefix shared by the keys of the node, stored at the end of the page.
+    unsigned short heap_length;         //Bytes at the end of the page taken by the records and the prefix.
+    unsigned short garbage_length;      //Bytes of removed records among them.
+    unsigned short slot_offsets[0];     //Record of each slot, in key order.
+};
+
+/*Record of a slot on a compact page*/
+struct index_compact_record{
+    i64 page_no;
+    i64 slot_no;
+    unsigned short suffix_length;
+    char suffix[0];                     //The key after the prefix of the page, up to its first NUL.
+} __attribute__((packed));
+
+/*Key type traits: compare, copy and the node search strategy of an index column type.*/
+struct long_long_key{
+    static inline int compare(const char *a, const char *b, i64)
+    {
+        long long x, y;
+        memcpy(&x, a, sizeof(x));
+        memcpy(&y, b, sizeof(y));
+        return (x > y) - (x < y);
+    }
+    static inline void copy(char *dest, const char *src, i64) {memcpy(dest, src, sizeof(long long));}
+};
+
+struct double_key{
+    //NaN keys are never in an index, as they compare equal to all keys.
+    static inline int compare(const char *a, const char *b, i64)
+    {
+        double x, y;
+        memcpy(&x, a, sizeof(x));
+        memcpy(&y, b, sizeof(y));
+        return (x > y) - (x < y);
+    }
+    static inline void copy(char *dest, const char *src, i64) {memcpy(dest, src, sizeof(double));}
+};
+
+struct fixed_length_string_key{
+    static inline int compare(const char *a, const char *b, i64 length) {return strncmp(a, b, length);}
+    static inline void copy(char *dest, const char *src, i64 length) {strncpy(dest, src, length);}
+};
+
+//Position of the first of 'key_num' keys in order (contiguous, of 'sizeof(long long)' bytes) which is not less than
+//'key': the search of a node with numeric keys.
+typedef i64 (*key_search_routine)(const char *keys, i64 key_num, const char *key);
+
+/*Root-to-leaf path of an index operation*/
+#define MAX_INDEX_TREE_HEIGHT 32
+#define MAX_LOCKED_INDEX_NODES 6
+
+//Returned when an operation met a concurrent change and has to start again from the root.
+#define INDEX_RESTART 1
+
+enum index_operation {Searching = 1, Inserting, Removing};
+
+struct index_path_node{
+    i64 page_no;
+    i64 slot_i;                 //Position of the child pointer taken (the key number for the rightmost pointer).
+    i64 version;                //Version of the node when it was read.
+    class index_page *page;     //Pinned for the parent of the current node, nullptr otherwise.
+};
+
+struct index_path{
+    i64 depth;                  //Number of internal nodes on the path, the root first.
+    i64 right_edge_depth;       //Levels from the root on the right edge of the tree (reached by rightmost pointers).
+    enum index_operation operation;
+    bool restructured;          //The remove fixed a node on the way down already.
+    i64 leaf_version;           //Version of the leaf when it was reached.
+    i64 locked_page_nos[MAX_LOCKED_INDEX_NODES];    //Nodes locked by the operation, unlocked when it is done.
+    i64 locked_num;
+    struct index_path_node nodes[MAX_INDEX_TREE_HEIGHT];
+};
+
+/*A node on the way of a batched search to the leaf of its current key*/
+struct index_batch_node{
+    class index_page *page;     //Pinned node.
+    i64 version;                //Version of the node when it was read.
+    char *bound;                //Greatest key its subtree may hold (a separator above it), nullptr on the right edge.
+};
+
+/*A key of a batched search*/
+struct index_probe{
+    unsigned long long order;   //Bits which order the key (see 'sort_index_probes').
+    struct index_page_slot *slot;
+};
+
+struct index_batch{
+    struct index_probe *probes; //Keys searched, in order.
+    i64 probe_num;
+    key_compare_routine compare;
+    i64 height;                 //Nodes kept from the search of the previous key, the root first.
+    i64 page_num;               //Node objects allocated (for the first levels), kept for the batch.
+    i64 leaf_height;            //Height of the last leaf reached, 0 before the first.
+    i64 prefetch_end;           //First probe whose leaf was not read ahead.
+    i64 read_bytes;             //Bytes read from the index file when leaves were last read ahead.
+    i64 leaf_slot_i;            //Slot found for the previous key in the leaf kept (0 once another leaf is reached).
+    char *bounds;               //Separators copied for the nodes, an index column length for each level.
+    struct index_batch_node nodes[MAX_INDEX_TREE_HEIGHT + 1];
+};
+
+/*A level of a tree built by a bulk load*/
+struct index_build_level{
+    char *slots;                //Expanded slots: leaf slots, or children with their largest key (as page no.).
+    i64 slot_num;               //Slots buffered.
+    i64 pending_num;            //Leading slots of a complete node, written when the next one is complete (0 if none).
+    i64 node_num;               //Nodes written.
+    class index_page *last_leaf;    //Last leaf written, pinned until the next one is linked to it.
+};
+
+struct index_build{
+    struct index_build_level levels[MAX_INDEX_TREE_HEIGHT];
+    i64 level_num;
+    double fill_factor;
+};
+
 /*Index slot*/
 struct index_page_slot{
     void *index_column; //A pointer to variable of type 'long long', 'double', or 'fixed length string'.
@@ -66,10 +283,13 @@ struct index_file_header {
     i64 slot_num_per_page;
     i64 next_empty_page_no;
     i64 root_page_no;
+    i64 free_page_no;           //Head of the free page list, 0 if empty.
+    i64 free_page_num;
 };
 
 //Incorporate meta information of an index file.
 class index{
+friend class index_cursor;
 protected:
     union{
         char *page;
@@ -77,55 +297,254 @@ protected:
     };
     class page_cache *page_cache;
     class paged_file index_paged_file;
+    class page_handle header_handle;    //Keeps the file header page pinned while the index is open.
+    key_search_routine key_search;      //Search of a node with numeric keys, for the CPU we run on.
+    i64 rightmost_leaf_page_no;         //Last leaf seen by an insert, where ascending keys go (0 if unknown).
+    i64 ***node_latches;                //Blocks of chunks of node latches, indexed by page no.
+    i64 node_latch_page_num;            //Pages below which node latches are allocated (under 'alloc_latch').
+    pthread_mutex_t alloc_latch;        //Serializes taking and freeing pages.
 
     //Internal function to create a new or open an existed index file.
-    i64 open_paged_index_file(char *index_column_name, char *table_name);
+    i64 open_paged_index_file(char *index_column_name, char *table_name, enum paged_file_mode mode = Buffered);
 
 private:
-    //Fill the contents in 'index_slot' in the designated position 'pos' on a cached page.
-    /*Preequisite: The page should be cached first.*/
+    static const int linear_search_slots = 8;  //Node search scans this many slots in order instead of bisecting.
+    static const int batch_direct_search_keys = 8;      //Batches of as many keys are searched one key at a time.
+    static const int batch_insertion_sort_keys = 32;    //Batches of as many keys are sorted by insertion.
+    static const int batch_prefetch_distance = 4;       //Probes ahead of a batched search whose keys are fetched.
+    static constexpr double default_fill_factor = 0.9;
+    static const i64 default_sort_memory = 64 << 20;
+    static const i64 compact_page_capacity = PAGE_SIZE - sizeof(struct index_compact_page);
+    static const int node_latch_chunk_bits = 12;        //Latches of 2^12 pages in a chunk,
+    static const int node_latch_block_bits = 14;        //2^14 chunks in a block,
+    static const i64 max_node_latch_blocks = 1 << 14;   //and as many blocks: no page past them is taken.
+    static const int max_latch_spins = 100;             //Spins waiting for a node before yielding the CPU.
+
+    //Length of an index slot: index column, page no. and slot no.
+    inline i64 get_index_slot_len() {return index_file_header->index_column_length + sizeof(i64) * 2;}
+
+    //String keys are stored on compact pages.
+    inline bool is_compact_index() {return index_file_header->index_column_type == FIXED_LENGTH_STRING;}
+    //A NaN double key would break the order of the keys: it is neither inserted nor found.
+    inline bool is_nan_key(const char *key)
+    {
+        double value;
+        if(index_file_header->index_column_type != DOUBLE)
+            return false;
+        memcpy(&value, key, sizeof(value));
+        return value != value;
+    }
+
+    //Key and pointers (page no. and slot no.) of slot 'i' on a page with numeric keys.
+    inline char *get_node_key(class index_page *cursor, i64 i);
+    inline i64 *get_node_rid(class index_page *cursor, i64 i);
+
+    //Record of slot 'i' on a compact page, and the prefix of the page.
+    inline struct index_compact_record *get_compact_record(class index_page *cursor, i64 i);
+    inline char *get_compact_prefix(class index_page *cursor);
+
+    //Suffix length of record 'i' on a compact page, or -1 if the record does not lie within the page (a page read
+    //without a latch may be changing).
+    inline i64 get_compact_suffix_length(class index_page *cursor, i64 i);
+
+    //Bytes of a compact page taken by its slots, and the bytes expanded slots would take on a compact page.
+    inline i64 get_compact_page_used(class index_page *cursor);
+    i64 get_compact_slots_size(char *slots, i64 num);
+
+    //Find the first slot on a page whose key is not less than 'key' (the number of keys if there is none).
+    //'found' tells if that slot holds 'key' itself. The keys of the slots before 'from' are known to be less.
+    i64 search_index_page(class index_page *cursor, const char *key, bool &found, i64 from = 0);
+    i64 search_compact_page(class index_page *cursor, const char *key, bool &found, i64 from);
+
+    //Fill the contents in 'index_slot' in expanded slot 'pos'.
     void fill_index_page_slot(char *pos, struct index_page_slot *index_slot);
 
+    //Copy the key (the index column length, padded with NULs) or the page no. and slot no. of slot 'i' of a page.
+    void get_slot_key(class index_page *cursor, i64 i, char *key);
+    void get_slot_rid(class index_page *cursor, i64 i, struct index_page_slot *index_slot);
+
+    //Page no. of child 'i' of an internal node (the rightmost pointer for the key number), and its update.
+    inline i64 get_child_page_no(class index_page *node, i64 i);
+    inline void set_child_page_no(class index_page *node, i64 i, i64 page_no);
+
     //Find a specific index key contained in 'index_slot' on a page.
     bool find_index_slot_on_page(class index_page *cursor, struct index_page_slot *index_slot);
 
-    //Go through the tree until we reach the leaf node
-    i64 scurry_to_leaf(class index_page *&cursor, struct index_page_slot *index_slot);
+    //Go through the tree from the root until we reach the leaf of 'key' in 'cursor', recording the internal nodes
+    //in 'path'. Nodes are read without latches. Full nodes (for an insert) or nodes below the minimum (for a
+    //remove) are changed on the way down, which returns INDEX_RESTART, as does a change seen in a node.
+    i64 scurry_to_leaf(class index_page *&cursor, const char *key, struct index_path *path);
+
+    //Unpin the nodes above level 'depth' of the path.
+    void release_index_path(struct index_path *path, i64 depth);
+
+    //Sort the keys of a batched search: by the bits which order them (the key itself for numeric keys, 8 bytes after
+    //the prefix all keys share for string keys), then keys of the same bits by the whole key.
+    void sort_index_probes(struct index_probe *probes, i64 num);
+
+    //Go down from the deepest node kept by a batched search whose subtree may hold the key of probe 'probe_i', to
+    //the leaf of the key, which is left on top of the nodes. INDEX_RESTART on a change seen in a node.
+    i64 scurry_batch_to_leaf(struct index_batch *batch, i64 probe_i);
+
+    //Read ahead the leaves, children of 'node' read at 'version', of the probes from 'probe_i' on which lie under the
+    //node ('bound' is its greatest key), up to a readahead window. Adjacent pages are read by one request. Nothing is
+    //read ahead while the leaves are cached.
+    void prefetch_index_children(struct index_batch *batch, class index_page *node, i64 version, i64 probe_i,
+                                 const char *bound);
+
+    //Copy the key of slot 'i' as get_slot_key does, from a node read without a latch. False if the slot does not
+    //make a key within the page.
+    bool copy_slot_key(class index_page *cursor, i64 i, char *key);
+
+    //Latch of node 'page_no'.
+    i64 *get_node_latch(i64 page_no);
 
-    //Find position to insert new key.
-    i64 find_position_for_new_slot(class index_page *cursor, struct index_page_slot *index_slot, char *&insert_pos);
+    //Allocate the table of node latches, with the latches of the pages in use, and free it. DB_ERROR if memory runs
+    //out.
+    i64 init_node_latches();
+    void free_node_latches();
 
-    //Find if the specific index page is full.
+    //Allocate the latches of the pages below 'page_num' which have none yet. DB_ERROR if memory runs out or the
+    //table is full. Called with 'alloc_latch' held, or before the index is shared.
+    i64 add_node_latches(i64 page_num);
+
+    //Version of a node, once no writer holds it.
+    i64 read_node_version(i64 page_no);
+
+    //Find if a node is still at the version it was read at.
+    inline bool validate_node_version(i64 page_no, i64 version);
+
+    //Lock a node for the operation of 'path' if it is still at 'version' (or at any version if it is -1 and the
+    //node is not locked). Never waits.
+    bool lock_index_node(struct index_path *path, i64 page_no, i64 version);
+
+    //Unlock the nodes locked by the operation of 'path', moving their versions on.
+    void unlock_index_nodes(struct index_path *path);
+
+    //Lock the sibling which 'fix_underflow' pairs 'node' with (the parent is locked), and for leaves, the leaf after
+    //the pair, whose back link a merge changes.
+    i64 lock_index_sibling(struct index_path *path, i64 depth, class index_page *node);
+
+    //Split a full node, or fix a node below the minimum, met at level 'path->depth' on the way down and read at
+    //'version'. 'append' tells that the key of an insert goes past all keys of the node, on the right edge of the
+    //tree. INDEX_RESTART once done.
+    i64 restructure_on_descent(struct index_path *path, class index_page *node, i64 version, bool append);
+
+    //Insert a key greater than all keys of the index into the last leaf, without going down the tree, if the leaf
+    //remembered is still the last one and has room. INDEX_RESTART if the key has to go down the tree.
+    i64 append_to_rightmost_leaf(struct index_page_slot *index_slot);
+
+    //Lock the leaf reached by the path and insert into it, or remove 'key' from it.
+    i64 insert_to_leaf(struct index_path *path, class index_page *leaf, struct index_page_slot *index_slot);
+    i64 remove_from_leaf(struct index_path *path, class index_page *leaf, const char *key);
+
+    //Find if the specific index page may not take one more slot (of any key).
     inline bool is_index_page_full(class index_page *cursor);
 
-    //Insert directly the new index slot if the page has at least one available free slot.
-    i64 insert_index_slot_on_page(class index_page *cursor, struct index_page_slot *index_slot, char *insert_pos);
+    //Find if a page takes one more slot with key 'key'.
+    bool has_room_for_slot(class index_page *cursor, const char *key);
+
+    //Find if a node other than the root is below the minimum, or stays at least at it after losing any slot.
+    bool is_index_page_underfull(class index_page *cursor);
+    bool is_index_page_above_min(class index_page *cursor);
+
+    //Find if expanded slots fit on one page.
+    bool index_slots_fit(char *slots, i64 num);
+
+    //Insert the new index slot at position 'pos' of a page which has room for it.
+    i64 insert_index_slot_on_page(class index_page *cursor, i64 pos, struct index_page_slot *index_slot);
+
+    //Remove slot 'i' of a page.
+    void remove_index_slot_on_page(class index_page *cursor, i64 i);
+
+    //Copy all slots of a page into expanded slots. Return their number.
+    i64 expand_index_page(class index_page *cursor, char *slots);
+
+    //Rewrite the slots of a page from expanded slots (the header is kept but for the key number).
+    i64 fill_index_page(class index_page *cursor, char *slots, i64 num);
+
+    //Replace the key of slot 'i' of a page. DB_ERROR (and no change) if the page has no room for it.
+    i64 replace_index_key(class index_page *cursor, i64 i, const char *key);
+
+    //Choose how expanded slots are divided between two nodes: the first 'k' go left (for internal nodes, slot
+    //'k - 1' is promoted to the parent and its pointer becomes the rightmost pointer of the left node).
+    i64 get_split_point(char *slots, i64 num, enum index_page_flag flag);
+
+    //Separator of two leaves whose last and first keys are 'left_key' and 'right_key' (cut on compact pages).
+    void make_separator(const char *left_key, const char *right_key, char *separator);
+
+    //Fill nodes 'left' and 'right' with expanded slots divided at point 'k', and set their separator. An internal
+    //'right' takes 'rightmost_page_no' as its rightmost pointer.
+    i64 fill_split_pages(char *slots, i64 num, i64 k, i64 rightmost_page_no, class index_page *left,
+                         class index_page *right, char *separator);
+
+    //Insert 'index_slot' at position 'pos' of 'node', on level 'depth' of the path (the leaf if 'depth' is the path
+    //depth), splitting it if needed. An internal node takes the separator and left half of a split child, and the
+    //pointer after it becomes 'right_page_no', the right half.
+    i64 insert_to_node(struct index_path *path, i64 depth, class index_page *node, i64 pos, struct index_page_slot *index_slot,
+                       i64 right_page_no);
 
-    //Fill split leaf nodes: cursor(old page to be split) & new_page.
-    i64 fill_split_index_leaf_page(class index_page *cursor, class index_page *new_page, struct index_page_slot *index_slot, \
-                              char *insert_pos);
+    //Divide expanded slots ('rightmost_page_no' is the rightmost pointer, for internal nodes) between 'node', on level
+    //'depth' of the path, and a new right sibling, and insert their separator into the parent or a new root. If
+    //'append', the last slot goes past the others on the right edge of the tree: the node keeps all the others.
+    i64 split_index_node(struct index_path *path, i64 depth, class index_page *node, char *slots, i64 num,
+                         i64 rightmost_page_no, bool append);
 
-    //Fill split internal nodes: parent(old parent to be split) & new_parent.
-    i64 fill_split_index_internal_page(class index_page *parent, class index_page *new_parent, class index_page *new_child,
-                                 struct index_page_slot *index_slot, char *insert_pos);
+    //Create an empty node on a page taken from the free list, or past the used pages if the list is empty.
+    i64 create_index_node(class index_page *node, enum index_page_flag flag);
 
-    //Fill new root page
-    i64 fill_new_root_page(class index_page *root, class index_page *child_left, class index_page *child_right);
+    //Put the page of a node on the free list.
+    void free_index_node(class index_page *node);
 
-    //Find parent page
-    i64 find_parent_index_page(class index_page *child, class index_page *&parent);
+    //Fix 'node', child of node 'depth - 1' of the path, which is below the minimum: merge it with a sibling or
+    //even out their slots. The parent may be left below the minimum.
+    i64 fix_underflow(struct index_path *path, i64 depth, class index_page *node);
 
-    //Insert to parent page
-    i64 insert_to_parent_page(class index_page *parent, class index_page *new_sibling, class index_page *old_sibling);
+    //Move the children of 'node' from page 'end' on into the pages of 'dest' (recursively for internal nodes).
+    i64 relocate_index_nodes(class index_page *node, i64 end, i64 *dest, i64 &dest_i);
+
+    //Move a node to empty page 'page_no', fixing the leaf list. 'node' then holds the new page.
+    i64 move_index_node(class index_page *node, i64 page_no);
+
+    //Key comparison of the index column type.
+    key_compare_routine get_key_compare_routine();
+
+    //Node search of the index column type, the fastest the CPU supports (nullptr for string keys).
+    key_search_routine get_key_search_routine();
+
+    //Find if expanded slots (children with their largest key, for internal nodes) make a node of a bulk load.
+    bool fits_build_node(struct index_build *build, char *slots, i64 num, enum index_page_flag flag);
+
+    //Write a node of bulk load level 'level_i' from expanded slots, and add it to the level above. 'next_key' is
+    //the first key after the node, nullptr for the last one. The first leaf is the (empty) root page.
+    i64 write_build_node(struct index_build *build, i64 level_i, char *slots, i64 num, const char *next_key);
+
+    //Add an expanded slot to level 'level_i' of a bulk load.
+    i64 add_to_build_level(struct index_build *build, i64 level_i, const char *slot);
+
+    //Write the nodes held back by the levels of a bulk load, up to the root.
+    i64 finish_build(struct index_build *build);
+
+    //Scan routine of 'build_index': add an index slot for a record to the sorter.
+    static i64 collect_index_slot(void *arg, const char *content, i64 page_no, i64 slot_no);
 
 public:
-    index(class page_cache *page_cache) : page_cache(page_cache), page(nullptr){}
+    index(class page_cache *page_cache) : page_cache(page_cache), page(nullptr), key_search(nullptr),
+                                          rightmost_leaf_page_no(0), node_latches(nullptr), node_latch_page_num(0)
+    {
+        pthread_mutex_init(&alloc_latch, nullptr);
+    }
+    ~index()
+    {
+        free_node_latches();
+        pthread_mutex_destroy(&alloc_latch);
+    }
 
     //Create index file.
     i64 create_index(enum index_column_type type, char *table_name, char *index_column_name, i64 index_column_length);
 
-    //Open existed index file.
-    i64 open_index(char *table_name, char *index_column_name);
+    //Open existed index file. A read-mostly index can be mapped instead of going through the page cache.
+    i64 open_index(char *table_name, char *index_column_name, enum paged_file_mode mode = Buffered);
 
     //Close opened index file.
     i64 close_index();
@@ -133,31 +552,99 @@ public:
     //Get maximum slot number on a page.
     inline i64 get_slot_num_per_page(){return index_file_header->slot_num_per_page;}
 
-    //Search a specific index key in current index file.
+    //Search a specific index key in current index file. Search, insert and remove may be called concurrently.
     i64 search_key(struct index_page_slot *index_slot);
 
-    //Insert an index slot into current index file.
+    //Search the keys of 'num' index slots at once, as search_key does for each (page no. and slot no. are -1 for
+    //a key not found). Keys are searched in order, sharing the way down and reading ahead the leaves.
+    i64 search_keys(struct index_page_slot *index_slots, i64 num);
+
+    //Insert an index slot into current index file. DB_ERROR for a key already there, or a NaN key.
     i64 insert(struct index_page_slot *index_slot);
+
+    //Remove the slot of index key 'key'. DB_ERROR if there is none.
+    i64 remove(void *key);
+
+    //Shrink the index file to the pages in use, moving nodes into free pages.
+    i64 compact();
+
+    //Pages of the index file, and free pages among them.
+    inline i64 get_page_num() {return index_file_header->next_empty_page_no;}
+    inline i64 get_free_page_num() {return index_file_header->free_page_num;}
+
+    //Build an empty index from slots in key order, laid out as on a page (index column, page no., slot no.).
+    //Nodes are filled up to 'fill_factor' of their slots. Duplicated and NaN keys are not permitted: the build stops
+    //with DB_ERROR and the index has to be created again.
+    i64 bulk_load(class sorted_stream *slots, double fill_factor = default_fill_factor);
+
+    //Build an empty index from column 'column_no' of a table, sorting its keys in 'memory_budget' bytes.
+    i64 build_index(class record *table, i64 column_no, double fill_factor = default_fill_factor,
+                    i64 memory_budget = default_sort_memory);
 };
 
 //An individual index page (Internal or leaf page)
 class index_page{
 friend class index;
+friend class index_cursor;
 protected:    
     union{
         char *page;
         struct index_node_page *index_node_page;
+        struct index_compact_page *index_compact_page;
     };
     i64 page_no;
     class paged_file *index_paged_file;
+    class page_handle handle;       //The page is unpinned when the handle is released, at the latest on destruction.
 
 public:
-    index_page(class paged_file *index_paged_file) : index_paged_file(index_paged_file) {}
-    ~index_page();
+    index_page(class paged_file *index_paged_file) : page(nullptr), index_paged_file(index_paged_file) {}
+    //Pin page 'page_no' as this node, unpinning the page previously held.
+    i64 get_page(i64 page_no);
+    //Pin page 'page_no' as a new zeroed node.
+    i64 allocate_page(i64 page_no);
+    inline void mark_dirty() {handle.mark_dirty();}
+    inline void release() {handle.release(); page = nullptr;}
     i64 create_empty_node(enum index_page_flag flag, i64 page_no);
 };
 
+//Range scan over an open index. At most one leaf is pinned at a time.
+class index_cursor{
+private:
+    class index *idx;
+    class index_page *leaf;     //Leaf holding the position.
+    i64 pos;                    //Position: before slot 'pos' of the leaf.
+
+    //Copy slot 'pos' of the leaf into 'index_slot'.
+    void copy_slot(struct index_page_slot *index_slot);
+
+public:
+    index_cursor(class index *idx);
+    ~index_cursor();
+    //Position before the first key not less than 'key' (before the first key of the index if 'key' is nullptr).
+    //DB_ERROR for a NaN key.
+    i64 seek(void *key);
+    //Position after the last key of the index.
+    i64 seek_to_last();
+    //Return the slot after the position and move past it. The key is copied to 'index_slot->index_column' (which
+    //must hold the index column length). At the end, page no. and slot no. are set to -1.
+    i64 next(struct index_page_slot *index_slot);
+    //Return the slot before the position and move before it. At the beginning, page no. and slot no. are set to -1.
+    i64 prev(struct index_page_slot *index_slot);
+    //Unpin the leaf. The cursor must be positioned again before use.
+    void close();
+};
+
 extern void index_test();
 extern void index_test2();
+extern void index_concurrency_test();
+extern void index_concurrent_update_test();
+extern void index_mmap_test();
+extern void index_search_bench();
+extern void index_range_test();
+extern void index_bulk_load_test();
+extern void index_remove_test();
+extern void index_key_search_test();
+extern void index_batch_search_test();
+extern void index_sequential_insert_test();
 
 #endif
\ No newline at end of file
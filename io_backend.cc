@@ -0,0 +1,107 @@
+#include "io_backend.h"
+
+#include <limits.h>
+
+/* -------------------------------------- */
+//    Class positional_io_backend methods implementation
+i64 positional_io_backend::read_page(int fd, i64 page_no, char *page)
+{
+    ssize_t nbytes = pread(fd, page, PAGE_SIZE, page_no * PAGE_SIZE);
+    count_syscall(1);
+    count_read(nbytes);
+    return (nbytes == -1) ? DB_ERROR : DB_SUCCESS;
+}
+
+i64 positional_io_backend::read_pages(int fd, i64 page_no, char **pages, int page_num)
+{
+    struct iovec iov[IOV_MAX];
+
+    while(page_num > 0){
+        int iov_num = (page_num < IOV_MAX) ? page_num : IOV_MAX;
+        for(int i = 0; i < iov_num; ++i){
+            iov[i].iov_base = pages[i];
+            iov[i].iov_len = PAGE_SIZE;
+        }
+        ssize_t nbytes = preadv(fd, iov, iov_num, page_no * PAGE_SIZE);
+        count_syscall(1);
+        count_read(nbytes);
+        if(nbytes == -1)
+            return DB_ERROR;
+        //Reached the end of file.
+        if(nbytes < (ssize_t)iov_num * PAGE_SIZE)
+            break;
+        pages += iov_num;
+        page_no += iov_num;
+        page_num -= iov_num;
+    }
+    return DB_SUCCESS;
+}
+
+i64 positional_io_backend::write_page(int fd, i64 page_no, char *page)
+{
+    ssize_t nbytes = pwrite(fd, page, PAGE_SIZE, page_no * PAGE_SIZE);
+    count_syscall(1);
+    count_write(nbytes);
+    return (nbytes == PAGE_SIZE) ? DB_SUCCESS : DB_ERROR;
+}
+
+i64 positional_io_backend::write_pages(int fd, i64 page_no, char **pages, int page_num)
+{
+    struct iovec iov[IOV_MAX];
+
+    //A single pwritev can carry IOV_MAX buffers at most, so split long runs.
+    while(page_num > 0){
+        int iov_num = (page_num < IOV_MAX) ? page_num : IOV_MAX;
+        for(int i = 0; i < iov_num; ++i){
+            iov[i].iov_base = pages[i];
+            iov[i].iov_len = PAGE_SIZE;
+        }
+        ssize_t nbytes = pwritev(fd, iov, iov_num, page_no * PAGE_SIZE);
+        count_syscall(1);
+        count_write(nbytes);
+        if(nbytes != (ssize_t)iov_num * PAGE_SIZE)
+            return DB_ERROR;
+        pages += iov_num;
+        page_no += iov_num;
+        page_num -= iov_num;
+    }
+    return DB_SUCCESS;
+}
+
+/* -------------------------------------- */
+//    Class seek_io_backend methods implementation
+i64 seek_io_backend::read_page(int fd, i64 page_no, char *page)
+{
+    lseek(fd, page_no * PAGE_SIZE, SEEK_SET);
+    ssize_t nbytes = read(fd, page, PAGE_SIZE);
+    count_syscall(2);
+    count_read(nbytes);
+    return (nbytes == -1) ? DB_ERROR : DB_SUCCESS;
+}
+
+i64 seek_io_backend::read_pages(int fd, i64 page_no, char **pages, int page_num)
+{
+    for(int i = 0; i < page_num; ++i){
+        if(read_page(fd, page_no + i, pages[i]) != DB_SUCCESS)
+            return DB_ERROR;
+    }
+    return DB_SUCCESS;
+}
+
+i64 seek_io_backend::write_page(int fd, i64 page_no, char *page)
+{
+    lseek(fd, page_no * PAGE_SIZE, SEEK_SET);
+    ssize_t nbytes = write(fd, page, PAGE_SIZE);
+    count_syscall(2);
+    count_write(nbytes);
+    return (nbytes == PAGE_SIZE) ? DB_SUCCESS : DB_ERROR;
+}
+
+i64 seek_io_backend::write_pages(int fd, i64 page_no, char **pages, int page_num)
+{
+    for(int i = 0; i < page_num; ++i){
+        if(write_page(fd, page_no + i, pages[i]) != DB_SUCCESS)
+            return DB_ERROR;
+    }
+    return DB_SUCCESS;
+}
@@ -0,0 +1,103 @@
+#ifndef __IO_BACKEND_H__
+#define __IO_BACKEND_H__
+
+#include "db.h"
+
+#include <stdlib.h>
+#include <sys/uio.h>
+
+/*
+    I/O backend design:
+        All page I/O issued by the page cache goes through an I/O backend, so the way pages reach the disk can be
+        changed without touching the page cache.
+
+        Read page:   Read one page into a page buffer. Bytes beyond the end of file are left untouched.
+        Read pages:  Read a run of consecutive pages, each into its own page buffer (used by readahead).
+        Write page:  Write one page buffer to its position in the file.
+        Write pages: Write a run of consecutive pages, each held in its own page buffer.
+
+    Backends:
+        Positional I/O (default): pread / preadv / pwrite / pwritev. One system call per request, and no shared file offset,
+                                  so concurrent requests on the same file descriptor are safe.
+        Seek I/O:                 lseek followed by read / write, one page at a time. Kept for comparison only as
+                                  it is not safe to share a file descriptor across threads.
+
+    Counters:
+        Number of system calls, bytes read and bytes written. Updated atomically.
+
+    Asynchronous backends (async_io.h) can additionally write pages behind: the caller hands the page over and does
+    not wait for the write.
+
+    Page buffers:
+        Files may be opened with O_DIRECT, so every buffer passed to a backend must be aligned to PAGE_SIZE. Page
+        frames of the page cache are. Temporary buffers are allocated by 'alloc_page_buffers'.
+*/
+
+//Allocate PAGE_SIZE aligned buffers for 'page_num' pages. Free them by 'free_page_buffers'.
+inline char *alloc_page_buffers(int page_num)
+{
+    void *buf = nullptr;
+    if(posix_memalign(&buf, PAGE_SIZE, (size_t)page_num * PAGE_SIZE) != 0)
+        return nullptr;
+    return (char *)buf;
+}
+
+inline void free_page_buffers(char *buf) {free(buf);}
+
+struct io_stats {
+    i64 syscall_num;
+    i64 read_bytes;
+    i64 write_bytes;
+};
+
+class io_backend{
+protected:
+    struct io_stats stats;
+
+    inline void count_syscall(i64 num) {__sync_fetch_and_add(&stats.syscall_num, num);}
+    inline void count_read(i64 nbytes) {if(nbytes > 0) __sync_fetch_and_add(&stats.read_bytes, nbytes);}
+    inline void count_write(i64 nbytes) {if(nbytes > 0) __sync_fetch_and_add(&stats.write_bytes, nbytes);}
+
+public:
+    io_backend() {memset(&stats, 0, sizeof(stats));}
+    virtual ~io_backend() {}
+
+    //Return DB_ERROR on I/O error. A short read at the end of file is not an error.
+    virtual i64 read_page(int fd, i64 page_no, char *page) = 0;
+    virtual i64 read_pages(int fd, i64 page_no, char **pages, int page_num) = 0;
+    virtual i64 write_page(int fd, i64 page_no, char *page) = 0;
+    virtual i64 write_pages(int fd, i64 page_no, char **pages, int page_num) = 0;
+
+    //Write a page without waiting for it. The backend takes over 'page' (allocated by alloc_page_buffers).
+    //Synchronous backends simply write it.
+    virtual i64 write_page_behind(int fd, i64 page_no, char *page)
+    {
+        i64 ret = write_page(fd, page_no, page);
+        free_page_buffers(page);
+        return ret;
+    }
+    //Wait for pending writes behind of a page (of all pages of the file if 'page_no' is -1). Return DB_ERROR if
+    //one of them failed. A failed write is reported until a wait for all pages of its file has returned it.
+    virtual i64 wait_write_behind(int, i64) {return DB_SUCCESS;}
+    virtual bool is_async() {return false;}
+
+    inline void get_stats(struct io_stats *snapshot) {memcpy(snapshot, &stats, sizeof(stats));}
+};
+
+class positional_io_backend : public io_backend{
+public:
+    i64 read_page(int fd, i64 page_no, char *page);
+    i64 read_pages(int fd, i64 page_no, char **pages, int page_num);
+    i64 write_page(int fd, i64 page_no, char *page);
+    i64 write_pages(int fd, i64 page_no, char **pages, int page_num);
+};
+
+class seek_io_backend : public io_backend{
+public:
+    i64 read_page(int fd, i64 page_no, char *page);
+    i64 read_pages(int fd, i64 page_no, char **pages, int page_num);
+    i64 write_page(int fd, i64 page_no, char *page);
+    i64 write_pages(int fd, i64 page_no, char **pages, int page_num);
+};
+
+#endif
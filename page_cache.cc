@@ -1,5 +1,10 @@
 #include "page_cache.h"
 
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
 i64 paged_file::unpin_page_internal(struct page_meta *curr_page)
 {
     if(curr_page == nullptr)
@@ -12,246 +17,1775 @@ i64 paged_file::unpin_page_internal(struct page_meta *curr_page)
 
 i64 paged_file::unpin_page(i64 page_no)
 {
-    struct page_meta *page_info = page_cache->get_page(fd, page_no);
+    if(mode == Mapped)
+        return DB_SUCCESS;
+    struct page_meta *page_info = page_cache->lookup_page(fd, page_no);
     return unpin_page_internal(page_info);
 }
 
-i64 paged_file::open_paged_file(char *filename, class page_cache *page_cache)
+i64 paged_file::open_paged_file(char *filename, class page_cache *page_cache, enum paged_file_mode mode)
 {
     this->page_cache = page_cache;
+    this->mode = mode;
     init_double_linked_list_head(&this->pages_in_file);
-    fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    last_page_no = -2;
+    sequential_num = 0;
+    readahead_window = min_readahead_pages;
+    readahead_end = 0;
+    extent_page_num = min_extent_pages;
+    preallocation_supported = true;
+    if(mode == Direct){
+        fd = open(filename, O_RDWR | O_CREAT | O_DIRECT, S_IRUSR | S_IWUSR);
+        //The file system does not support direct I/O: fall back to buffered I/O.
+        if(fd == -1 && errno == EINVAL)
+            this->mode = Buffered;
+        else if(fd == -1)
+            return DB_ERROR;
+    }
+    if(this->mode != Direct)
+        fd = open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
     if(fd == -1)
         return DB_ERROR;
+
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) == -1){
+        close(fd);
+        return DB_ERROR;
+    }
+    logical_page_num = preallocated_page_num = (file_stat.st_size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    if(mode == Mapped){
+        //Only reserve address space here. Nothing is committed until the file is mapped into it.
+        map_base = (char *)mmap(nullptr, map_reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(map_base == MAP_FAILED){
+            close(fd);
+            return DB_ERROR;
+        }
+        mapped_page_num = 0;
+        if(map_file(logical_page_num) != DB_SUCCESS){
+            munmap(map_base, map_reserve_size);
+            close(fd);
+            return DB_ERROR;
+        }
+    }
+
+    this->filename = strdup(filename);
+    read_bytes = write_bytes = 0;
+    pthread_mutex_lock(&page_cache->files_latch);
+    double_linked_list_add_tail(&adjacent_open_files, &page_cache->open_files);
+    pthread_mutex_unlock(&page_cache->files_latch);
+    return DB_SUCCESS;
+}
+
+i64 paged_file::map_file(i64 page_num)
+{
+    if(page_num <= mapped_page_num)
+        return DB_SUCCESS;
+    if(page_num > map_reserve_size / PAGE_SIZE)
+        return DB_ERROR;
+    //Map the new part of the file right after the mapped part, so the mapping grows in place.
+    char *addr = map_base + mapped_page_num * PAGE_SIZE;
+    size_t length = (page_num - mapped_page_num) * PAGE_SIZE;
+    if(mmap(addr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, mapped_page_num * PAGE_SIZE) == MAP_FAILED)
+        return DB_ERROR;
+    __atomic_store_n(&mapped_page_num, page_num, __ATOMIC_RELEASE);
     return DB_SUCCESS;
 }
 
+char *paged_file::get_mapped_page(i64 page_no)
+{
+    if(page_no < __atomic_load_n(&mapped_page_num, __ATOMIC_ACQUIRE))
+        return map_base + page_no * PAGE_SIZE;
+
+    pthread_mutex_lock(&map_latch);
+    //The file may have been extended through another handle. Otherwise extend it, as accessing a mapped page past
+    //the end of file raises SIGBUS.
+    struct stat file_stat;
+    i64 page_num = page_no + 1;
+    i64 ret = DB_ERROR;
+    if(fstat(fd, &file_stat) != -1){
+        i64 file_page_num = (file_stat.st_size + PAGE_SIZE - 1) / PAGE_SIZE;
+        if(file_page_num < page_num && ftruncate(fd, page_num * PAGE_SIZE) == -1)
+            file_page_num = -1;
+        if(file_page_num != -1)
+            ret = map_file((file_page_num > page_num) ? file_page_num : page_num);
+    }
+    pthread_mutex_unlock(&map_latch);
+    return (ret == DB_SUCCESS) ? map_base + page_no * PAGE_SIZE : nullptr;
+}
+
+void paged_file::detect_sequential_access(i64 page_no)
+{
+    i64 readahead_start = 0;
+    int readahead_num = 0;
+
+    pthread_mutex_lock(&readahead_latch);
+    if(page_no == last_page_no + 1){
+        sequential_num++;
+    }
+    else if(page_no != last_page_no){
+        //Random access: start over with the smallest window.
+        sequential_num = 0;
+        readahead_window = min_readahead_pages;
+        readahead_end = 0;
+    }
+    last_page_no = page_no;
+    //Issue the next window once the reader gets into the second half of the current one.
+    if(sequential_num >= sequential_threshold && page_no + readahead_window / 2 >= readahead_end){
+        readahead_start = (readahead_end > page_no) ? readahead_end : page_no;
+        readahead_num = readahead_window;
+        readahead_end = readahead_start + readahead_num;
+        if(readahead_window < page_cache::max_readahead_pages)
+            readahead_window *= 2;
+    }
+    pthread_mutex_unlock(&readahead_latch);
+
+    if(readahead_num){
+        //Do not read past the end of file.
+        i64 file_page_num = get_logical_page_num();
+        if(readahead_start + readahead_num > file_page_num)
+            readahead_num = file_page_num - readahead_start;
+        if(readahead_num > 0)
+            page_cache->readahead(this, readahead_start, readahead_num);
+    }
+}
+
 i64 paged_file::get_page(i64 page_no, char *&page)
 {
-    off_t ret = lseek(fd, page_no * PAGE_SIZE, SEEK_SET);
-    if(ret == -1)
+    if(page_no < 0)
         return DB_ERROR;
+    if(mode == Mapped){
+        page = get_mapped_page(page_no);
+        return page ? DB_SUCCESS : DB_ERROR;
+    }
+    detect_sequential_access(page_no);
+    extend_logical_size(page_no);
 
+    //Page cache pins the page on behalf of this file.
     struct page_meta *page_info = page_cache->get_page(fd, page_no, this);
     if(page_info == nullptr){
         return DB_ERROR;
     }
-    if(!page_info->pinned){
-        page_info->pinned = 1;
-        delete_double_linked_list_entry(&page_info->adjacent_pages_in_free_list);
-        init_double_linked_list_head(&page_info->adjacent_pages_in_free_list);
-    }
     page = page_info->page;
 
     return DB_SUCCESS;
 }
 
+i64 paged_file::get_page_async(i64 page_no, class page_future *future)
+{
+    //A reused future is completed already. It is pending again from now on.
+    future->handle.release();
+    future->done = false;
+    if(page_no < 0){
+        future->finish(DB_ERROR);
+        return DB_ERROR;
+    }
+    if(mode == Mapped){
+        i64 ret = get_page(page_no, future->handle);
+        future->finish(ret);
+        return ret;
+    }
+    extend_logical_size(page_no);
+    return page_cache->get_page_async(fd, page_no, this, future);
+}
+
+i64 paged_file::get_page(i64 page_no, class page_handle &handle)
+{
+    handle.release();
+    if(page_no < 0)
+        return DB_ERROR;
+    if(mode == Mapped){
+        handle.page = get_mapped_page(page_no);
+        handle.page_no = page_no;
+        return handle.page ? DB_SUCCESS : DB_ERROR;
+    }
+    detect_sequential_access(page_no);
+    extend_logical_size(page_no);
+
+    struct page_meta *page_info = page_cache->get_page(fd, page_no, this);
+    if(page_info == nullptr)
+        return DB_ERROR;
+    handle.attach(page_info, page_cache);
+
+    return DB_SUCCESS;
+}
+
+bool paged_file::extend_logical_size(i64 page_no)
+{
+    i64 page_num = get_logical_page_num();
+    while(page_no >= page_num){
+        if(__atomic_compare_exchange_n(&logical_page_num, &page_num, page_no + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return true;
+    }
+    return false;
+}
+
+void paged_file::preallocate(i64 page_no)
+{
+    pthread_mutex_lock(&extent_latch);
+    if(preallocation_supported && page_no >= preallocated_page_num){
+        //Extents double up to a maximum, so a growing file takes few allocations.
+        i64 page_num = page_no + 1 - preallocated_page_num;
+        if(page_num < extent_page_num)
+            page_num = extent_page_num;
+        if(fallocate(fd, FALLOC_FL_KEEP_SIZE, preallocated_page_num * PAGE_SIZE, page_num * PAGE_SIZE) == 0)
+            preallocated_page_num += page_num;
+        else if(errno == EOPNOTSUPP)
+            preallocation_supported = false;
+        if(extent_page_num < max_extent_pages)
+            extent_page_num *= 2;
+    }
+    pthread_mutex_unlock(&extent_latch);
+}
+
+i64 paged_file::allocate_page(i64 page_no, class page_handle &handle)
+{
+    handle.release();
+    if(page_no < 0)
+        return DB_ERROR;
+    bool fresh = extend_logical_size(page_no);
+    if(fresh && mode != Mapped)
+        preallocate(page_no);
+
+    if(mode == Mapped){
+        handle.page = get_mapped_page(page_no);
+        handle.page_no = page_no;
+        if(handle.page == nullptr)
+            return DB_ERROR;
+        memset(handle.page, 0, PAGE_SIZE);
+        return DB_SUCCESS;
+    }
+
+    struct page_meta *page_info = page_cache->get_page(fd, page_no, this, fresh);
+    if(page_info == nullptr)
+        return DB_ERROR;
+    handle.attach(page_info, page_cache);
+    //A page inside the file may hold old contents.
+    if(!fresh)
+        memset(handle.page, 0, PAGE_SIZE);
+    handle.mark_dirty();
+
+    return DB_SUCCESS;
+}
+
 i64 paged_file::mark_page_dirty(i64 page_no)
 {
-    struct page_meta *page_info = page_cache->get_page(fd, page_no);
+    if(mode == Mapped)
+        return DB_SUCCESS;
+    struct page_meta *page_info = page_cache->lookup_page(fd, page_no);
     if(page_info == nullptr)
         return DB_ERROR;
-    page_info->dirty = 1;
+    page_cache->mark_page_dirty(page_info);
     return DB_SUCCESS;
 }
 
 i64 paged_file::commit_page(i64 page_no)
 {
-    struct page_meta *page_info = page_cache->get_page(fd, page_no);
+    i64 ret = DB_SUCCESS;
+
+    //A modified mapped page is already in the kernel page cache, like a written one.
+    if(mode == Mapped)
+        return DB_SUCCESS;
+    struct page_meta *page_info = page_cache->lookup_page(fd, page_no);
     if(page_info == nullptr)
         return DB_ERROR;
+    pthread_mutex_lock(&page_info->shard->latch);
+    page_info->shard->wait_for_flush(page_info);
+    //A page which could not be written stays dirty.
     if(page_info->dirty){
-        lseek(fd, page_info->page_no * PAGE_SIZE, SEEK_SET);
-        write(fd, page_info->page, PAGE_SIZE);
-        page_info->dirty = 0;
+        ret = page_info->shard->io->write_page(fd, page_info->page_no, page_info->page);
+        if(ret == DB_SUCCESS){
+            count_write(1);
+            page_info->dirty = 0;
+            page_info->shard->dirty_num--;
+        }
     }
+    pthread_mutex_unlock(&page_info->shard->latch);
     page_cache->insert_page_to_free_list(page_info);
-    return DB_SUCCESS;
+    return ret;
+}
+
+i64 paged_file::flush_paged_file()
+{
+    if(mode == Mapped){
+        //Start writeback of the modified mapped pages.
+        return (msync(map_base, mapped_page_num * PAGE_SIZE, MS_ASYNC) == 0) ? DB_SUCCESS : DB_ERROR;
+    }
+    i64 ret = page_cache->flush_pages_of_file(this);
+    //Dirty pages evicted earlier were written behind. A write behind that failed is reported here.
+    if(page_cache->get_io_backend()->wait_write_behind(fd, -1) != DB_SUCCESS)
+        ret = DB_ERROR;
+    return ret;
+}
+
+i64 paged_file::truncate_paged_file(i64 page_num)
+{
+    if(mode == Mapped || page_num < 0)
+        return DB_ERROR;
+    if(page_cache->discard_pages_of_file(this, page_num) != DB_SUCCESS)
+        return DB_ERROR;
+    //Writes behind must not land past the new end. One which failed is reported, though the file is truncated.
+    i64 ret = page_cache->get_io_backend()->wait_write_behind(fd, -1);
+    if(ftruncate(fd, page_num * PAGE_SIZE) != 0)
+        return DB_ERROR;
+
+    //Preallocated extents past the end are gone with it.
+    pthread_mutex_lock(&extent_latch);
+    __atomic_store_n(&logical_page_num, page_num, __ATOMIC_RELEASE);
+    preallocated_page_num = page_num;
+    extent_page_num = min_extent_pages;
+    pthread_mutex_unlock(&extent_latch);
+    return ret;
 }
 
 i64 paged_file::close_paged_file()
 {
-    struct page_meta *curr_page;
-    double_linked_list_for_each_entry(curr_page, &pages_in_file, adjacent_pages_in_file){
-        if(curr_page->dirty){
-            lseek(fd, curr_page->page_no * PAGE_SIZE, SEEK_SET);
-            write(fd, curr_page->page, PAGE_SIZE);
-            curr_page->dirty = 0;
-        }cout<<curr_page->page_no<<' ';
-        //Remove current page from lists in hash buckets.
-        page_cache->remove_page_from_hash_table(curr_page);
-        //Release pages used by current file and add it to the tail of free pages list.
-        page_cache->insert_page_to_free_list(curr_page);
-
-        //If the direct previous element is not the list head 'pages_in_file', we reset its contents.
-        //We do not reset the head for now, since there exists a corner case: 
-        //      the previous element of the head can not be reset in this iteration as it is the last iterated element.
-        struct double_linked_list_head *prev_elem = curr_page->adjacent_pages_in_file.prev;
-        if(prev_elem != &pages_in_file) 
-            init_double_linked_list_head(prev_elem);
-
-    }cout<<"fd: "<<fd<<endl;
-
-    //Corner case: Reset the previous element of the head.
-    init_double_linked_list_head(pages_in_file.prev);
-    
-    //The following works the same way as the snippet above except we iterate the list directly without using the macro. 
-    //A benifit of direct iteration is the elimination of the corner case.
-    /*struct double_linked_list_head *cursor = pages_in_file.next;
-    while(cursor != &pages_in_file){
-        curr_page = container_of(cursor, struct page_meta, adjacent_pages_in_file);
-        if(curr_page->dirty){
-            lseek(fd, curr_page->page_no * PAGE_SIZE, SEEK_SET);
-            write(fd, curr_page->page, PAGE_SIZE);
-            curr_page->dirty = 0;
-        }cout<<curr_page->page_no<<' ';
-        //Remove current page from lists in hash buckets.
-        page_cache->remove_page_from_hash_table(curr_page);
-        //Release pages used by current file and add it to the tail of free pages list.
-        page_cache->insert_page_to_free_list(curr_page);
-        struct double_linked_list_head *cursor_to_be_reset = cursor;
-        cursor = cursor->next;
-        init_double_linked_list_head(cursor_to_be_reset);
-    }cout<<"fd: "<<fd<<endl;*/
-
-    //Now we can safely reset the list head per se.
-    init_double_linked_list_head(&pages_in_file);
+    pthread_mutex_lock(&page_cache->files_latch);
+    delete_double_linked_list_entry(&adjacent_open_files);
+    pthread_mutex_unlock(&page_cache->files_latch);
+    free(filename);
+    filename = nullptr;
 
+    if(mode == Mapped){
+        munmap(map_base, map_reserve_size);
+        close(fd);
+        return DB_SUCCESS;
+    }
+    i64 ret = page_cache->release_pages_of_file(this);
+    //Pages of this file written behind must reach the disk before the file is closed.
+    if(page_cache->get_io_backend()->wait_write_behind(fd, -1) != DB_SUCCESS)
+        ret = DB_ERROR;
     close(fd);
+    return ret;
+}
+
+/* -------------------------------------- */
+//    Class page_handle methods implementation
+void page_handle::release()
+{
+    page = nullptr;
+    if(page_info == nullptr)
+        return;
+    page_cache->insert_page_to_free_list(page_info);
+    page_info = nullptr;
+}
+
+/* -------------------------------------- */
+//    Class page_future methods implementation
+page_future::page_future(void (*callback)(class page_future *future, void *arg), void *arg)
+{
+    this->callback = callback;
+    this->callback_arg = arg;
+    done = false;
+    ret = DB_ERROR;
+    pthread_mutex_init(&latch, nullptr);
+    pthread_cond_init(&done_cond, nullptr);
+}
+
+page_future::~page_future()
+{
+    //The request must not complete into a destroyed future.
+    wait();
+    handle.release();
+    pthread_cond_destroy(&done_cond);
+    pthread_mutex_destroy(&latch);
+}
+
+void page_future::finish(i64 ret)
+{
+    this->ret = ret;
+    if(callback)
+        callback(this, callback_arg);
+    pthread_mutex_lock(&latch);
+    done = true;
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&latch);
+}
+
+i64 page_future::wait()
+{
+    pthread_mutex_lock(&latch);
+    while(!done)
+        pthread_cond_wait(&done_cond, &latch);
+    pthread_mutex_unlock(&latch);
+    return ret;
+}
+
+/* -------------------------------------- */
+//    Class page_cache methods implementation
+//Map an anonymous region for the page frames. With 'huge_pages', try huge pages reserved for hugetlbfs first, then
+//fall back to a 2 MiB aligned region advised to be backed by transparent huge pages.
+static char *map_frame_pool(size_t &size, bool huge_pages, bool &hugetlb)
+{
+    const size_t huge_page_size = 2 * 1024 * 1024;
+    char *pool;
+
+    hugetlb = false;
+    if(!huge_pages){
+        pool = (char *)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return (pool == MAP_FAILED) ? nullptr : pool;
+    }
+
+    size = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+    pool = (char *)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(pool != MAP_FAILED){
+        hugetlb = true;
+        return pool;
+    }
+
+    //Over-map, then trim both ends so the pool starts at a huge page boundary.
+    char *region = (char *)mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(region == MAP_FAILED)
+        return nullptr;
+    pool = (char *)(((unsigned long)region + huge_page_size - 1) & ~(huge_page_size - 1));
+    if(pool > region)
+        munmap(region, pool - region);
+    if(region + huge_page_size > pool)
+        munmap(pool + size, region + huge_page_size - pool);
+    madvise(pool, size, MADV_HUGEPAGE);
+    return pool;
+}
+
+page_cache::page_cache(int total_pages, enum page_replacement_policy policy, int shard_num, bool huge_pages)
+{
+    this->shard_num = shard_num;
+    this->frame_pool_size = (size_t)total_pages * PAGE_SIZE;
+    this->huge_pages = huge_pages;
+    this->frame_pool = map_frame_pool(frame_pool_size, huge_pages, hugetlb);
+    if(frame_pool == nullptr)
+        exit(-1);
+    this->io = &default_io;
+    this->flusher_running = false;
+    pthread_mutex_init(&flusher_latch, nullptr);
+    pthread_cond_init(&flusher_wakeup, nullptr);
+    this->dumper_running = false;
+    pthread_mutex_init(&dumper_latch, nullptr);
+    pthread_cond_init(&dumper_wakeup, nullptr);
+    pthread_mutex_init(&files_latch, nullptr);
+    init_double_linked_list_head(&open_files);
+    shards = new class page_cache_shard * [shard_num];
+    //Spread pages evenly. The first shards take the remainder.
+    char *frames = frame_pool;
+    for(int i = 0; i < shard_num; ++i){
+        int shard_page_num = total_pages / shard_num + (i < total_pages % shard_num ? 1 : 0);
+        shards[i] = new class page_cache_shard(shard_page_num, policy, frames);
+        shards[i]->io = io;
+        frames += (size_t)shard_page_num * PAGE_SIZE;
+    }
+}
+
+void page_cache::set_compressed_cache_budget(i64 budget_bytes)
+{
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        delete shards[i]->second_tier;
+        shards[i]->second_tier = (budget_bytes > 0) ? new class compressed_cache(budget_bytes / shard_num) : nullptr;
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+}
+
+void page_cache::set_io_backend(class io_backend *io)
+{
+    this->io = io ? io : &default_io;
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        shards[i]->io = this->io;
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+}
+
+static int compare_page_no(const void *a, const void *b)
+{
+    i64 page_no_a = (*(struct page_meta **)a)->page_no;
+    i64 page_no_b = (*(struct page_meta **)b)->page_no;
+    return (page_no_a > page_no_b) - (page_no_a < page_no_b);
+}
+
+i64 page_cache::write_dirty_pages_of_file(class paged_file *paged_file)
+{
+    struct page_meta *curr_page;
+    int dirty_page_num = 0;
+    i64 ret = DB_SUCCESS;
+
+    pthread_mutex_lock(&paged_file->pages_in_file_latch);
+    double_linked_list_for_each_entry(curr_page, &paged_file->pages_in_file, adjacent_pages_in_file){
+        if(curr_page->dirty)
+            dirty_page_num++;
+    }
+    if(!dirty_page_num){
+        pthread_mutex_unlock(&paged_file->pages_in_file_latch);
+        return DB_SUCCESS;
+    }
+
+    //Sort dirty pages by page no. so that adjacent pages are written by a single request.
+    struct page_meta **dirty_pages = new struct page_meta * [dirty_page_num];
+    char **bufs = new char * [dirty_page_num];
+    int i = 0;
+    double_linked_list_for_each_entry(curr_page, &paged_file->pages_in_file, adjacent_pages_in_file){
+        if(curr_page->dirty)
+            dirty_pages[i++] = curr_page;
+    }
+    pthread_mutex_unlock(&paged_file->pages_in_file_latch);
+    qsort(dirty_pages, dirty_page_num, sizeof(struct page_meta *), compare_page_no);
+
+    int run_start = 0;
+    for(i = 0; i < dirty_page_num; ++i){
+        bufs[i] = dirty_pages[i]->page;
+        //Write current run if the next dirty page is not adjacent to current one. The pages of a run that failed
+        //stay dirty.
+        if(i + 1 == dirty_page_num || dirty_pages[i + 1]->page_no != dirty_pages[i]->page_no + 1){
+            if(io->write_pages(paged_file->fd, dirty_pages[run_start]->page_no, &bufs[run_start],
+                               i - run_start + 1) == DB_SUCCESS){
+                for(int j = run_start; j <= i; ++j){
+                    dirty_pages[j]->dirty = 0;
+                    dirty_pages[j]->shard->dirty_num--;
+                }
+                paged_file->count_write(i - run_start + 1);
+            }
+            else
+                ret = DB_ERROR;
+            run_start = i + 1;
+        }
+    }
+
+    delete [] bufs;
+    delete [] dirty_pages;
+    return ret;
+}
+
+i64 page_cache::flush_pages_of_file(class paged_file *paged_file)
+{
+    i64 ret;
+    //Shard latches are always taken in the same order here, and nowhere else is more than one held at a time.
+    //Background writes must finish first, or they could land after ours.
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        shards[i]->wait_for_flush(nullptr);
+    }
+    ret = write_dirty_pages_of_file(paged_file);
+    for(int i = shard_num - 1; i >= 0; --i){
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+    return ret;
+}
+
+page_cache::~page_cache()
+{
+    stop_flusher();
+    stop_stats_dump();
+    pthread_cond_destroy(&flusher_wakeup);
+    pthread_mutex_destroy(&flusher_latch);
+    pthread_cond_destroy(&dumper_wakeup);
+    pthread_mutex_destroy(&dumper_latch);
+    pthread_mutex_destroy(&files_latch);
+    for(int i = 0; i < shard_num; ++i){
+        delete shards[i];
+    }
+    delete [] shards;
+    munmap(frame_pool, frame_pool_size);
+}
+
+class page_cache_shard *page_cache::get_shard(int fd, i64 page_no)
+{
+    //High bits, so the shard does not correlate with the bucket inside a shard.
+    return shards[(page_hash(fd, page_no) >> 32) % shard_num];
+}
+
+i64 page_cache::resize(int total_pages)
+{
+    int new_total_pages = 0;
+    for(int i = 0; i < shard_num; ++i){
+        int shard_page_num = total_pages / shard_num + (i < total_pages % shard_num ? 1 : 0);
+        pthread_mutex_lock(&shards[i]->latch);
+        new_total_pages += shards[i]->resize(shard_page_num, huge_pages);
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+    return (new_total_pages == total_pages) ? DB_SUCCESS : DB_ERROR;
+}
+
+int page_cache::get_total_pages()
+{
+    int total_pages = 0;
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        total_pages += shards[i]->total_pages;
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+    return total_pages;
+}
+
+struct page_meta *page_cache::lookup_page(int fd, i64 page_no)
+{
+    class page_cache_shard *shard = get_shard(fd, page_no);
+    pthread_mutex_lock(&shard->latch);
+    struct page_meta *curr_page = shard->lookup_page(fd, page_no);
+    pthread_mutex_unlock(&shard->latch);
+    return curr_page;
+}
+
+struct page_meta *page_cache::get_page(int fd, i64 page_no, class paged_file *paged_file, bool fresh)
+{
+    class page_cache_shard *shard = get_shard(fd, page_no);
+    pthread_mutex_lock(&shard->latch);
+    struct page_meta *curr_page = shard->get_page(fd, page_no, paged_file, nullptr, fresh);
+    pthread_mutex_unlock(&shard->latch);
+    return curr_page;
+}
+
+i64 page_cache::get_page_async(int fd, i64 page_no, class paged_file *paged_file, class page_future *future)
+{
+    class page_cache_shard *shard = get_shard(fd, page_no);
+    bool read_pending = false;
+
+    pthread_mutex_lock(&shard->latch);
+    struct page_meta *curr_page = shard->get_page(fd, page_no, paged_file, &read_pending, false);
+    pthread_mutex_unlock(&shard->latch);
+
+    if(curr_page == nullptr){
+        future->finish(DB_ERROR);
+        return DB_ERROR;
+    }
+    future->handle.attach(curr_page, this);
+    //Cache hit, or a synchronous backend has read the page already.
+    if(!read_pending){
+        future->finish(DB_SUCCESS);
+        return DB_SUCCESS;
+    }
+
+    struct io_request *req = &future->req;
+    req->opcode = IO_READ;
+    req->fd = fd;
+    req->page_no = page_no;
+    req->page = curr_page->page;
+    req->complete = page_cache_shard::complete_async_read;
+    req->arg = future;
+    if(static_cast<class async_io_engine *>(io)->submit(req) != DB_SUCCESS){
+        req->result = -1;
+        page_cache_shard::complete_async_read(req);
+        return DB_ERROR;
+    }
     return DB_SUCCESS;
 }
 
-int page_cache::hash(int fd, i64 page_no)
+void page_cache::remove_page_from_hash_table(struct page_meta *curr_page)
+{
+    pthread_mutex_lock(&curr_page->shard->latch);
+    curr_page->shard->remove_page_from_hash_table(curr_page);
+    pthread_mutex_unlock(&curr_page->shard->latch);
+}
+
+void page_cache::insert_page_to_free_list(struct page_meta *curr_page)
 {
-    int res = fd;
-    res = res * 147 + (int)page_no;
-    res = res % bucket_size; //It is possible that the modulus is negative as C99 requires that (a/b) * b + a%b shall equal a. 
-    return (res >= 0) ? res : res + bucket_size;
+    pthread_mutex_lock(&curr_page->shard->latch);
+    curr_page->shard->insert_page_to_free_list(curr_page);
+    pthread_mutex_unlock(&curr_page->shard->latch);
 }
 
-page_cache::page_cache(int total_pages)
+void page_cache::mark_page_dirty(struct page_meta *curr_page)
 {
-    this->total_pages = total_pages;
-    this->bucket_size = total_pages / factor;
+    class page_cache_shard *shard = curr_page->shard;
+    bool wake_flusher = false;
+
+    pthread_mutex_lock(&shard->latch);
+    if(!curr_page->dirty){
+        curr_page->dirty = 1;
+        shard->dirty_num++;
+        wake_flusher = flusher_running && shard->dirty_num > shard->total_pages * dirty_high;
+    }
+    pthread_mutex_unlock(&shard->latch);
+
+    //Above the high watermark: do not wait for the next round.
+    if(wake_flusher){
+        pthread_mutex_lock(&flusher_latch);
+        flush_requested = true;
+        pthread_cond_signal(&flusher_wakeup);
+        pthread_mutex_unlock(&flusher_latch);
+    }
+}
+
+i64 page_cache::release_pages_of_file(class paged_file *paged_file)
+{
+    i64 ret = DB_SUCCESS;
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        shards[i]->wait_for_flush(nullptr);
+    }
+    //Pages left dirty by a failed write are written once more as they are released, which tells if one is lost.
+    write_dirty_pages_of_file(paged_file);
+    for(int i = shard_num - 1; i >= 0; --i){
+        if(shards[i]->release_pages_of_file(paged_file) != DB_SUCCESS)
+            ret = DB_ERROR;
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+    return ret;
+}
+
+i64 page_cache::discard_pages_of_file(class paged_file *paged_file, i64 page_no)
+{
+    struct page_meta *curr_page;
+    i64 ret = DB_SUCCESS;
+
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        shards[i]->wait_for_flush(nullptr);
+    }
+    pthread_mutex_lock(&paged_file->pages_in_file_latch);
+    double_linked_list_for_each_entry(curr_page, &paged_file->pages_in_file, adjacent_pages_in_file){
+        if(curr_page->page_no >= page_no && curr_page->pinned){
+            ret = DB_ERROR;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&paged_file->pages_in_file_latch);
+    for(int i = shard_num - 1; i >= 0; --i){
+        if(ret == DB_SUCCESS)
+            shards[i]->discard_pages_of_file(paged_file, page_no);
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+    return ret;
+}
+
+i64 page_cache::start_flusher(double clean_fraction, double dirty_low, double dirty_high, int interval_ms)
+{
+    if(flusher_running)
+        return DB_ERROR;
+    this->clean_fraction = clean_fraction;
+    this->dirty_low = dirty_low;
+    this->dirty_high = dirty_high;
+    this->flush_interval_ms = interval_ms;
+    flusher_stopping = false;
+    flush_requested = false;
+    if(pthread_create(&flusher, nullptr, run_flusher, this) != 0)
+        return DB_ERROR;
+    flusher_running = true;
+    return DB_SUCCESS;
+}
+
+void page_cache::stop_flusher()
+{
+    if(!flusher_running)
+        return;
+    pthread_mutex_lock(&flusher_latch);
+    flusher_stopping = true;
+    pthread_cond_signal(&flusher_wakeup);
+    pthread_mutex_unlock(&flusher_latch);
+    pthread_join(flusher, nullptr);
+    flusher_running = false;
+}
+
+void *page_cache::run_flusher(void *arg)
+{
+    class page_cache *pg_cache = (class page_cache *)arg;
+    char *bufs = alloc_page_buffers(page_cache_shard::flush_batch);
+    struct timespec deadline;
+
+    pthread_mutex_lock(&pg_cache->flusher_latch);
+    while(!pg_cache->flusher_stopping){
+        pg_cache->flush_requested = false;
+        pthread_mutex_unlock(&pg_cache->flusher_latch);
+
+        for(int i = 0; i < pg_cache->shard_num; ++i){
+            class page_cache_shard *shard = pg_cache->shards[i];
+            int clean_page_num = shard->total_pages * pg_cache->clean_fraction;
+            int dirty_low_num = shard->total_pages * pg_cache->dirty_low;
+            int dirty_high_num = shard->total_pages * pg_cache->dirty_high;
+            //A full batch means there may be more to flush.
+            while(shard->flush_ahead(clean_page_num, dirty_low_num, dirty_high_num, bufs) == page_cache_shard::flush_batch);
+        }
+
+        pthread_mutex_lock(&pg_cache->flusher_latch);
+        if(pg_cache->flusher_stopping || pg_cache->flush_requested)
+            continue;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)pg_cache->flush_interval_ms * 1000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&pg_cache->flusher_wakeup, &pg_cache->flusher_latch, &deadline);
+    }
+    pthread_mutex_unlock(&pg_cache->flusher_latch);
+
+    free_page_buffers(bufs);
+    return nullptr;
+}
+
+void page_cache::readahead(class paged_file *paged_file, i64 page_no, int page_num)
+{
+    struct page_meta *pages[max_readahead_pages];
+    char *bufs[max_readahead_pages];
+    int fd = paged_file->fd;
+
+    //Take frames one page at a time, so at most one shard latch is held.
+    for(int i = 0; i < page_num; ++i){
+        class page_cache_shard *shard = get_shard(fd, page_no + i);
+        pthread_mutex_lock(&shard->latch);
+        pages[i] = shard->get_readahead_page(fd, page_no + i, paged_file);
+        pthread_mutex_unlock(&shard->latch);
+        if(pages[i])
+            bufs[i] = pages[i]->page;
+    }
+
+    //Read each run of pages which got a frame by a single request.
+    int run_start = 0;
+    for(int i = 0; i < page_num; ++i){
+        if(pages[i] == nullptr){
+            run_start = i + 1;
+            continue;
+        }
+        if(i + 1 < page_num && pages[i + 1])
+            continue;
+        i64 ret = io->read_pages(fd, page_no + run_start, &bufs[run_start], i - run_start + 1);
+        if(ret == DB_SUCCESS)
+            paged_file->count_read(i - run_start + 1);
+        for(int j = run_start; j <= i; ++j){
+            class page_cache_shard *shard = pages[j]->shard;
+            pthread_mutex_lock(&shard->latch);
+            pages[j]->loading = 0;
+            if(ret == DB_SUCCESS)
+                shard->insert_page_to_free_list(pages[j]);
+            else
+                shard->discard_page(pages[j]);
+            pthread_cond_broadcast(&shard->load_done);
+            pthread_mutex_unlock(&shard->latch);
+        }
+        run_start = i + 1;
+    }
+}
+
+void page_cache::get_readahead_stats(i64 *readahead_num, i64 *hit_num, i64 *wasted_num)
+{
+    *readahead_num = *hit_num = *wasted_num = 0;
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        *readahead_num += shards[i]->readahead_num;
+        *hit_num += shards[i]->readahead_hit_num;
+        *wasted_num += shards[i]->readahead_wasted_num;
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+}
+
+i64 page_cache::get_eviction_write_num()
+{
+    i64 write_num = 0;
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        write_num += shards[i]->eviction_write_num;
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+    return write_num;
+}
+
+i64 page_cache::get_background_write_num()
+{
+    i64 write_num = 0;
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        write_num += shards[i]->background_write_num;
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+    return write_num;
+}
+
+i64 page_cache::get_hit_num()
+{
+    i64 hit_num = 0;
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        hit_num += shards[i]->hit_num;
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+    return hit_num;
+}
+
+i64 page_cache::get_miss_num()
+{
+    i64 miss_num = 0;
+    for(int i = 0; i < shard_num; ++i){
+        pthread_mutex_lock(&shards[i]->latch);
+        miss_num += shards[i]->miss_num;
+        pthread_mutex_unlock(&shards[i]->latch);
+    }
+    return miss_num;
+}
+
+void page_cache::get_stats(struct page_cache_stats *snapshot)
+{
+    memset(snapshot, 0, sizeof(struct page_cache_stats));
+    for(int i = 0; i < shard_num; ++i){
+        class page_cache_shard *shard = shards[i];
+        pthread_mutex_lock(&shard->latch);
+        snapshot->total_pages += shard->total_pages;
+        snapshot->dirty_num += shard->dirty_num;
+        snapshot->hot_num += shard->hot_page_num;
+        snapshot->hit_num += shard->hit_num;
+        snapshot->miss_num += shard->miss_num;
+        snapshot->eviction_num += shard->eviction_num;
+        snapshot->eviction_write_num += shard->eviction_write_num;
+        snapshot->background_write_num += shard->background_write_num;
+        snapshot->readahead_num += shard->readahead_num;
+        snapshot->readahead_hit_num += shard->readahead_hit_num;
+        snapshot->readahead_wasted_num += shard->readahead_wasted_num;
+        snapshot->pin_wait_num += shard->pin_wait_num;
+        snapshot->pin_wait_ns += shard->pin_wait_ns;
+        snapshot->depleted_num += shard->depleted_num;
+        for(int j = 0; j < MISS_LATENCY_BUCKETS; ++j){
+            snapshot->miss_latency[j] += shard->miss_latency[j];
+        }
+        if(shard->second_tier){
+            struct compressed_cache_stats tier_stats;
+            shard->second_tier->get_stats(&tier_stats);
+            i64 *sum = (i64 *)&snapshot->second_tier, *part = (i64 *)&tier_stats;
+            //All counters are i64 and add up across shards.
+            for(int j = 0; j < (int)(sizeof(tier_stats) / sizeof(i64)); ++j){
+                sum[j] += part[j];
+            }
+        }
+        pthread_mutex_unlock(&shard->latch);
+    }
+    io->get_stats(&snapshot->io);
+}
+
+i64 get_miss_latency_percentile(struct page_cache_stats *stats, double fraction)
+{
+    i64 miss_num = 0, counted_num = 0;
+    for(int i = 0; i < MISS_LATENCY_BUCKETS; ++i){
+        miss_num += stats->miss_latency[i];
+    }
+    if(!miss_num)
+        return 0;
+    for(int i = 0; i < MISS_LATENCY_BUCKETS; ++i){
+        counted_num += stats->miss_latency[i];
+        if(counted_num >= miss_num * fraction)
+            return 1LL << (i + 1);
+    }
+    return 1LL << MISS_LATENCY_BUCKETS;
+}
+
+i64 page_cache::dump_stats(int fd)
+{
+    struct page_cache_stats stats;
+    class paged_file *paged_file;
+    char buf[4096];
+    int len = 0;
+
+    get_stats(&stats);
+    len += snprintf(buf + len, sizeof(buf) - len,
+        "page_cache time_ns=%lld pages=%lld dirty=%lld hot=%lld hits=%lld misses=%lld evictions=%lld eviction_writes=%lld "
+        "background_writes=%lld readahead=%lld readahead_hits=%lld readahead_wasted=%lld pin_waits=%lld "
+        "pin_wait_ns=%lld depleted=%lld miss_p50_ns=%lld miss_p99_ns=%lld syscalls=%lld read_bytes=%lld "
+        "write_bytes=%lld\n",
+        monotonic_ns(), stats.total_pages, stats.dirty_num, stats.hot_num, stats.hit_num, stats.miss_num, stats.eviction_num,
+        stats.eviction_write_num, stats.background_write_num, stats.readahead_num, stats.readahead_hit_num,
+        stats.readahead_wasted_num, stats.pin_wait_num, stats.pin_wait_ns, stats.depleted_num,
+        get_miss_latency_percentile(&stats, 0.5), get_miss_latency_percentile(&stats, 0.99), stats.io.syscall_num,
+        stats.io.read_bytes, stats.io.write_bytes);
+    //Non empty histogram buckets, as upper bound in ns:count.
+    len += snprintf(buf + len, sizeof(buf) - len, "miss_latency");
+    for(int i = 0; i < MISS_LATENCY_BUCKETS && len < (int)sizeof(buf); ++i){
+        if(stats.miss_latency[i])
+            len += snprintf(buf + len, sizeof(buf) - len, " %lld:%lld", 1LL << (i + 1), stats.miss_latency[i]);
+    }
+    if(len < (int)sizeof(buf))
+        len += snprintf(buf + len, sizeof(buf) - len, "\n");
+    if(stats.second_tier.budget_bytes && len < (int)sizeof(buf)){
+        len += snprintf(buf + len, sizeof(buf) - len,
+            "compressed_cache pages=%lld used_bytes=%lld budget_bytes=%lld lookups=%lld hits=%lld stores=%lld "
+            "rejects=%lld drops=%lld compress_ns=%lld decompress_ns=%lld stored_bytes=%lld compressed_bytes=%lld\n",
+            stats.second_tier.page_num, stats.second_tier.used_bytes, stats.second_tier.budget_bytes,
+            stats.second_tier.lookup_num, stats.second_tier.hit_num, stats.second_tier.store_num,
+            stats.second_tier.reject_num, stats.second_tier.drop_num, stats.second_tier.compress_ns,
+            stats.second_tier.decompress_ns, stats.second_tier.stored_bytes, stats.second_tier.compressed_bytes);
+    }
+    if(len > (int)sizeof(buf))
+        len = sizeof(buf);
+    if(write(fd, buf, len) != len)
+        return DB_ERROR;
+
+    //One line per open file, written one at a time as there may be many.
+    pthread_mutex_lock(&files_latch);
+    double_linked_list_for_each_entry(paged_file, &open_files, adjacent_open_files){
+        len = snprintf(buf, sizeof(buf), "paged_file fd=%d name=%s read_bytes=%lld write_bytes=%lld\n",
+                       paged_file->fd, paged_file->filename, paged_file->get_read_bytes(), paged_file->get_write_bytes());
+        if(len > (int)sizeof(buf))
+            len = sizeof(buf);
+        if(write(fd, buf, len) != len){
+            pthread_mutex_unlock(&files_latch);
+            return DB_ERROR;
+        }
+    }
+    pthread_mutex_unlock(&files_latch);
+    return DB_SUCCESS;
+}
+
+i64 page_cache::start_stats_dump(const char *filename, int interval_ms)
+{
+    if(dumper_running)
+        return DB_ERROR;
+    stats_fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    if(stats_fd == -1)
+        return DB_ERROR;
+    stats_interval_ms = interval_ms;
+    dumper_stopping = false;
+    if(pthread_create(&stats_dumper, nullptr, run_stats_dumper, this) != 0){
+        close(stats_fd);
+        return DB_ERROR;
+    }
+    dumper_running = true;
+    return DB_SUCCESS;
+}
+
+void page_cache::stop_stats_dump()
+{
+    if(!dumper_running)
+        return;
+    pthread_mutex_lock(&dumper_latch);
+    dumper_stopping = true;
+    pthread_cond_signal(&dumper_wakeup);
+    pthread_mutex_unlock(&dumper_latch);
+    pthread_join(stats_dumper, nullptr);
+    close(stats_fd);
+    dumper_running = false;
+}
+
+void *page_cache::run_stats_dumper(void *arg)
+{
+    class page_cache *pg_cache = (class page_cache *)arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&pg_cache->dumper_latch);
+    while(!pg_cache->dumper_stopping){
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)pg_cache->stats_interval_ms * 1000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&pg_cache->dumper_wakeup, &pg_cache->dumper_latch, &deadline);
+        pthread_mutex_unlock(&pg_cache->dumper_latch);
+        //Also dump once when stopped, so the last interval is not lost.
+        pg_cache->dump_stats(pg_cache->stats_fd);
+        pthread_mutex_lock(&pg_cache->dumper_latch);
+    }
+    pthread_mutex_unlock(&pg_cache->dumper_latch);
+    return nullptr;
+}
+
+/* -------------------------------------- */
+//    Class page_cache_shard methods implementation
+int page_cache_shard::get_bucket_num(int page_num)
+{
+    int bucket_num = 1;
+    while(bucket_num < page_num)
+        bucket_num <<= 1;
+    return bucket_num;
+}
+
+void page_cache_shard::start_rehash(int bucket_num)
+{
+    //Finish the previous resize first.
+    if(old_page_bucket)
+        rehash(old_bucket_num);
+
+    old_page_bucket = page_bucket;
+    old_bucket_num = bucket_mask + 1;
+    rehash_index = 0;
+    page_bucket = new struct double_linked_list_head [bucket_num];
+    bucket_mask = bucket_num - 1;
+    for(int i = 0; i < bucket_num; ++i){
+        init_double_linked_list_head(&page_bucket[i]);
+    }
+}
+
+void page_cache_shard::rehash(int bucket_num)
+{
+    if(old_page_bucket == nullptr)
+        return;
+    for(; bucket_num > 0 && rehash_index < old_bucket_num; --bucket_num, ++rehash_index){
+        struct double_linked_list_head *old_bucket = &old_page_bucket[rehash_index];
+        while(!double_linked_list_empty(old_bucket)){
+            struct page_meta *curr_page = container_of(old_bucket->next, struct page_meta, adjacent_pages_in_hash_table);
+            delete_double_linked_list_entry(&curr_page->adjacent_pages_in_hash_table);
+            double_linked_list_add_head(&curr_page->adjacent_pages_in_hash_table, get_bucket(curr_page->fd, curr_page->page_no));
+        }
+    }
+    if(rehash_index == old_bucket_num){
+        delete [] old_page_bucket;
+        old_page_bucket = nullptr;
+    }
+}
+
+i64 page_cache_shard::add_chunk(int page_num, char *frames, bool huge_pages)
+{
+    struct page_meta_chunk *chunk = new struct page_meta_chunk;
+    bool hugetlb;
+
+    chunk->page_num = page_num;
+    chunk->frames = nullptr;
+    chunk->frames_size = 0;
+    if(frames == nullptr){
+        chunk->frames_size = (size_t)page_num * PAGE_SIZE;
+        chunk->frames = frames = map_frame_pool(chunk->frames_size, huge_pages, hugetlb);
+        if(frames == nullptr){
+            delete chunk;
+            return DB_ERROR;
+        }
+    }
+    //Plain new does not honor the cache line alignment of page metas before C++17.
+    if(posix_memalign((void **)&chunk->pages, CACHE_LINE_SIZE, sizeof(struct page_meta) * page_num) != 0){
+        if(chunk->frames)
+            munmap(chunk->frames, chunk->frames_size);
+        delete chunk;
+        return DB_ERROR;
+    }
+    memset(chunk->pages, 0, sizeof(struct page_meta) * page_num);
+
+    //New pages go to the head of free pages list, so they are used before any cached page is evicted.
+    for(int i = 0; i < page_num; ++i){
+        chunk->pages[i].shard = this;
+        chunk->pages[i].page = frames + (size_t)i * PAGE_SIZE;
+        double_linked_list_add_head(&chunk->pages[i].adjacent_pages_in_free_list, &free_pages);
+    }
+    //The snippet below is more efficient than the previous one, although the previous one seems more succinct. 
+    /*for(int i = 0; i < page_num - 1; ++i){
+        chunk->pages[i].adjacent_pages_in_free_list.next = &(chunk->pages[i + 1].adjacent_pages_in_free_list);
+        chunk->pages[i + 1].adjacent_pages_in_free_list.prev = &(chunk->pages[i].adjacent_pages_in_free_list);
+    }
+    chunk->pages[0].adjacent_pages_in_free_list.prev = &free_pages;
+    chunk->pages[page_num - 1].adjacent_pages_in_free_list.next = &free_pages;
+    free_pages.next = &(chunk->pages[0].adjacent_pages_in_free_list);
+    free_pages.prev = &(chunk->pages[page_num - 1].adjacent_pages_in_free_list);*/
+
+    chunk->next = chunks;
+    chunks = chunk;
+    total_pages += page_num;
+    return DB_SUCCESS;
+}
+
+page_cache_shard::page_cache_shard(int total_pages, enum page_replacement_policy policy, char *frames)
+{
+    this->total_pages = 0;
+    this->chunks = nullptr;
+    this->policy = policy;
+    this->hot_page_num = 0;
+    this->probation_threshold = total_pages / 4;
+    this->hit_num = this->miss_num = 0;
+    this->dirty_num = this->flushing_num = 0;
+    this->draining = false;
+    this->eviction_write_num = this->background_write_num = 0;
+    this->readahead_num = this->readahead_hit_num = this->readahead_wasted_num = 0;
+    this->eviction_num = this->pin_wait_num = this->pin_wait_ns = this->depleted_num = 0;
+    memset(miss_latency, 0, sizeof(miss_latency));
+    this->second_tier = nullptr;
+    this->all_ghosts = nullptr;
+    this->ghost_bucket = nullptr;
+    this->old_page_bucket = nullptr;
+    pthread_mutex_init(&latch, nullptr);
+    pthread_cond_init(&load_done, nullptr);
+    pthread_cond_init(&flush_done, nullptr);
+    init_double_linked_list_head(&hot_pages);
+    init_double_linked_list_head(&ghost_queue);
+    init_double_linked_list_head(&free_ghosts);
+    init_double_linked_list_head(&free_pages);
+    init_double_linked_list_head(&retired_pages);
+
+    int bucket_num = get_bucket_num(total_pages);
+    page_bucket = new struct double_linked_list_head [bucket_num];
+    bucket_mask = bucket_num - 1;
+    for(int i = 0; i < bucket_num; ++i){
+        init_double_linked_list_head(&page_bucket[i]);
+    }
+
+    if(add_chunk(total_pages, frames, false) != DB_SUCCESS){
+        delete [] page_bucket;
+        exit(-1);
+    }
+
+    //2Q remembers as many evicted pages as half of the cached pages.
+    if(policy == Two_queue){
+        int ghost_num = total_pages / 2;
+        int ghost_bucket_num = get_bucket_num(ghost_num);
+        all_ghosts = new struct ghost_page [ghost_num];
+        ghost_bucket = new struct double_linked_list_head [ghost_bucket_num];
+        ghost_bucket_mask = ghost_bucket_num - 1;
+        for(int i = 0; i < ghost_bucket_num; ++i){
+            init_double_linked_list_head(&ghost_bucket[i]);
+        }
+        for(int i = 0; i < ghost_num; ++i){
+            double_linked_list_add_tail(&all_ghosts[i].adjacent_ghosts_in_queue, &free_ghosts);
+        }
+    }
+}
+
+page_cache_shard::~page_cache_shard()
+{
+    while(chunks){
+        struct page_meta_chunk *chunk = chunks;
+        chunks = chunk->next;
+        if(chunk->frames)
+            munmap(chunk->frames, chunk->frames_size);
+        free(chunk->pages);
+        delete chunk;
+    }
+    delete second_tier;
+    delete [] page_bucket;
+    delete [] old_page_bucket;
+    delete [] all_ghosts;
+    delete [] ghost_bucket;
+    pthread_cond_destroy(&flush_done);
+    pthread_cond_destroy(&load_done);
+    pthread_mutex_destroy(&latch);
+}
+
+int page_cache_shard::resize(int new_total_pages, bool huge_pages)
+{
+    //Shrink: retire unpinned pages in eviction order. Never wait for a page.
+    while(total_pages > new_total_pages){
+        struct page_meta *victim = select_victim_page();
+        if(victim == nullptr || victim->flushing || evict_page(victim) != DB_SUCCESS)
+            break;
+        victim->fd = -1;
+        victim->page_no = -1;
+        victim->hot = 0;
+        victim->referenced = 0;
+        //Give the frame back to the kernel. It is faulted in again when the page is reused.
+        madvise(victim->page, PAGE_SIZE, MADV_DONTNEED);
+        double_linked_list_add_tail(&victim->adjacent_pages_in_free_list, &retired_pages);
+        total_pages--;
+    }
+
+    //Grow: reuse retired pages first, then add a chunk.
+    while(total_pages < new_total_pages && !double_linked_list_empty(&retired_pages)){
+        struct page_meta *curr_page = container_of(retired_pages.next, struct page_meta, adjacent_pages_in_free_list);
+        delete_double_linked_list_entry(&curr_page->adjacent_pages_in_free_list);
+        double_linked_list_add_head(&curr_page->adjacent_pages_in_free_list, &free_pages);
+        total_pages++;
+    }
+    if(total_pages < new_total_pages)
+        add_chunk(new_total_pages - total_pages, nullptr, huge_pages);
+
+    probation_threshold = total_pages / 4;
+    //Keep about one page per bucket.
+    int bucket_num = get_bucket_num(total_pages);
+    if(bucket_num > bucket_mask + 1 || bucket_num * 4 <= bucket_mask + 1)
+        start_rehash(bucket_num);
+    return total_pages;
+}
+
+struct page_meta *page_cache_shard::select_victim_page()
+{
+    struct page_meta *victim;
+
+    switch(policy){
+        case Clock:
+            //The head of free pages list is the clock hand. Each referenced page loses its reference bit and is moved
+            //behind the hand, so the sweep ends within two rounds at most.
+            while(!double_linked_list_empty(&free_pages)){
+                victim = container_of(free_pages.next, struct page_meta, adjacent_pages_in_free_list);
+                if(!victim->referenced)
+                    return victim;
+                victim->referenced = 0;
+                delete_double_linked_list_entry(&victim->adjacent_pages_in_free_list);
+                double_linked_list_add_tail(&victim->adjacent_pages_in_free_list, &free_pages);
+            }
+            return nullptr;
+
+        case Two_queue:
+            //Recycle probation pages first unless the probation queue is small enough to protect hot pages.
+            //Never used pages are counted as probation pages, so they are always consumed first.
+            if(!double_linked_list_empty(&free_pages) && 
+                (total_pages - hot_page_num > probation_threshold || double_linked_list_empty(&hot_pages)))
+                return container_of(free_pages.next, struct page_meta, adjacent_pages_in_free_list);
+            if(!double_linked_list_empty(&hot_pages))
+                return container_of(hot_pages.next, struct page_meta, adjacent_pages_in_free_list);
+            return nullptr;
+
+        default:
+            if(double_linked_list_empty(&free_pages))
+                return nullptr;
+            return container_of(free_pages.next, struct page_meta, adjacent_pages_in_free_list);
+    }
+}
+
+void page_cache_shard::remember_ghost_page(struct page_meta *curr_page)
+{
+    struct ghost_page *ghost;
+
+    //Recycle the oldest ghost if there is no unused entry.
+    if(double_linked_list_empty(&free_ghosts)){
+        ghost = container_of(ghost_queue.next, struct ghost_page, adjacent_ghosts_in_queue);
+        delete_double_linked_list_entry(&ghost->adjacent_ghosts_in_hash_table);
+    }
+    else{
+        ghost = container_of(free_ghosts.next, struct ghost_page, adjacent_ghosts_in_queue);
+    }
+    delete_double_linked_list_entry(&ghost->adjacent_ghosts_in_queue);
+
+    ghost->fd = curr_page->fd;
+    ghost->page_no = curr_page->page_no;
+    double_linked_list_add_head(&ghost->adjacent_ghosts_in_hash_table, &ghost_bucket[page_hash(ghost->fd, ghost->page_no) & ghost_bucket_mask]);
+    double_linked_list_add_tail(&ghost->adjacent_ghosts_in_queue, &ghost_queue);
+}
+
+bool page_cache_shard::forget_ghost_page(int fd, i64 page_no)
+{
+    struct ghost_page *ghost;
+    double_linked_list_for_each_entry(ghost, &ghost_bucket[page_hash(fd, page_no) & ghost_bucket_mask], adjacent_ghosts_in_hash_table){
+        if(ghost->fd == fd && ghost->page_no == page_no){
+            delete_double_linked_list_entry(&ghost->adjacent_ghosts_in_hash_table);
+            delete_double_linked_list_entry(&ghost->adjacent_ghosts_in_queue);
+            double_linked_list_add_tail(&ghost->adjacent_ghosts_in_queue, &free_ghosts);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct page_meta *page_cache_shard::lookup_page(int fd, i64 page_no)
+{
+    struct page_meta *curr_page;
+
+    //While resizing, a page may still be in its old bucket.
+    if(old_page_bucket){
+        rehash(rehash_step_buckets);
+        int old_bucket_index = page_hash(fd, page_no) & (old_bucket_num - 1);
+        if(old_page_bucket && old_bucket_index >= rehash_index){
+            double_linked_list_for_each_entry(curr_page, &old_page_bucket[old_bucket_index], adjacent_pages_in_hash_table){
+                if(curr_page->fd == fd && curr_page->page_no == page_no)
+                    return curr_page;
+            }
+        }
+    }
+    double_linked_list_for_each_entry(curr_page, get_bucket(fd, page_no), adjacent_pages_in_hash_table){
+        if(curr_page->fd == fd && curr_page->page_no == page_no)
+            return curr_page;
+    }
+    return nullptr;
+}
+
+struct page_meta *page_cache_shard::get_page(int fd, i64 page_no, class paged_file *paged_file, bool *read_pending, bool fresh)
+{
+    //Search hash bucket. If the required page is already cached, pin and return it directly.
+    struct page_meta *curr_page, *new_page;
+    for(;;){
+        //Wait until the page is read in if someone is reading it, and search again since the read may have failed.
+        if((curr_page = lookup_page(fd, page_no)) && curr_page->loading){
+            i64 wait_start = monotonic_ns();
+            while((curr_page = lookup_page(fd, page_no)) && curr_page->loading)
+                pthread_cond_wait(&load_done, &latch);
+            pin_wait_num++;
+            pin_wait_ns += monotonic_ns() - wait_start;
+        }
+        if(curr_page){
+            hit_num++;
+            if(curr_page->prefetched){
+                readahead_hit_num++;
+                curr_page->prefetched = 0;
+            }
+            curr_page->referenced = 1;
+            if(!curr_page->pinned){
+                delete_double_linked_list_entry(&curr_page->adjacent_pages_in_free_list);
+                init_double_linked_list_head(&curr_page->adjacent_pages_in_free_list);
+            }
+            curr_page->pinned++;
+            return curr_page;
+        }
 
-    page_bucket = new struct double_linked_list_head [bucket_size];
-    if(page_bucket == nullptr)
-        exit(-1);
-    memset(page_bucket, 0, sizeof(struct double_linked_list_head) * bucket_size);
-    for(int i = 0; i < bucket_size; ++i){
-        init_double_linked_list_head(&page_bucket[i]);
+        //Choose a page to be recycled.
+        new_page = select_victim_page();
+        //No free pages in the free pages list because all pages are pinned. Counted in the stats, not printed, as
+        //the latch is held.
+        if(new_page == nullptr){
+            depleted_num++;
+            return nullptr;
+        }
+        //The flusher caught up with eviction. Wait for its write, then search again as the latch was released.
+        if(!new_page->flushing)
+            break;
+        i64 wait_start = monotonic_ns();
+        pthread_cond_wait(&flush_done, &latch);
+        pin_wait_num++;
+        pin_wait_ns += monotonic_ns() - wait_start;
     }
-
-    all_pages = new struct page_meta [total_pages];
-    if(all_pages == nullptr){
-        delete [] page_bucket;
-        exit(-1);
+    miss_num++;
+    i64 miss_start = monotonic_ns();
+    //The victim could not be written back. It is left cached and dirty.
+    if(install_page(new_page, fd, page_no, paged_file) != DB_SUCCESS)
+        return nullptr;
+    //Nothing to read past the end of file. A page kept by the second tier does not need a read either.
+    if(fresh || (second_tier && second_tier->take(fd, page_no, new_page->page))){
+        count_miss_latency(monotonic_ns() - miss_start);
+        return new_page;
     }
-    memset(all_pages, 0, sizeof(struct page_meta) * total_pages);
 
-    init_double_linked_list_head(&free_pages);
-    for(int i = 0; i < total_pages; ++i){
-        double_linked_list_add_head(&all_pages[i].adjacent_pages_in_free_list, &free_pages);
+    //Let the caller read the page asynchronously.
+    if(read_pending && io->is_async()){
+        new_page->loading = 1;
+        *read_pending = true;
+        return new_page;
     }
-    //The snippet below is more efficient than the previous one, although the previous one seems more succinct. 
-    /*for(int i = 0; i < total_pages - 1; ++i){
-        all_pages[i].adjacent_pages_in_free_list.next = &(all_pages[i + 1].adjacent_pages_in_free_list);
-        all_pages[i + 1].adjacent_pages_in_free_list.prev = &(all_pages[i].adjacent_pages_in_free_list);
+
+    //If file read fails, return the page back to page cache.
+    if(io->read_page(fd, page_no, new_page->page) != DB_SUCCESS){
+        discard_page(new_page);
+        return nullptr;
     }
-    all_pages[0].adjacent_pages_in_free_list.prev = &free_pages;
-    all_pages[total_pages - 1].adjacent_pages_in_free_list.next = &free_pages;
-    free_pages.next = &(all_pages[0].adjacent_pages_in_free_list);
-    free_pages.prev = &(all_pages[total_pages - 1].adjacent_pages_in_free_list);*/
+    paged_file->count_read(1);
+    count_miss_latency(monotonic_ns() - miss_start);
+
+    return new_page;
 }
 
-page_cache::~page_cache()
+void page_cache_shard::count_miss_latency(i64 ns)
 {
-    delete [] all_pages;
-    delete [] page_bucket;
+    //Bucket of the highest bit set.
+    int bucket = (ns > 0) ? 63 - __builtin_clzll(ns) : 0;
+    if(bucket >= MISS_LATENCY_BUCKETS)
+        bucket = MISS_LATENCY_BUCKETS - 1;
+    miss_latency[bucket]++;
 }
 
-struct page_meta *page_cache::get_page(int fd, i64 page_no, class paged_file *paged_file)
+i64 page_cache_shard::evict_page(struct page_meta *new_page)
 {
-    //Search hash bucket. If the required page is already pinned, return it directly.
-    int hash_key = hash(fd, page_no);
-    struct page_meta *curr_page;
-    double_linked_list_for_each_entry(curr_page, &page_bucket[hash_key], adjacent_pages_in_hash_table){
-        if(curr_page->fd == fd && curr_page->page_no == page_no){
-            return curr_page;
+    //If the page is dirty, write it back to the disk. Nothing is changed if the write fails.
+    //An asynchronous backend writes a copy of the page behind, so the miss does not wait for the write.
+    if(new_page->dirty){
+        i64 ret;
+        if(io->is_async()){
+            char *copy = alloc_page_buffers(1);
+            if(copy == nullptr)
+                return DB_ERROR;
+            memcpy(copy, new_page->page, PAGE_SIZE);
+            ret = io->write_page_behind(new_page->fd, new_page->page_no, copy);
         }
+        else{
+            ret = io->write_page(new_page->fd, new_page->page_no, new_page->page);
+        }
+        if(ret != DB_SUCCESS)
+            return DB_ERROR;
+        eviction_write_num++;
+        new_page->dirty = 0;
+        dirty_num--;
+        if(new_page->file)
+            new_page->file->count_write(1);
     }
-
-    //No free pages in the free pages list because all pages are pinned.
-    if(double_linked_list_empty(&free_pages)){
-        cout<<"Page cache depleted. Can not insert page "<<page_no<<'.'<<endl;
-        return nullptr;
-    }
-
-    //Get a free page from the head
-    struct page_meta *new_page = container_of(free_pages.next, struct page_meta, adjacent_pages_in_free_list);
-    //If the page is dirty, write it back to the disk.
-    if(new_page->dirty){
-        lseek(new_page->fd, new_page->page_no * PAGE_SIZE, SEEK_SET);
-        write(new_page->fd, new_page->page, PAGE_SIZE); 
+    //A prefetched page evicted before anyone asked for it.
+    if(new_page->prefetched){
+        readahead_wasted_num++;
+        new_page->prefetched = 0;
     }
-    //Disconnect it from the hash table if necessary.
-    if(new_page->adjacent_pages_in_hash_table.next && new_page->adjacent_pages_in_hash_table.prev){
+    //Disconnect it from the hash table if necessary (never used, discarded and retired pages are not in it).
+    if(new_page->adjacent_pages_in_hash_table.next && 
+        new_page->adjacent_pages_in_hash_table.next != &new_page->adjacent_pages_in_hash_table){
+        eviction_num++;
+        //The page is clean now (it was just written back if it was dirty).
+        if(second_tier)
+            second_tier->put(new_page->fd, new_page->page_no, new_page->page);
+        //2Q: A recycled probation page goes to the ghost queue, a recycled hot page simply leaves the hot queue.
+        if(policy == Two_queue && !new_page->hot)
+            remember_ghost_page(new_page);
         remove_page_from_hash_table(new_page);
     }
     //Disconnect it from cached file page list if necessary.
-    if(new_page->adjacent_pages_in_file.next && new_page->adjacent_pages_in_file.prev){
+    if(new_page->file){
         //cout<<"Delete file page://// old page no."<<new_page->page_no<<" old fd "<<new_page->fd<<endl;
+        pthread_mutex_lock(&new_page->file->pages_in_file_latch);
         delete_double_linked_list_entry(&new_page->adjacent_pages_in_file);
         init_double_linked_list_head(&new_page->adjacent_pages_in_file);
+        pthread_mutex_unlock(&new_page->file->pages_in_file_latch);
+        new_page->file = nullptr;
     }
 
     //Adjust free pages list (REMOVE new page from the HEAD of free pages list) and fill in new page.
     delete_double_linked_list_entry(&new_page->adjacent_pages_in_free_list);
     init_double_linked_list_head(&new_page->adjacent_pages_in_free_list);
+    return DB_SUCCESS;
+}
+
+i64 page_cache_shard::install_page(struct page_meta *new_page, int fd, i64 page_no, class paged_file *paged_file)
+{
+    if(evict_page(new_page) != DB_SUCCESS)
+        return DB_ERROR;
 
     new_page->dirty = 0;
     new_page->pinned = 1;
+    new_page->referenced = 0;
     new_page->fd = fd;
     new_page->page_no = page_no;
+    //2Q: A page requested again soon after its eviction is hot.
+    new_page->hot = (policy == Two_queue && forget_ghost_page(fd, page_no)) ? 1 : 0;
+    if(new_page->hot)
+        hot_page_num++;
     //Pin the page in the HEAD of one hash bucket
-    double_linked_list_add_head(&new_page->adjacent_pages_in_hash_table, &page_bucket[hash_key]);
+    double_linked_list_add_head(&new_page->adjacent_pages_in_hash_table, get_bucket(fd, page_no));
     //Insert the new retrieved page to the HEAD of cached file page list.
-    if(paged_file){
-        //cout<<"Insert file page: new page no."<<new_page->page_no<<" new fd "<<new_page->fd<<endl;
-        double_linked_list_add_head(&new_page->adjacent_pages_in_file, paged_file->get_pages_in_file());
-    }
+    //cout<<"Insert file page: new page no."<<new_page->page_no<<" new fd "<<new_page->fd<<endl;
+    pthread_mutex_lock(&paged_file->pages_in_file_latch);
+    double_linked_list_add_head(&new_page->adjacent_pages_in_file, paged_file->get_pages_in_file());
+    pthread_mutex_unlock(&paged_file->pages_in_file_latch);
+    new_page->file = paged_file;
 
     memset(new_page->page, 0, PAGE_SIZE);
-    lseek(fd, page_no * PAGE_SIZE, SEEK_SET);
-    size_t nbytes = read(fd, new_page->page, PAGE_SIZE);
+    //The page may still be being written behind after an earlier eviction. If that write failed, the next flush or
+    //close of the file reports it.
+    io->wait_write_behind(fd, page_no);
+    return DB_SUCCESS;
+}
 
-    //If file read fails, return the page back to page cache.
-    if(nbytes == -1){
-        new_page->pinned = 0;
-        remove_page_from_hash_table(new_page);
-        insert_page_to_free_list(new_page);
+struct page_meta *page_cache_shard::get_readahead_page(int fd, i64 page_no, class paged_file *paged_file)
+{
+    //Already cached, or being read by someone else. A page in the second tier is cheaper to get on demand.
+    if(lookup_page(fd, page_no) || (second_tier && second_tier->contains(fd, page_no)))
+        return nullptr;
+    //Readahead never waits for a frame.
+    struct page_meta *new_page = select_victim_page();
+    if(new_page == nullptr || new_page->flushing || install_page(new_page, fd, page_no, paged_file) != DB_SUCCESS)
         return nullptr;
+    new_page->loading = 1;
+    new_page->prefetched = 1;
+    readahead_num++;
+    return new_page;
+}
+
+void page_cache_shard::discard_page(struct page_meta *curr_page)
+{
+    if(curr_page->file){
+        pthread_mutex_lock(&curr_page->file->pages_in_file_latch);
+        delete_double_linked_list_entry(&curr_page->adjacent_pages_in_file);
+        init_double_linked_list_head(&curr_page->adjacent_pages_in_file);
+        pthread_mutex_unlock(&curr_page->file->pages_in_file_latch);
+        curr_page->file = nullptr;
     }
+    remove_page_from_hash_table(curr_page);
+    curr_page->prefetched = 0;
+    curr_page->pinned = 1;
+    insert_page_to_free_list(curr_page);
+}
 
-    return new_page;
+void page_cache_shard::complete_async_read(struct io_request *req)
+{
+    class page_future *future = (class page_future *)req->arg;
+    struct page_meta *curr_page = future->handle.page_info;
+    class page_cache_shard *shard = curr_page->shard;
+    i64 ret = (req->result < 0) ? DB_ERROR : DB_SUCCESS;
+
+    pthread_mutex_lock(&shard->latch);
+    curr_page->loading = 0;
+    if(ret == DB_SUCCESS && curr_page->file)
+        curr_page->file->count_read(1);
+    if(ret != DB_SUCCESS){
+        shard->discard_page(curr_page);
+        future->handle.page_info = nullptr;
+        future->handle.page = nullptr;
+    }
+    pthread_cond_broadcast(&shard->load_done);
+    pthread_mutex_unlock(&shard->latch);
+
+    future->finish(ret);
 }
 
-void page_cache::remove_page_from_hash_table(struct page_meta *curr_page)
+void page_cache_shard::wait_for_flush(struct page_meta *curr_page)
+{
+    while(curr_page ? curr_page->flushing : flushing_num)
+        pthread_cond_wait(&flush_done, &latch);
+}
+
+int page_cache_shard::collect_pages_to_flush(struct double_linked_list_head *list, struct page_meta **pages, int page_num,
+                                             int &scanned_num, int clean_page_num, int dirty_low_num)
+{
+    struct page_meta *curr_page;
+    double_linked_list_for_each_entry(curr_page, list, adjacent_pages_in_free_list){
+        //Past the clean window, keep going only while draining above the low watermark.
+        if(page_num == flush_batch || 
+            (scanned_num >= clean_page_num && (!draining || dirty_num - page_num <= dirty_low_num)))
+            break;
+        scanned_num++;
+        if(curr_page->dirty && !curr_page->flushing)
+            pages[page_num++] = curr_page;
+    }
+    return page_num;
+}
+
+static int compare_page_identity(const void *a, const void *b)
+{
+    struct page_meta *page_a = *(struct page_meta **)a;
+    struct page_meta *page_b = *(struct page_meta **)b;
+    if(page_a->fd != page_b->fd)
+        return (page_a->fd > page_b->fd) - (page_a->fd < page_b->fd);
+    return (page_a->page_no > page_b->page_no) - (page_a->page_no < page_b->page_no);
+}
+
+int page_cache_shard::flush_ahead(int clean_page_num, int dirty_low_num, int dirty_high_num, char *bufs)
+{
+    struct page_meta *pages[flush_batch];
+    char *page_bufs[flush_batch];
+    bool written[flush_batch];
+    int page_num = 0, scanned_num = 0, run_start = 0, written_num = 0;
+
+    pthread_mutex_lock(&latch);
+    if(dirty_num > dirty_high_num)
+        draining = true;
+    if(dirty_num <= dirty_low_num)
+        draining = false;
+    //Unpinned pages nearest to eviction come first. 2Q may also evict from the head of the hot queue.
+    page_num = collect_pages_to_flush(&free_pages, pages, page_num, scanned_num, clean_page_num, dirty_low_num);
+    if(policy == Two_queue){
+        scanned_num = 0;
+        page_num = collect_pages_to_flush(&hot_pages, pages, page_num, scanned_num, clean_page_num, dirty_low_num);
+    }
+    //Sort by (fd, page no.) so that adjacent pages are written by a single request.
+    qsort(pages, page_num, sizeof(struct page_meta *), compare_page_identity);
+    //Write copies, so the pages stay usable while the latch is released. A page being flushed is not evicted.
+    for(int i = 0; i < page_num; ++i){
+        page_bufs[i] = bufs + i * PAGE_SIZE;
+        memcpy(page_bufs[i], pages[i]->page, PAGE_SIZE);
+        pages[i]->dirty = 0;
+        pages[i]->flushing = 1;
+    }
+    dirty_num -= page_num;
+    flushing_num += page_num;
+    pthread_mutex_unlock(&latch);
+
+    if(!page_num)
+        return 0;
+
+    for(int i = 0; i < page_num; ++i){
+        if(i + 1 == page_num || pages[i + 1]->fd != pages[i]->fd || pages[i + 1]->page_no != pages[i]->page_no + 1){
+            bool ok = io->write_pages(pages[i]->fd, pages[run_start]->page_no, &page_bufs[run_start],
+                                      i - run_start + 1) == DB_SUCCESS;
+            for(int j = run_start; j <= i; ++j){
+                written[j] = ok;
+            }
+            run_start = i + 1;
+        }
+    }
+
+    //The pages of a failed run are dirty again (unless they were dirtied meanwhile), so a later flush or eviction
+    //writes them.
+    pthread_mutex_lock(&latch);
+    for(int i = 0; i < page_num; ++i){
+        pages[i]->flushing = 0;
+        if(written[i]){
+            written_num++;
+            if(pages[i]->file)
+                pages[i]->file->count_write(1);
+        }
+        else if(!pages[i]->dirty){
+            pages[i]->dirty = 1;
+            dirty_num++;
+        }
+    }
+    flushing_num -= page_num;
+    background_write_num += written_num;
+    pthread_cond_broadcast(&flush_done);
+    pthread_mutex_unlock(&latch);
+
+    return written_num;
+}
+
+void page_cache_shard::remove_page_from_hash_table(struct page_meta *curr_page)
 {
+    //2Q: A page no longer cached (evicted, or dropped with its file) is not hot any more.
+    if(curr_page->hot){
+        curr_page->hot = 0;
+        hot_page_num--;
+    }
     //Delete current node from the list.
     delete_double_linked_list_entry(&curr_page->adjacent_pages_in_hash_table);
     init_double_linked_list_head(&curr_page->adjacent_pages_in_hash_table);
 }
 
-void page_cache::insert_page_to_free_list(struct page_meta *curr_page)
+void page_cache_shard::insert_page_to_free_list(struct page_meta *curr_page)
 {
     if(!curr_page->pinned)
         return;
-    curr_page->pinned = 0;
+    //Still pinned by someone else.
+    if(--curr_page->pinned)
+        return;
+    //2Q: Insert hot page to the TAIL (most recently used end) of hot pages list.
+    if(curr_page->hot){
+        double_linked_list_add_tail(&(curr_page->adjacent_pages_in_free_list), &hot_pages);
+        return;
+    }
     //Insert current page to the TAIL of free pages list.
     double_linked_list_add_tail(&(curr_page->adjacent_pages_in_free_list), &free_pages);
 }
 
+i64 page_cache_shard::release_pages_of_file(class paged_file *paged_file)
+{
+    struct page_meta *curr_page;
+    struct double_linked_list_head *cursor, *next;
+    i64 ret = DB_SUCCESS;
+
+    pthread_mutex_lock(&paged_file->pages_in_file_latch);
+    //Only pages of this shard are released here, so iterate the list directly as its entries may be removed.
+    cursor = paged_file->pages_in_file.next;
+    while(cursor != &paged_file->pages_in_file){
+        next = cursor->next;
+        curr_page = container_of(cursor, struct page_meta, adjacent_pages_in_file);
+        if(curr_page->shard == this){
+            if(curr_page->dirty){
+                //The file is going away, so the page is dropped even if it could not be written.
+                if(io->write_page(curr_page->fd, curr_page->page_no, curr_page->page) == DB_SUCCESS)
+                    paged_file->count_write(1);
+                else
+                    ret = DB_ERROR;
+                curr_page->dirty = 0;
+                dirty_num--;
+            }
+            if(curr_page->prefetched){
+                readahead_wasted_num++;
+                curr_page->prefetched = 0;
+            }
+            //Remove current page from lists in hash buckets.
+            remove_page_from_hash_table(curr_page);
+            //Release all pins and add it to the tail of free pages list.
+            if(curr_page->pinned){
+                curr_page->pinned = 1;
+                insert_page_to_free_list(curr_page);
+            }
+            //Disconnect it from the cached pages list of the file.
+            delete_double_linked_list_entry(cursor);
+            init_double_linked_list_head(cursor);
+            curr_page->file = nullptr;
+        }
+        cursor = next;
+    }
+    pthread_mutex_unlock(&paged_file->pages_in_file_latch);
+    //The descriptor may be reused by another file.
+    if(second_tier)
+        second_tier->invalidate(paged_file->fd, -1);
+    return ret;
+}
+
+void page_cache_shard::discard_pages_of_file(class paged_file *paged_file, i64 page_no)
+{
+    struct page_meta *curr_page;
+    struct double_linked_list_head *cursor, *next;
+
+    pthread_mutex_lock(&paged_file->pages_in_file_latch);
+    cursor = paged_file->pages_in_file.next;
+    while(cursor != &paged_file->pages_in_file){
+        next = cursor->next;
+        curr_page = container_of(cursor, struct page_meta, adjacent_pages_in_file);
+        if(curr_page->shard == this && curr_page->page_no >= page_no){
+            if(curr_page->dirty){
+                curr_page->dirty = 0;
+                dirty_num--;
+            }
+            if(curr_page->prefetched){
+                readahead_wasted_num++;
+                curr_page->prefetched = 0;
+            }
+            //The page stays on the free list, holding nothing.
+            remove_page_from_hash_table(curr_page);
+            delete_double_linked_list_entry(cursor);
+            init_double_linked_list_head(cursor);
+            curr_page->file = nullptr;
+        }
+        cursor = next;
+    }
+    pthread_mutex_unlock(&paged_file->pages_in_file_latch);
+    if(second_tier)
+        second_tier->invalidate_from(paged_file->fd, page_no);
+}
+
 //Open different files simultaneously.
 void page_cache_test()
 {
@@ -348,4 +1882,619 @@ void page_cache_test2()
         file.unpin_page(j);
     }    
     file.close_paged_file();
-}
\ No newline at end of file
+}
+
+//Hit rate of replacement policies on a mixed workload: point lookups on a small hot set (e.g. B+ tree internal nodes)
+//interleaved with a long sequential scan (e.g. a full pass over record pages).
+void page_cache_policy_test()
+{
+    enum page_replacement_policy policies[] = {Fifo, Clock, Two_queue};
+    const char *policy_names[] = {"FIFO", "CLOCK", "2Q"};
+    char filename[] = "d.txt";
+    char *page;
+
+    for(size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p){
+        class page_cache pg_cache(40, policies[p]);
+        class paged_file file;
+        i64 hot_hits = 0, hot_lookups = 0;
+
+        file.open_paged_file(filename, &pg_cache);
+        for(int round = 0; round < 20; ++round){
+            for(i64 scan_page_no = 100; scan_page_no < 400; ++scan_page_no){
+                //Sequential scan step.
+                file.get_page(scan_page_no, page);
+                file.unpin_page(scan_page_no);
+
+                //Point lookup on the hot set.
+                i64 hot_page_no = (scan_page_no * 7) % 24;
+                i64 hit_num = pg_cache.get_hit_num();
+                file.get_page(hot_page_no, page);
+                file.unpin_page(hot_page_no);
+                hot_hits += pg_cache.get_hit_num() - hit_num;
+                hot_lookups++;
+            }
+        }
+        cout<<policy_names[p]<<": hits "<<pg_cache.get_hit_num()<<" misses "<<pg_cache.get_miss_num()
+            <<" hot set hit rate "<<(double)hot_hits / hot_lookups<<endl;
+        file.close_paged_file();
+    }
+}
+
+//2Q: Hot pages of a closed file leave the hot count, so it never exceeds the cached pages over many open and close
+//rounds.
+void page_cache_hot_close_test()
+{
+    class page_cache pg_cache(40, Two_queue);
+    class paged_file file;
+    struct page_cache_stats stats;
+    char filename[] = "d.txt";
+    char *page;
+    i64 max_hot_num = 0;
+    int bad_rounds = 0;
+
+    for(int round = 0; round < 30; ++round){
+        file.open_paged_file(filename, &pg_cache);
+        //Pages evicted from probation and asked for again become hot.
+        for(int pass = 0; pass < 3; ++pass){
+            for(i64 page_no = 0; page_no < 60; ++page_no){
+                file.get_page(page_no, page);
+                file.unpin_page(page_no);
+            }
+        }
+        pg_cache.get_stats(&stats);
+        if(stats.hot_num > max_hot_num)
+            max_hot_num = stats.hot_num;
+        if(stats.hot_num > stats.total_pages)
+            bad_rounds++;
+        file.close_paged_file();
+        //Nothing of the file is cached any more.
+        pg_cache.get_stats(&stats);
+        if(stats.hot_num != 0)
+            bad_rounds++;
+    }
+    cout<<"2Q open and close: at most "<<max_hot_num<<" hot pages of "<<stats.total_pages<<", "<<bad_rounds
+        <<" bad rounds."<<endl;
+}
+
+//System calls issued by the page cache with seek I/O (before) and positional, coalesced I/O (after).
+void page_cache_io_test()
+{
+    class seek_io_backend seek_io;
+    class positional_io_backend positional_io;
+    class io_backend *backends[] = {&seek_io, &positional_io};
+    const char *backend_names[] = {"seek I/O", "positional I/O"};
+    char filename[] = "e.txt";
+    char *page;
+
+    for(size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b){
+        class page_cache pg_cache(256, Fifo, 4);
+        class paged_file file;
+        struct io_stats stats;
+
+        pg_cache.set_io_backend(backends[b]);
+        unlink(filename);
+        file.open_paged_file(filename, &pg_cache);
+        //Read and dirty 200 pages, then write them back on close.
+        for(i64 page_no = 0; page_no < 200; ++page_no){
+            file.get_page(page_no, page);
+            page[page_no % PAGE_SIZE] = 'a' + page_no % 26;
+            file.mark_page_dirty(page_no);
+            file.unpin_page(page_no);
+        }
+        file.close_paged_file();
+
+        backends[b]->get_stats(&stats);
+        cout<<backend_names[b]<<": "<<stats.syscall_num<<" system calls, "<<stats.read_bytes<<" bytes read, "
+            <<stats.write_bytes<<" bytes written"<<endl;
+    }
+}
+
+static void count_completed_page(class page_future *, void *arg)
+{
+    __sync_fetch_and_add((int *)arg, 1);
+}
+
+//Read pages asynchronously and evict dirty pages through writes behind.
+void page_cache_async_test()
+{
+    class thread_pool_io_engine thread_pool(4);
+    class async_io_engine *engines[] = {create_async_io_engine(64), &thread_pool};
+    const char *engine_names[] = {"default engine", "thread pool engine"};
+    char filename[] = "e.txt";
+    const int page_num = 256;
+    char *page;
+
+    for(size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); ++e){
+        class page_cache pg_cache(32, Fifo, 4);
+        class paged_file file;
+        int completed = 0, bad_pages = 0;
+
+        pg_cache.set_io_backend(engines[e]);
+        unlink(filename);
+        file.open_paged_file(filename, &pg_cache);
+        //Dirty more pages than the cache holds, so dirty victims are written behind.
+        for(i64 page_no = 0; page_no < page_num; ++page_no){
+            file.get_page(page_no, page);
+            memset(page, 'a' + page_no % 26, PAGE_SIZE);
+            file.mark_page_dirty(page_no);
+            file.unpin_page(page_no);
+        }
+        file.close_paged_file();
+
+        //Read pages back with a few requests in flight at a time.
+        file.open_paged_file(filename, &pg_cache);
+        const int batch = 16;
+        for(i64 page_no = 0; page_no < page_num; page_no += batch){
+            class page_future *futures[batch];
+            for(int i = 0; i < batch; ++i){
+                futures[i] = new class page_future(count_completed_page, &completed);
+                file.get_page_async(page_no + i, futures[i]);
+            }
+            for(int i = 0; i < batch; ++i){
+                if(futures[i]->wait() != DB_SUCCESS || futures[i]->handle.get_page()[PAGE_SIZE - 1] != 'a' + (page_no + i) % 26)
+                    bad_pages++;
+                delete futures[i];
+            }
+        }
+        file.close_paged_file();
+
+        cout<<engine_names[e]<<": "<<completed<<" pages completed, "<<bad_pages<<" bad pages."<<endl;
+    }
+    delete engines[0];
+}
+
+struct page_cache_mix_thread_arg {
+    class paged_file *file;
+    i64 page_num;
+    int round_num;
+    int bad_pages;
+};
+
+//Synchronous misses, each holding the shard latch while its page is read.
+static void *read_pages_sync(void *arg)
+{
+    struct page_cache_mix_thread_arg *mix_arg = (struct page_cache_mix_thread_arg *)arg;
+    char *page;
+
+    for(int round = 0; round < mix_arg->round_num; ++round){
+        for(i64 page_no = mix_arg->page_num - 1; page_no >= 0; page_no -= 3){
+            if(mix_arg->file->get_page(page_no, page) != DB_SUCCESS){
+                mix_arg->bad_pages++;
+                continue;
+            }
+            if(page[PAGE_SIZE - 1] != 'a' + page_no % 26)
+                mix_arg->bad_pages++;
+            mix_arg->file->unpin_page(page_no);
+        }
+    }
+    return nullptr;
+}
+
+//Asynchronous misses completing on the same shard meanwhile.
+static void *read_pages_async(void *arg)
+{
+    struct page_cache_mix_thread_arg *mix_arg = (struct page_cache_mix_thread_arg *)arg;
+    const int batch = 4;
+    class page_future futures[batch];
+
+    for(int round = 0; round < mix_arg->round_num; ++round){
+        for(i64 page_no = 0; page_no + batch <= mix_arg->page_num; page_no += batch){
+            for(int i = 0; i < batch; ++i){
+                mix_arg->file->get_page_async(page_no + i, &futures[i]);
+            }
+            for(int i = 0; i < batch; ++i){
+                if(futures[i].wait() != DB_SUCCESS || futures[i].handle.get_page()[PAGE_SIZE - 1] != 'a' + (page_no + i) % 26)
+                    mix_arg->bad_pages++;
+                futures[i].handle.release();
+            }
+        }
+    }
+    return nullptr;
+}
+
+//Synchronous and asynchronous misses on a single shard with the default engine. Completions must not wait for the
+//shard latch on the thread reaping the synchronous reads.
+void page_cache_async_mix_test()
+{
+    class async_io_engine *engine = create_async_io_engine(64);
+    class page_cache pg_cache(16, Fifo, 1);
+    class paged_file file;
+    char filename[] = "e.txt";
+    const i64 page_num = 128;
+    char *page;
+
+    pg_cache.set_io_backend(engine);
+    unlink(filename);
+    file.open_paged_file(filename, &pg_cache);
+    for(i64 page_no = 0; page_no < page_num; ++page_no){
+        file.get_page(page_no, page);
+        memset(page, 'a' + page_no % 26, PAGE_SIZE);
+        file.mark_page_dirty(page_no);
+        file.unpin_page(page_no);
+    }
+    file.flush_paged_file();
+
+    struct page_cache_mix_thread_arg args[2];
+    pthread_t threads[2];
+    for(int i = 0; i < 2; ++i){
+        args[i].file = &file;
+        args[i].page_num = page_num;
+        args[i].round_num = 50;
+        args[i].bad_pages = 0;
+    }
+    pthread_create(&threads[0], nullptr, read_pages_sync, &args[0]);
+    pthread_create(&threads[1], nullptr, read_pages_async, &args[1]);
+    for(int i = 0; i < 2; ++i){
+        pthread_join(threads[i], nullptr);
+    }
+    file.close_paged_file();
+
+    struct page_cache_stats stats;
+    pg_cache.get_stats(&stats);
+    cout<<"Mixed misses: "<<stats.miss_num<<" misses, "<<args[0].bad_pages + args[1].bad_pages<<" bad pages."<<endl;
+    pg_cache.set_io_backend(nullptr);
+    delete engine;
+}
+
+//Dirty victims written on misses without and with the background flusher.
+void page_cache_flusher_test()
+{
+    char filename[] = "f.txt";
+    const int page_num = 2048;
+    char *page;
+
+    for(int with_flusher = 0; with_flusher < 2; ++with_flusher){
+        class page_cache pg_cache(256, Fifo, 4);
+        class paged_file file;
+        int bad_pages = 0;
+
+        if(with_flusher)
+            pg_cache.start_flusher(0.25, 0.25, 0.5, 1);
+        unlink(filename);
+        file.open_paged_file(filename, &pg_cache);
+        for(i64 page_no = 0; page_no < page_num; ++page_no){
+            file.get_page(page_no, page);
+            memset(page, 'a' + page_no % 26, PAGE_SIZE);
+            file.mark_page_dirty(page_no);
+            file.unpin_page(page_no);
+            //Give the flusher a chance, as a foreground thread doing real work would.
+            if(page_no % 16 == 15)
+                usleep(200);
+        }
+        file.close_paged_file();
+
+        file.open_paged_file(filename, &pg_cache);
+        for(i64 page_no = 0; page_no < page_num; ++page_no){
+            file.get_page(page_no, page);
+            if(page[0] != 'a' + page_no % 26 || page[PAGE_SIZE - 1] != 'a' + page_no % 26)
+                bad_pages++;
+            file.unpin_page(page_no);
+        }
+        file.close_paged_file();
+
+        cout<<(with_flusher ? "With flusher: " : "Without flusher: ")<<pg_cache.get_eviction_write_num()
+            <<" dirty victims written on misses, "<<pg_cache.get_background_write_num()<<" pages written in background, "
+            <<bad_pages<<" bad pages."<<endl;
+    }
+}
+
+//Read system calls of a sequential scan and of random lookups with readahead.
+void page_cache_readahead_test()
+{
+    char filename[] = "g.txt";
+    const int page_num = 1024;
+    char *page;
+
+    {
+        class page_cache pg_cache(64);
+        class paged_file file;
+        unlink(filename);
+        file.open_paged_file(filename, &pg_cache);
+        for(i64 page_no = 0; page_no < page_num; ++page_no){
+            file.get_page(page_no, page);
+            memset(page, 'a' + page_no % 26, PAGE_SIZE);
+            file.mark_page_dirty(page_no);
+            file.unpin_page(page_no);
+        }
+        file.close_paged_file();
+    }
+
+    for(int random = 0; random < 2; ++random){
+        class page_cache pg_cache(256, Fifo, 4);
+        class positional_io_backend io;
+        class paged_file file;
+        struct io_stats stats;
+        i64 readahead_num, hit_num, wasted_num;
+        int bad_pages = 0;
+
+        pg_cache.set_io_backend(&io);
+        file.open_paged_file(filename, &pg_cache);
+        for(i64 i = 0; i < page_num; ++i){
+            i64 page_no = random ? (i * 337) % page_num : i;
+            file.get_page(page_no, page);
+            if(page[0] != 'a' + page_no % 26 || page[PAGE_SIZE - 1] != 'a' + page_no % 26)
+                bad_pages++;
+            file.unpin_page(page_no);
+        }
+        file.close_paged_file();
+
+        io.get_stats(&stats);
+        pg_cache.get_readahead_stats(&readahead_num, &hit_num, &wasted_num);
+        cout<<(random ? "Random: " : "Sequential: ")<<stats.syscall_num<<" read calls, "<<readahead_num
+            <<" pages read ahead, "<<hit_num<<" useful, "<<wasted_num<<" wasted, "<<bad_pages<<" bad pages."<<endl;
+    }
+}
+
+//Write and read back pages of a file opened with O_DIRECT through a huge page frame pool.
+void page_cache_direct_test()
+{
+    char filename[] = "h.txt";
+    const int page_num = 512;
+    class page_cache pg_cache(256, Clock, 4, true);
+    class paged_file file;
+    int bad_pages = 0;
+    char *page;
+
+    unlink(filename);
+    file.open_paged_file(filename, &pg_cache, Direct);
+    cout<<(file.get_mode() == Direct ? "Direct I/O" : "Buffered I/O (no direct I/O support)")<<", "
+        <<(pg_cache.uses_hugetlb() ? "hugetlbfs" : "transparent huge page")<<" frame pool."<<endl;
+    for(i64 page_no = 0; page_no < page_num; ++page_no){
+        file.get_page(page_no, page);
+        memset(page, 'a' + page_no % 26, PAGE_SIZE);
+        file.mark_page_dirty(page_no);
+        file.unpin_page(page_no);
+    }
+    file.close_paged_file();
+
+    file.open_paged_file(filename, &pg_cache, Direct);
+    for(i64 page_no = 0; page_no < page_num; ++page_no){
+        file.get_page(page_no, page);
+        if(page[0] != 'a' + page_no % 26 || page[PAGE_SIZE - 1] != 'a' + page_no % 26)
+            bad_pages++;
+        file.unpin_page(page_no);
+    }
+    file.close_paged_file();
+    cout<<bad_pages<<" bad pages."<<endl;
+}
+
+//Latency of hash table lookups of cached pages in a large page cache.
+void page_cache_lookup_test()
+{
+    char filename[] = "i.txt";
+    const int page_num = 65536;
+    const i64 lookup_num = 1 << 22;
+    class page_cache pg_cache(page_num);
+    class paged_file file;
+    struct timespec start, end;
+    i64 found = 0;
+    char *page;
+
+    unlink(filename);
+    file.open_paged_file(filename, &pg_cache);
+    for(i64 page_no = 0; page_no < page_num; ++page_no){
+        file.get_page(page_no, page);
+        file.unpin_page(page_no);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i64 i = 0; i < lookup_num; ++i){
+        if(pg_cache.lookup_page(file.get_fd(), (i * 40503) % page_num))
+            found++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    file.close_paged_file();
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    cout<<"Page meta size "<<sizeof(struct page_meta)<<" bytes, "<<seconds * 1e9 / lookup_num<<" ns per lookup, "
+        <<found<<" found."<<endl;
+}
+
+//Grow and shrink a page cache while pages of a file are cached, pinned and dirty.
+void page_cache_resize_test()
+{
+    char filename[] = "j.txt";
+    const int page_num = 1024;
+    int sizes[] = {64, 512, 2048, 16, 256};
+    class page_cache pg_cache(64, Two_queue, 4);
+    class paged_file file;
+    class page_handle pinned_page;
+    int bad_pages = 0;
+    char *page;
+
+    unlink(filename);
+    file.open_paged_file(filename, &pg_cache);
+    //Keep one page pinned all along.
+    file.get_page(page_num, pinned_page);
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s){
+        i64 ret = pg_cache.resize(sizes[s]);
+        i64 miss_num = pg_cache.get_miss_num();
+        //Dirty every page, then read all of them back.
+        for(int round = 0; round < 2; ++round){
+            for(i64 page_no = 0; page_no < page_num; ++page_no){
+                file.get_page(page_no, page);
+                if(round == 0){
+                    memset(page, 'a' + (page_no + (i64)s) % 26, PAGE_SIZE);
+                    file.mark_page_dirty(page_no);
+                }
+                else if(page[0] != 'a' + (page_no + (i64)s) % 26 || page[PAGE_SIZE - 1] != 'a' + (page_no + (i64)s) % 26){
+                    bad_pages++;
+                }
+                file.unpin_page(page_no);
+            }
+        }
+        cout<<"Resize to "<<sizes[s]<<(ret == DB_SUCCESS ? "" : " (partly)")<<": "<<pg_cache.get_total_pages()
+            <<" pages, "<<pg_cache.get_miss_num() - miss_num<<" misses."<<endl;
+    }
+    pinned_page.release();
+    file.close_paged_file();
+    cout<<bad_pages<<" bad pages."<<endl;
+}
+
+//System calls and time spent appending new pages to a file by get_page and by allocate_page.
+void page_cache_allocate_test()
+{
+    char filename[] = "k.txt";
+    const int page_num = 4096;
+
+    for(int allocate = 0; allocate < 2; ++allocate){
+        class page_cache pg_cache(256, Fifo, 4);
+        class positional_io_backend io;
+        class paged_file file;
+        class page_handle handle;
+        struct io_stats stats;
+        struct timespec start, end;
+        int bad_pages = 0;
+
+        pg_cache.set_io_backend(&io);
+        unlink(filename);
+        file.open_paged_file(filename, &pg_cache);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(i64 page_no = 0; page_no < page_num; ++page_no){
+            if(allocate)
+                file.allocate_page(page_no, handle);
+            else
+                file.get_page(page_no, handle);
+            if(handle.get_page()[0] != 0 || handle.get_page()[PAGE_SIZE - 1] != 0)
+                bad_pages++;
+            memset(handle.get_page(), 'a' + page_no % 26, PAGE_SIZE);
+            handle.mark_dirty();
+        }
+        handle.release();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        io.get_stats(&stats);
+        file.close_paged_file();
+
+        file.open_paged_file(filename, &pg_cache);
+        for(i64 page_no = 0; page_no < page_num; ++page_no){
+            file.get_page(page_no, handle);
+            if(handle.get_page()[0] != 'a' + page_no % 26 || handle.get_page()[PAGE_SIZE - 1] != 'a' + page_no % 26)
+                bad_pages++;
+        }
+        handle.release();
+        file.close_paged_file();
+
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        cout<<(allocate ? "allocate_page: " : "get_page: ")<<stats.syscall_num<<" system calls, "<<seconds * 1e6 / page_num
+            <<" us per new page, "<<bad_pages<<" bad pages."<<endl;
+    }
+}
+
+//Counters of a mixed workload, and a periodic dump of them.
+void page_cache_stats_test()
+{
+    char filename[] = "l.txt";
+    char stats_filename[] = "l_stats.txt";
+    const int page_num = 1024;
+    class page_cache pg_cache(256, Clock, 4);
+    class paged_file file;
+    class page_handle handle;
+    struct page_cache_stats stats;
+
+    unlink(filename);
+    unlink(stats_filename);
+    pg_cache.start_stats_dump(stats_filename, 10);
+    file.open_paged_file(filename, &pg_cache);
+    for(i64 page_no = 0; page_no < page_num; ++page_no){
+        file.allocate_page(page_no, handle);
+        memset(handle.get_page(), 'a' + page_no % 26, PAGE_SIZE);
+    }
+    for(int round = 0; round < 4; ++round){
+        for(i64 page_no = 0; page_no < page_num; ++page_no){
+            file.get_page(round % 2 ? (page_no * 337) % page_num : page_no, handle);
+        }
+    }
+    handle.release();
+    usleep(30000);
+    pg_cache.get_stats(&stats);
+    pg_cache.stop_stats_dump();
+
+    cout<<"hits "<<stats.hit_num<<" misses "<<stats.miss_num<<" evictions "<<stats.eviction_num<<" dirty writes "
+        <<stats.eviction_write_num<<" readahead "<<stats.readahead_num<<" pin waits "<<stats.pin_wait_num
+        <<" miss p50 "<<get_miss_latency_percentile(&stats, 0.5)<<" ns p99 "<<get_miss_latency_percentile(&stats, 0.99)
+        <<" ns, file read "<<file.get_read_bytes()<<" written "<<file.get_write_bytes()<<" bytes."<<endl;
+    file.close_paged_file();
+
+    //Show the last dump.
+    char buf[4096];
+    int fd = open(stats_filename, O_RDONLY);
+    off_t size = lseek(fd, 0, SEEK_END);
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, size > (off_t)sizeof(buf) - 1 ? size - (sizeof(buf) - 1) : 0);
+    close(fd);
+    buf[len > 0 ? len : 0] = '\0';
+    char *last_dump = strstr(buf, "page_cache ");
+    while(last_dump && strstr(last_dump + 1, "page_cache "))
+        last_dump = strstr(last_dump + 1, "page_cache ");
+    cout<<(last_dump ? last_dump : buf);
+}
+
+//Reads from disk with and without a compressed second tier, on a working set larger than the page cache.
+void page_cache_compressed_test()
+{
+    char filename[] = "m.txt";
+    const int page_num = 1024;
+    char *page;
+
+    //Pages of records: compressible, and different from one page to the next.
+    {
+        class page_cache pg_cache(64);
+        class paged_file file;
+        class page_handle handle;
+        unlink(filename);
+        file.open_paged_file(filename, &pg_cache);
+        for(i64 page_no = 0; page_no < page_num; ++page_no){
+            file.allocate_page(page_no, handle);
+            for(int i = 0; i + 64 <= PAGE_SIZE; i += 64){
+                snprintf(handle.get_page() + i, 64, "record %lld:%d name fruit%lld price %lld",
+                         page_no, i, (page_no * 7 + i) % 97, page_no * i % 1000);
+            }
+        }
+        handle.release();
+        file.close_paged_file();
+    }
+
+    for(int with_tier = 0; with_tier < 2; ++with_tier){
+        class page_cache pg_cache(page_num / 2, Clock, 4);
+        class positional_io_backend io;
+        class paged_file file;
+        struct page_cache_stats stats;
+        struct io_stats before;
+        int bad_pages = 0;
+        char expected[64];
+
+        pg_cache.set_io_backend(&io);
+        if(with_tier)
+            pg_cache.set_compressed_cache_budget(page_num * PAGE_SIZE / 2);
+        file.open_paged_file(filename, &pg_cache);
+        //First pass warms the tiers. Random passes read pages again.
+        for(i64 page_no = 0; page_no < page_num; ++page_no){
+            file.get_page(page_no, page);
+            file.unpin_page(page_no);
+        }
+        io.get_stats(&before);
+        for(int round = 0; round < 4; ++round){
+            for(i64 i = 0; i < page_num; ++i){
+                i64 page_no = (i * 337 + round * 101) % page_num;
+                file.get_page(page_no, page);
+                snprintf(expected, 64, "record %lld:%d name fruit%lld price %lld", page_no, 64, (page_no * 7 + 64) % 97,
+                         page_no * 64 % 1000);
+                if(strcmp(page + 64, expected))
+                    bad_pages++;
+                file.unpin_page(page_no);
+            }
+        }
+        pg_cache.get_stats(&stats);
+        file.close_paged_file();
+
+        struct compressed_cache_stats *tier = &stats.second_tier;
+        cout<<(with_tier ? "With compressed tier: " : "Without compressed tier: ")<<stats.io.read_bytes - before.read_bytes
+            <<" bytes read from disk";
+        if(with_tier)
+            cout<<", tier hit rate "<<(tier->lookup_num ? 100.0 * tier->hit_num / tier->lookup_num : 0)
+                <<"%, "<<(tier->hit_num ? tier->decompress_ns / tier->hit_num : 0)<<" ns per decompression, "
+                <<(tier->store_num ? tier->compress_ns / tier->store_num : 0)<<" ns per compression, ratio "
+                <<(tier->compressed_bytes ? (double)tier->stored_bytes / tier->compressed_bytes : 0)<<", "
+                <<tier->reject_num<<" rejected";
+        cout<<", "<<bad_pages<<" bad pages."<<endl;
+    }
+}
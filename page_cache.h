@@ -2,6 +2,11 @@
 #define __PAGE_CACHE_H__
 
 #include "db.h"
+#include "io_backend.h"
+#include "async_io.h"
+#include "compressed_cache.h"
+
+#include <pthread.h>
 
 /*
     Page cache design:
@@ -9,63 +14,524 @@
         Pinned pages: -> hash table -> double linked list
         Free pages list: -> double linked list
 
+    Hashing:
+        (File descriptor, page no.) is mixed into a 64-bit hash. Its high bits choose the shard, its low bits the
+        bucket in the shard's hash table.
+
+    Shards:
+        Pages are partitioned into N shards by (File descriptor, page no.). Each shard owns a part of all pages, its
+        own hash table, free pages list and replacement policy state, and a latch protecting all of them.
+        Pinning, unpinning and marking dirty only take the latch of the page's shard, so threads working on
+        different shards never contend. A page cache with one shard behaves like an unsharded one.
+        The shard latch is held while a missing page is read in, so no one can see a half-read page.
+        Latch order: shard latch -> paged file latch (protecting the cached pages list of a file).
+        Flushing or closing a file takes all shard latches in shard order.
+
+    Resizing:
+        The page cache can be grown or shrunk online, one shard at a time.
+        Growing reuses retired pages first, then adds a chunk of page metas with their own frames.
+        Shrinking retires unpinned pages in eviction order (writing them back if dirty) and gives their frames back to
+        the kernel. Pinned pages are never waited for, so a shrink may fall short.
+        A shard's hash table has a power of 2 number of buckets, about one per page. When the number of pages
+        outgrows it (or drops well below it), a new table is allocated and the old buckets are moved into it a few at
+        a time on each lookup, so no operation pays for the whole rehash. Until then both tables are searched.
+        The 2Q ghost queue keeps the size it had when the page cache was constructed.
+
+    Page frames:
+        Page contents live in a frame pool apart from the page metas. Page metas are packed in a cache line aligned
+        array, and the fields needed to walk a hash chain share one cache line, so lookups do not touch the frames
+        and touch one cache line per page visited. The frame pool is mapped anonymously, so every frame is aligned
+        to PAGE_SIZE as O_DIRECT requires. Optionally it is backed by 2 MiB huge pages (hugetlbfs pages if any are
+        reserved, transparent huge pages otherwise) to save TLB misses on large caches.
+
+    I/O:
+        All page I/O goes through the page cache's I/O backend (positional I/O by default). When a file is flushed or
+        closed, its dirty pages are sorted by page no. and each run of adjacent pages is written by one request.
+        Background flusher (optional): a thread that writes dirty unpinned pages ahead of the eviction point, so
+        misses rarely have to write a victim. Each round it keeps the first 'clean fraction' pages of every shard's
+        free pages list (and 2Q hot queue) clean. When the dirty pages of a shard exceed the high watermark, it also
+        writes the oldest dirty pages until the shard drops to the low watermark.
+        Copies of the pages are written with the shard latch released. A page being flushed is not evicted, and
+        flushing or closing a file first waits for background writes of the shard.
+        Readahead: each paged file watches the page numbers it is asked for. After a few strictly increasing requests
+        it prefetches a window of following pages, read by a single request per run of pages not yet cached. The
+        next window is issued when the reader gets into the second half of the current one, and the window doubles
+        up to a maximum. Any other access resets it. Prefetched pages are unpinned, and counted as hits when asked
+        for, or as wasted when evicted (or released) first.
+        With an asynchronous backend:
+            A dirty victim is copied and written behind, so a miss costs a single read on the critical path.
+            Pages can be requested asynchronously (page future). A page being read in is already in the hash table
+            with its loading flag set; whoever else asks for it waits until the read completes.
+
+    Statistics:
+        Each shard counts, under its latch, hits, misses, evictions, dirty victims written, background writes,
+        readahead, pin waits (a pin request blocked on a page being read in or flushed) and requests failed because
+        every page was pinned. Synchronous misses are timed and counted in a latency histogram of power of 2 buckets.
+        Each paged file counts the bytes read and written for it (atomically, as I/O is done without latches).
+        'get_stats' sums the shards into a snapshot. Optionally a thread appends a snapshot, with the counters of
+        every open file, to a file periodically.
+
+    Compressed second tier (optional, compressed_cache.h):
+        Each shard may keep the pages it evicts in a compressed cache within a part of a memory budget. A miss looks
+        there before reading from disk. Readahead skips pages found there.
+
+    Replacement policy (chosen when the page cache is constructed):
+        Fifo:       Victims are taken from the head of free pages list, unpinned pages are appended to its tail.
+        Clock:      Free pages list is the clock. Its head is the clock hand: a referenced page gets a second chance
+                    (reference bit cleared and moved to the tail), the first unreferenced page is the victim.
+        Two_queue:  Simplified 2Q. Free pages list is the probation queue (A1in), pages re-referenced after a recent
+                    eviction live in the hot queue (Am, LRU order). Evicted probation pages are remembered in a
+                    ghost queue (A1out, page identity only). A single scan therefore only churns the probation queue.
+
     Page meta:
         Tuple (File descriptor, page no.) identifies an unique page.
         Dirty flag: if set, this page needs to be flush to disk when it is reused.
-        Pinned flag: if set, this page is pinned, or else, it is free to be recycled. Used to prevent repeatedly releasing the same page.
+        Pin count: number of outstanding pins. A page is free to be recycled only when it drops to 0. Releasing an
+                   unpinned page is a no-op.
+        Referenced flag: CLOCK reference bit.
+        Hot flag: if set, this page lives in the hot queue of 2Q.
+        Loading flag: if set, an asynchronous read of this page is in flight.
+        Flushing flag: if set, the background flusher is writing this page.
+        Prefetched flag: if set, this page was read ahead and no one has asked for it yet.
+        Shard the page belongs to, and the paged file whose cached pages list contains it.
         Adjacent pages in hash table.
         Adjacent pages in free pages list.
         Adjacent pages in the same file.
-        The page contents.
+        The page contents (a frame in the frame pool).
 
     File session handle:
         File descriptor.
         Pointer to page cache.
         Cached pages of this file. (A list)
+        Logical size: number of pages that may hold data, on disk or in the page cache. It starts from the file size
+        and grows with every page handed out. A page allocated at or past it is known to be zero, so it is not read.
+        Preallocated size: the file is extended on disk ahead of the logical size in growing extents by fallocate
+        (the file size is kept), so appending pages does not allocate file system blocks one page at a time.
+        Mode (chosen when the file is opened):
+            Buffered:   Pages are read into the page cache.
+            Direct:     Like buffered, but the file is opened with O_DIRECT, so pages are cached once (in the page
+                        cache) instead of twice, and the page cache owns the memory budget. Falls back to buffered if
+                        the file system does not support it.
+            Mapped:     The file is mapped with mmap and get_page hands out pointers into the mapping, so pages are not
+                        copied and the page cache is bypassed. Meant for read-mostly files. A large range of address
+                        space is reserved when the file is opened, and the file is mapped into it from its start.
+                        When a page past the mapping is requested, the mapping is extended in place (the file is
+                        extended first if needed), so pages handed out never move. Pinning and marking dirty are
+                        no-ops: the kernel writes modified pages back.
+
+    Page handle:
+        Returned by paged_file::get_page. It carries the pinned page meta, so marking the page dirty and unpinning it
+        do not search the hash table again. A handle of a mapped file only carries the page address. The page is
+        unpinned when the handle is released or goes out of scope. Handles must be released before the file is
+        closed.
 */
 
+#define CACHE_LINE_SIZE 64
+#define MISS_LATENCY_BUCKETS 32     //Bucket i counts misses taking [2^i, 2^(i+1)) ns. The last one has no upper bound.
+
+//The first cache line holds what a hash chain walk and a pin touch, the second one the rest.
 struct page_meta {
-    int fd;
     i64 page_no;
-    int dirty;
-    int pinned;
+    int fd;
+    int pinned;                                                  //Pin count
     struct double_linked_list_head adjacent_pages_in_hash_table; //Adjacent pages in hash bucket
+    char *page;                                                  //Page frame
+    unsigned char dirty;
+    unsigned char referenced;
+    unsigned char hot;
+    unsigned char loading;
+    unsigned char flushing;
+    unsigned char prefetched;
     struct double_linked_list_head adjacent_pages_in_free_list;  //Adjacent pages in free page list
+
+    class page_cache_shard *shard;
+    class paged_file *file;
     struct double_linked_list_head adjacent_pages_in_file;       //Adjacent pages in the same file
-    char page[PAGE_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+enum page_replacement_policy {Fifo = 1, Clock, Two_queue};
+enum paged_file_mode {Buffered = 1, Direct, Mapped};
+
+//Snapshot of page cache counters.
+struct page_cache_stats {
+    i64 total_pages;
+    i64 dirty_num;
+    i64 hot_num;                                //2Q: Cached hot pages.
+    i64 hit_num, miss_num;
+    i64 eviction_num;                           //Cached pages evicted (recycled or retired).
+    i64 eviction_write_num;                     //Dirty victims written on a miss.
+    i64 background_write_num;
+    i64 readahead_num, readahead_hit_num, readahead_wasted_num;
+    i64 pin_wait_num;                           //Pin requests which waited for a read or a background flush.
+    i64 pin_wait_ns;                            //Total time spent in those waits.
+    i64 depleted_num;                           //Pin requests failed because all pages were pinned.
+    i64 miss_latency[MISS_LATENCY_BUCKETS];     //Synchronous misses by latency.
+    struct compressed_cache_stats second_tier;  //Counters of the compressed second tier.
+    struct io_stats io;                         //Counters of the I/O backend.
 };
 
-class page_cache{
+//Latency (ns, upper bound of its bucket) under which 'fraction' of the misses of a snapshot fall.
+extern i64 get_miss_latency_percentile(struct page_cache_stats *stats, double fraction);
+
+//Identity of a recently evicted page (2Q ghost queue entry).
+struct ghost_page {
+    int fd;
+    i64 page_no;
+    struct double_linked_list_head adjacent_ghosts_in_hash_table;
+    struct double_linked_list_head adjacent_ghosts_in_queue;
+};
+
+//Page metas added to a shard at once.
+struct page_meta_chunk {
+    struct page_meta *pages;
+    int page_num;
+    char *frames;               //Frames mapped for this chunk, or nullptr if they are part of the page cache's pool.
+    size_t frames_size;
+    struct page_meta_chunk *next;
+};
+
+//A partition of the page cache. All methods except the constructor and destructor must be called with 'latch' held.
+class page_cache_shard{
+friend class page_cache;
+friend class paged_file;
 private:
-    static const int factor = 10;                //Bucket factor
-    struct page_meta *all_pages;                 //All pages
-    struct double_linked_list_head *page_bucket; //Pinned pages
+    static const int rehash_step_buckets = 4;    //Old buckets moved into the new hash table per lookup.
+    static const int flush_batch = 64;           //Maximum pages written by one background flush.
+    pthread_mutex_t latch;
+    pthread_cond_t load_done;                    //Signaled when an asynchronous read completes.
+    pthread_cond_t flush_done;                   //Signaled when a background flush completes.
+    struct page_meta_chunk *chunks;              //All pages
+    struct double_linked_list_head *page_bucket; //Cached pages (hash table)
+    int bucket_mask;                             //Number of buckets - 1
+    struct double_linked_list_head *old_page_bucket; //Hash table being moved into 'page_bucket', or nullptr.
+    int old_bucket_num, rehash_index;            //Old buckets below 'rehash_index' are moved already.
     struct double_linked_list_head free_pages;   //Unpinned pages (Free pages list)
-    int total_pages, bucket_size;
+    struct double_linked_list_head retired_pages;//Pages taken out of use by shrinking.
+    int total_pages;                             //Pages in use (not retired)
+
+    enum page_replacement_policy policy;
+    struct double_linked_list_head hot_pages;    //2Q: Unpinned hot pages (Am), least recently used first.
+    int hot_page_num;                            //2Q: Number of cached hot pages, pinned or not.
+    int probation_threshold;                     //2Q: Probation queue size (Kin) above which it is preferred for eviction.
+    struct ghost_page *all_ghosts;               //2Q: Ghost entries pool.
+    struct double_linked_list_head *ghost_bucket;//2Q: Ghost entries hash table.
+    int ghost_bucket_mask;
+    struct double_linked_list_head ghost_queue;  //2Q: Ghost entries in eviction order (A1out).
+    struct double_linked_list_head free_ghosts;  //2Q: Unused ghost entries.
+
+    i64 hit_num, miss_num;                       //Pin requests served from cache / from disk.
+    int dirty_num;                               //Dirty pages.
+    int flushing_num;                            //Pages being written by the background flusher.
+    bool draining;                               //Flusher: above the high watermark, not yet down to the low one.
+    i64 eviction_write_num;                      //Dirty victims written on a miss.
+    i64 background_write_num;                    //Pages written by the background flusher.
+    i64 readahead_num;                           //Pages read ahead.
+    i64 readahead_hit_num;                       //Pages read ahead and asked for later.
+    i64 readahead_wasted_num;                    //Pages read ahead and evicted before anyone asked for them.
+    i64 eviction_num;                            //Cached pages evicted (recycled or retired).
+    i64 pin_wait_num, pin_wait_ns;               //Pin requests which waited, and the time they waited.
+    i64 depleted_num;                            //Pin requests failed because all pages were pinned.
+    i64 miss_latency[MISS_LATENCY_BUCKETS];      //Synchronous misses by latency.
+    class compressed_cache *second_tier;         //Evicted pages, compressed. nullptr if disabled.
+    class io_backend *io;
+
+    //Number of buckets of a hash table for 'page_num' entries.
+    static int get_bucket_num(int page_num);
+    inline struct double_linked_list_head *get_bucket(int fd, i64 page_no)
+    {
+        return &page_bucket[page_hash(fd, page_no) & bucket_mask];
+    }
+    //Allocate a new hash table and start moving pages into it.
+    void start_rehash(int bucket_num);
+    //Move up to 'bucket_num' old buckets into the new hash table.
+    void rehash(int bucket_num);
+    //Add 'page_num' free pages. Frames are mapped unless 'frames' is given.
+    i64 add_chunk(int page_num, char *frames, bool huge_pages);
+
+    //Choose the page to be recycled according to the replacement policy. Return nullptr if all pages are pinned.
+    struct page_meta *select_victim_page();
+
+    //2Q: Remember an evicted probation page in the ghost queue.
+    void remember_ghost_page(struct page_meta *curr_page);
+
+    //2Q: Find and drop the ghost entry of a page. Return true if the page was evicted recently.
+    bool forget_ghost_page(int fd, i64 page_no);
+
+    page_cache_shard(int total_pages, enum page_replacement_policy policy, char *frames);
+    ~page_cache_shard();
+    //Grow or shrink to 'total_pages' pages. Return the number of pages in use afterwards.
+    int resize(int total_pages, bool huge_pages);
+    struct page_meta *lookup_page(int fd, i64 page_no);
+    //Pin the page, reading it in on a miss. If 'read_pending' is given and the backend is asynchronous, the page
+    //is left loading instead, and the caller must read it in. A 'fresh' page is known to be past the end of file,
+    //so it is zeroed rather than read.
+    struct page_meta *get_page(int fd, i64 page_no, class paged_file *paged_file, bool *read_pending, bool fresh);
+    //Write back a victim if dirty, and disconnect it from the hash table, its file and the free pages list.
+    //DB_ERROR if the write fails: the victim is left untouched, still cached and dirty.
+    i64 evict_page(struct page_meta *victim);
+    //Take 'new_page' (a victim) for (fd, page_no): write it back if dirty, and insert it pinned into the hash table
+    //and the cached pages list of 'paged_file'. The page contents are zeroed, not read. DB_ERROR as 'evict_page'.
+    i64 install_page(struct page_meta *new_page, int fd, i64 page_no, class paged_file *paged_file);
+    //Take a frame for reading ahead a page. Return nullptr if the page is cached or no frame is free right now.
+    //The page returned is pinned and loading.
+    struct page_meta *get_readahead_page(int fd, i64 page_no, class paged_file *paged_file);
+    //Count a synchronous miss in the latency histogram.
+    void count_miss_latency(i64 ns);
+    //Give back a page that could not be read in.
+    void discard_page(struct page_meta *curr_page);
+    static void complete_async_read(struct io_request *req);
+    //Take a page out of the hash table. A hot page is not hot any more.
+    void remove_page_from_hash_table(struct page_meta *curr_page);
+    void insert_page_to_free_list(struct page_meta *curr_page);
+    //Write back and release the cached pages of a file in this shard. DB_ERROR if one could not be written.
+    i64 release_pages_of_file(class paged_file *paged_file);
+    //Drop cached pages of a file from 'page_no' on, dirty or not, without writing them back.
+    void discard_pages_of_file(class paged_file *paged_file, i64 page_no);
+
+    //Wait until the background flusher is done with the page (or with all pages if 'curr_page' is nullptr).
+    void wait_for_flush(struct page_meta *curr_page);
+    //Append dirty pages of a free list (from its eviction end) to 'pages'. Return the new number of pages.
+    int collect_pages_to_flush(struct double_linked_list_head *list, struct page_meta **pages, int page_num,
+                               int &scanned_num, int clean_page_num, int dirty_low_num);
+    //Write one batch of dirty pages ahead of eviction using 'bufs' (flush_batch pages). Return the number of pages
+    //written. Called by the flusher WITHOUT the latch held.
+    int flush_ahead(int clean_page_num, int dirty_low_num, int dirty_high_num, char *bufs);
+};
+
+class page_cache{
+friend class paged_file;
+private:
+    class page_cache_shard **shards;
+    int shard_num;
+    char *frame_pool;
+    size_t frame_pool_size;
+    bool huge_pages;                        //Frames should be backed by huge pages.
+    bool hugetlb;                           //Frame pool is backed by hugetlbfs pages.
+    class positional_io_backend default_io;
+    class io_backend *io;
+
+    pthread_t flusher;
+    pthread_mutex_t flusher_latch;
+    pthread_cond_t flusher_wakeup;
+    bool flusher_running, flusher_stopping, flush_requested;
+    double clean_fraction, dirty_low, dirty_high;
+    int flush_interval_ms;
+
+    static void *run_flusher(void *arg);
+
+    //Open files (for the statistics dump), protected by 'files_latch'.
+    pthread_mutex_t files_latch;
+    struct double_linked_list_head open_files;
+
+    //Periodic statistics dump.
+    pthread_t stats_dumper;
+    pthread_mutex_t dumper_latch;
+    pthread_cond_t dumper_wakeup;
+    bool dumper_running, dumper_stopping;
+    int stats_fd;
+    int stats_interval_ms;
+
+    static void *run_stats_dumper(void *arg);
 
-    int hash(int fd, i64 page_no);
+    class page_cache_shard *get_shard(int fd, i64 page_no);
+
+    //Write dirty pages of a file in page no. order, coalescing adjacent pages. All shard latches must be held.
+    //Pages of a failed write stay dirty, and DB_ERROR is returned.
+    i64 write_dirty_pages_of_file(class paged_file *paged_file);
 
 public:
-    page_cache(int bucket_size);
+    static const int max_readahead_pages = 64;
+
+    page_cache(int total_pages, enum page_replacement_policy policy = Fifo, int shard_num = 1, bool huge_pages = false);
     ~page_cache();
-    struct page_meta *get_page(int fd, i64 page_no, class paged_file *paged_file = nullptr);
+    //Find a cached page without pinning it. Return nullptr if it is not cached.
+    struct page_meta *lookup_page(int fd, i64 page_no);
+    //Pin the page on behalf of 'paged_file', reading it in if necessary (unless it is 'fresh', past the end of file).
+    struct page_meta *get_page(int fd, i64 page_no, class paged_file *paged_file, bool fresh = false);
+    //Pin the page into 'future'. The future completes once the page is read in.
+    i64 get_page_async(int fd, i64 page_no, class paged_file *paged_file, class page_future *future);
     void remove_page_from_hash_table(struct page_meta *curr_page);
-    void insert_page_to_free_list(struct page_meta *curr_page);     //Insert current page to the tail of free pages list.
+    void insert_page_to_free_list(struct page_meta *curr_page);     //Unpin current page. Insert it to the tail of free pages list (or hot queue) once no one pins it.
+    void mark_page_dirty(struct page_meta *curr_page);
+    i64 flush_pages_of_file(class paged_file *paged_file);          //Write back all dirty pages of a file.
+    i64 release_pages_of_file(class paged_file *paged_file);        //Flush and release all cached pages of a file.
+    //Drop cached pages of a file from 'page_no' on without writing them back. Return DB_ERROR (and drop none) if
+    //one of them is pinned.
+    i64 discard_pages_of_file(class paged_file *paged_file, i64 page_no);
+    //Replace the I/O backend. nullptr restores the default one. The backend is not owned by the page cache.
+    void set_io_backend(class io_backend *io);
+    inline class io_backend *get_io_backend() {return io;}
+    inline bool uses_hugetlb() {return hugetlb;}
+    //Keep evicted pages compressed within 'budget_bytes' (split among shards). 0 disables the second tier.
+    //Pages kept so far are dropped.
+    void set_compressed_cache_budget(i64 budget_bytes);
+    //Grow or shrink the page cache online. Return DB_ERROR if it could not reach 'total_pages' (e.g. too many pages
+    //are pinned to shrink).
+    i64 resize(int total_pages);
+    int get_total_pages();
+    //Start the background flusher. Fractions are relative to the pages of a shard.
+    i64 start_flusher(double clean_fraction = 0.25, double dirty_low = 0.25, double dirty_high = 0.5, int interval_ms = 10);
+    void stop_flusher();
+    //Read ahead 'page_num' (at most max_readahead_pages) pages of a file into unpinned pages.
+    void readahead(class paged_file *paged_file, i64 page_no, int page_num);
+    void get_readahead_stats(i64 *readahead_num, i64 *hit_num, i64 *wasted_num);
+    i64 get_eviction_write_num();
+    i64 get_background_write_num();
+    i64 get_hit_num();
+    i64 get_miss_num();
+    //Take a snapshot of all counters. Counters of different shards are read one shard at a time.
+    void get_stats(struct page_cache_stats *snapshot);
+    //Write a snapshot, and the counters of every open file, as text to 'fd'.
+    i64 dump_stats(int fd);
+    //Append a dump to 'filename' every 'interval_ms' milliseconds until stopped.
+    i64 start_stats_dump(const char *filename, int interval_ms = 1000);
+    void stop_stats_dump();
+};
+
+//Pinned page handle.
+class page_handle{
+friend class paged_file;
+friend class page_cache;
+friend class page_cache_shard;
+private:
+    struct page_meta *page_info;    //nullptr for a page of a mapped file.
+    class page_cache *page_cache;
+    char *page;
+    i64 page_no;
+
+    page_handle(const page_handle &) = delete;
+    page_handle &operator=(const page_handle &) = delete;
+    inline void attach(struct page_meta *page_info, class page_cache *page_cache)
+    {
+        this->page_info = page_info;
+        this->page_cache = page_cache;
+        this->page = page_info->page;
+        this->page_no = page_info->page_no;
+    }
+
+public:
+    page_handle() : page_info(nullptr), page_cache(nullptr), page(nullptr), page_no(-1) {}
+    ~page_handle() {release();}
+    inline bool is_pinned() {return page != nullptr;}
+    inline char *get_page() {return page;}
+    inline i64 get_page_no() {return page_no;}
+    inline void mark_dirty() {if(page_info) page_cache->mark_page_dirty(page_info);}
+    //Unpin the page. Releasing an empty handle is a no-op.
+    void release();
+};
+
+//Result of an asynchronous page request. The optional callback is called on completion, possibly on an I/O thread.
+class page_future{
+friend class page_cache;
+friend class page_cache_shard;
+friend class paged_file;
+private:
+    pthread_mutex_t latch;
+    pthread_cond_t done_cond;
+    bool done;
+    i64 ret;
+    struct io_request req;
+    void (*callback)(class page_future *future, void *arg);
+    void *callback_arg;
+
+    page_future(const page_future &) = delete;
+    page_future &operator=(const page_future &) = delete;
+    void finish(i64 ret);
+
+public:
+    class page_handle handle;   //The pinned page once the request succeeded.
+
+    page_future(void (*callback)(class page_future *future, void *arg) = nullptr, void *arg = nullptr);
+    ~page_future();
+    //Wait for completion. Return DB_SUCCESS if the page is pinned in 'handle'.
+    i64 wait();
 };
 
 class paged_file{
+friend class page_cache_shard;
+friend class page_cache;
     int fd;
     class page_cache *page_cache;
+    enum paged_file_mode mode;
+    pthread_mutex_t pages_in_file_latch;
     struct double_linked_list_head pages_in_file;
+
+    //Readahead state, protected by 'readahead_latch'.
+    static const int min_readahead_pages = 4;
+    static const int sequential_threshold = 2;   //Strictly increasing requests before reading ahead.
+    pthread_mutex_t readahead_latch;
+    i64 last_page_no;
+    int sequential_num;
+    int readahead_window;
+    i64 readahead_end;                           //First page after the last window read ahead.
+
+    //Mapped mode: reserved address space, and number of pages mapped from its start.
+    static const i64 map_reserve_size = 1LL << 36;
+    pthread_mutex_t map_latch;
+    char *map_base;
+    i64 mapped_page_num;
+
+    //Logical size, and preallocated extents protected by 'extent_latch'.
+    static const int min_extent_pages = 256;
+    static const int max_extent_pages = 16384;
+    i64 logical_page_num;
+    pthread_mutex_t extent_latch;
+    i64 preallocated_page_num;
+    int extent_page_num;                         //Size of the next extent.
+    bool preallocation_supported;
+
+    //Statistics. 'adjacent_open_files' links the file into the open files list of the page cache.
+    char *filename;
+    i64 read_bytes, write_bytes;
+    struct double_linked_list_head adjacent_open_files;
+
+    inline void count_read(i64 page_num) {__sync_fetch_and_add(&read_bytes, page_num * PAGE_SIZE);}
+    inline void count_write(i64 page_num) {__sync_fetch_and_add(&write_bytes, page_num * PAGE_SIZE);}
     i64 unpin_page_internal(struct page_meta *curr_page);
+    void detect_sequential_access(i64 page_no);
+    //Raise the logical size to cover 'page_no'. Return true if the page was past the end.
+    bool extend_logical_size(i64 page_no);
+    //Preallocate disk space for pages up to 'page_no'.
+    void preallocate(i64 page_no);
+    //Mapped mode: make sure page 'page_no' is mapped. Return its address, or nullptr on failure.
+    char *get_mapped_page(i64 page_no);
+    i64 map_file(i64 page_num);
 
 public:
+    paged_file()
+    {
+        pthread_mutex_init(&pages_in_file_latch, nullptr);
+        pthread_mutex_init(&readahead_latch, nullptr);
+        pthread_mutex_init(&map_latch, nullptr);
+        pthread_mutex_init(&extent_latch, nullptr);
+    }
+    ~paged_file()
+    {
+        pthread_mutex_destroy(&extent_latch);
+        pthread_mutex_destroy(&map_latch);
+        pthread_mutex_destroy(&readahead_latch);
+        pthread_mutex_destroy(&pages_in_file_latch);
+    }
     inline struct double_linked_list_head *get_pages_in_file() {return &pages_in_file;}
-    i64 open_paged_file(char *filename, class page_cache *page_cache);
+    i64 open_paged_file(char *filename, class page_cache *page_cache, enum paged_file_mode mode = Buffered);
+    inline enum paged_file_mode get_mode() {return mode;}
+    inline int get_fd() {return fd;}
     i64 get_page(i64 page_no, char *&page);
+    i64 get_page(i64 page_no, class page_handle &handle);   //Pin a page into 'handle', releasing the page it held.
+    i64 get_page_async(i64 page_no, class page_future *future);  //A future can be reused once completed.
+    //Pin a new page into 'handle', zeroed and marked dirty. Past the end of file, it is not read from disk.
+    i64 allocate_page(i64 page_no, class page_handle &handle);
+    inline i64 get_logical_page_num() {return __atomic_load_n(&logical_page_num, __ATOMIC_ACQUIRE);}
+    //Bytes read and written for this file through the page cache since it was opened.
+    inline i64 get_read_bytes() {return __atomic_load_n(&read_bytes, __ATOMIC_RELAXED);}
+    inline i64 get_write_bytes() {return __atomic_load_n(&write_bytes, __ATOMIC_RELAXED);}
     i64 unpin_page(i64 page_no);
     i64 mark_page_dirty(i64 page_no);
     i64 commit_page(i64 page_no);
+    i64 flush_paged_file();
+    //Shrink the file to 'page_num' pages. Cached pages past it are dropped, and must not be pinned.
+    //Not supported for a mapped file.
+    i64 truncate_paged_file(i64 page_num);
     i64 close_paged_file();
 };
 
@@ -73,4 +539,19 @@ extern void page_cache_test();
 
 extern void page_cache_test2();
 
+extern void page_cache_policy_test();
+extern void page_cache_hot_close_test();
+
+extern void page_cache_io_test();
+extern void page_cache_async_test();
+extern void page_cache_async_mix_test();
+extern void page_cache_flusher_test();
+extern void page_cache_readahead_test();
+extern void page_cache_direct_test();
+extern void page_cache_lookup_test();
+extern void page_cache_resize_test();
+extern void page_cache_allocate_test();
+extern void page_cache_stats_test();
+extern void page_cache_compressed_test();
+
 #endif
\ No newline at end of file
@@ -2,12 +2,12 @@
 
 i64 record::create_empty_record_page(i64 page_no)
 {
-    char *page = nullptr;
-    i64 ret = record_paged_file.get_page(page_no, page);
-    struct record_page_header *pg_hdr = (struct record_page_header *)page;
-
+    class page_handle handle;
+    //The page comes zeroed and dirty, so the slot bitmap is empty.
+    i64 ret = record_paged_file.allocate_page(page_no, handle);
     if(ret != DB_SUCCESS)
         return ret;
+    struct record_page_header *pg_hdr = (struct record_page_header *)handle.get_page();
     
     if(records_per_page > 0){
         pg_hdr->next_extended_page_no = -1;
@@ -22,21 +22,18 @@ i64 record::create_empty_record_page(i64 page_no)
         pg_hdr->slot_bitmap_length = 0;
     }
 
-    record_paged_file.mark_page_dirty(page_no);
-    record_paged_file.unpin_page(page_no);
-
     return DB_SUCCESS;
 }
 
 i64 record::find_first_empty_slot(i64 page_no, i64 &slot_no)
 {
-    char *page = nullptr;
+    class page_handle handle;
     slot_no = -1;
-    i64 ret = record_paged_file.get_page(page_no, page);
+    i64 ret = record_paged_file.get_page(page_no, handle);
     if(ret != DB_SUCCESS)
         return ret;
 
-    struct record_page_header *pg_hdr = (struct record_page_header *)page;
+    struct record_page_header *pg_hdr = (struct record_page_header *)handle.get_page();
     i64 *bitmap = pg_hdr->slot_bitmap;
     i64 len = pg_hdr->slot_bitmap_length;
     i64 cur_slot_no = 0;
@@ -44,22 +41,18 @@ i64 record::find_first_empty_slot(i64 page_no, i64 &slot_no)
     for(int i = 0; i < len; ++i){
         i64 tmp = bitmap[i];
         for(int j = 0; j < sizeof(bitmap[0]) * 8; ++j){
-            if(cur_slot_no >= records_per_page){
-                record_paged_file.unpin_page(page_no);
+            if(cur_slot_no >= records_per_page)
                 return DB_ERROR;
-            }
             if(!(tmp & 1)){
                 slot_no = cur_slot_no;
-                bitmap[i] |= 1 << (cur_slot_no % (sizeof(bitmap[0]) * 8));
-                record_paged_file.mark_page_dirty(page_no);
-                record_paged_file.unpin_page(page_no);
+                bitmap[i] |= (i64)1 << (cur_slot_no % (sizeof(bitmap[0]) * 8));
+                handle.mark_dirty();
                 return DB_SUCCESS;
             }
             tmp >>= 1;
             cur_slot_no++;
         }
     }
-    record_paged_file.unpin_page(page_no);
     return DB_ERROR;
 }
 
@@ -88,13 +81,14 @@ i64 record::insert_record(struct record_slot_attribute *record, i64 column_num_o
     }
 
     struct column_meta *cur_column_meta = column_meta_copy;
-    char *page = nullptr;
+    class page_handle handle;
     struct record_slot_attribute *cur_attr = record;
-    record_paged_file.get_page(page_no, page);
+    if(record_paged_file.get_page(page_no, handle) != DB_SUCCESS)
+        return DB_ERROR;
+    char *page = handle.get_page();
 
     for(int i = 0; i < file_header.total_column_number; ++i){
         if(cur_column_meta->type != cur_attr->type || cur_column_meta->length != cur_attr->length){
-            record_paged_file.unpin_page(page_no);
             return DB_ERROR;
         }
         cur_column_meta++;
@@ -112,8 +106,7 @@ i64 record::insert_record(struct record_slot_attribute *record, i64 column_num_o
         cur_column_meta++;
         cur_attr++;
     }
-    record_paged_file.mark_page_dirty(page_no);
-    record_paged_file.unpin_page(page_no);
+    handle.mark_dirty();
     return DB_SUCCESS;
 }
 
@@ -123,8 +116,10 @@ i64 record::get_record(struct record_slot_attribute *record, i64 column_num_of_r
         return DB_ERROR;
 
     struct column_meta *cur_column_meta = column_meta_copy;
-    char *page = nullptr;
-    record_paged_file.get_page(page_no, page);
+    class page_handle handle;
+    if(record_paged_file.get_page(page_no, handle) != DB_SUCCESS)
+        return DB_ERROR;
+    char *page = handle.get_page();
     char bitmap_size = sizeof(i64) * ((struct record_page_header *)page)->slot_bitmap_length;
     char *slot_pos = page + sizeof(struct record_page_header) + bitmap_size + slot_no * record_length;
 
@@ -138,51 +133,78 @@ i64 record::get_record(struct record_slot_attribute *record, i64 column_num_of_r
         cur_column_meta++;
         record++;
     }
-    record_paged_file.mark_page_dirty(page_no);
-    record_paged_file.unpin_page(page_no);
+    return DB_SUCCESS;
+}
+
+i64 record::scan_column(i64 column_no, i64 (*visit)(void *arg, const char *content, i64 page_no, i64 slot_no), void *arg)
+{
+    if(get_column_meta(column_no) == nullptr)
+        return DB_ERROR;
+    i64 column_offset = 0;
+    for(i64 i = 0; i < column_no; ++i){
+        column_offset += column_meta_copy[i].length;
+    }
+
+    class page_handle handle;
+    i64 ret, bits_per_word = sizeof(i64) * 8;
+    //Records are on the pages between the header pages and the next empty page (which has none yet).
+    for(i64 page_no = file_header.header_total_pages; page_no < get_next_empty_page_no(); ++page_no){
+        //Unpin the previous page and pin the next one.
+        if((ret = record_paged_file.get_page(page_no, handle)) != DB_SUCCESS)
+            return ret;
+        char *page = handle.get_page();
+        struct record_page_header *pg_hdr = (struct record_page_header *)page;
+        char *slot_pos = page + sizeof(struct record_page_header) + sizeof(i64) * pg_hdr->slot_bitmap_length + column_offset;
+
+        for(i64 slot_no = 0; slot_no < records_per_page && slot_no < pg_hdr->slot_bitmap_length * bits_per_word; ++slot_no){
+            if((pg_hdr->slot_bitmap[slot_no / bits_per_word] >> (slot_no % bits_per_word)) & 1){
+                if((ret = visit(arg, slot_pos + slot_no * record_length, page_no, slot_no)) != DB_SUCCESS)
+                    return ret;
+            }
+        }
+    }
     return DB_SUCCESS;
 }
 
 i64 record::create_record(char *file_name, struct column_meta *column_meta, i64 num_of_columns)
 {
-    i64 column_meta_num_per_page = PAGE_SIZE / sizeof(struct column_meta);cout<<column_meta_num_per_page<<endl;
+    i64 column_meta_num_per_page = PAGE_SIZE / sizeof(struct column_meta);
     i64 total_meta_pages = ceiling(num_of_columns, column_meta_num_per_page);
     i64 npages = total_meta_pages + 1;
-    char *page = nullptr;
-    i64 record_length = 0;
+    class page_handle handle;
+    record_length = 0;
 
     i64 ret = record_paged_file.open_paged_file(file_name, page_cache);
     if(ret != DB_SUCCESS)
         return ret;
 
-    record_paged_file.get_page(0, page);
-    struct record_file_header *rec_hdr = (struct record_file_header *)page;
+    record_paged_file.get_page(0, handle);
+    struct record_file_header *rec_hdr = (struct record_file_header *)handle.get_page();
     rec_hdr->header_total_pages = npages;
     strncpy(rec_hdr->table_name, file_name, MAX_STRING_LENGTH);
     rec_hdr->total_column_number = num_of_columns;
     rec_hdr->next_available_page_no = npages;
     rec_hdr->next_empty_page_no = npages;
-    record_paged_file.mark_page_dirty(0);
-    record_paged_file.unpin_page(0);
+    handle.mark_dirty();
 
     memcpy(&file_header, rec_hdr, sizeof(struct record_file_header));    
+    handle.release();
 
     struct column_meta *column_meta_on_page;
     i64 page_no = 1;
     for(int i = 0; i < num_of_columns; ++i){
         if(!(i % column_meta_num_per_page)){
-            record_paged_file.mark_page_dirty(page_no - 1);
-            record_paged_file.unpin_page(page_no - 1);
-            record_paged_file.get_page(page_no, page);
-            column_meta_on_page = (struct column_meta *)page;
+            //Unpin the previous column meta page and pin the next one.
+            record_paged_file.get_page(page_no, handle);
+            handle.mark_dirty();
+            column_meta_on_page = (struct column_meta *)handle.get_page();
             page_no++;
         }
         memcpy(column_meta_on_page, &column_meta[i], sizeof(struct column_meta));
         record_length += column_meta[i].length;
         column_meta_on_page++;
     }
-    record_paged_file.mark_page_dirty(page_no - 1);
-    record_paged_file.unpin_page(page_no - 1);
+    handle.release();
 
     records_per_page = (PAGE_SIZE - sizeof(struct record_page_header)) / record_length;
 
@@ -203,14 +225,14 @@ i64 record::create_record(char *file_name, struct column_meta *column_meta, i64
 
 i64 record::open_record(char *file_name)
 {
-    char *page;
+    class page_handle handle;
     i64 ret = record_paged_file.open_paged_file(file_name, page_cache);
     if(ret != DB_SUCCESS)
         return ret;
 
-    record_paged_file.get_page(0, page);
-    memcpy(&file_header, page, sizeof(struct record_file_header));
-    record_paged_file.unpin_page(0);
+    if((ret = record_paged_file.get_page(0, handle)) != DB_SUCCESS)
+        return ret;
+    memcpy(&file_header, handle.get_page(), sizeof(struct record_file_header));
 
     i64 column_meta_num_per_page = PAGE_SIZE / sizeof(struct column_meta);
     i64 num_of_columns = file_header.total_column_number;
@@ -226,16 +248,16 @@ i64 record::open_record(char *file_name)
 
     for(int i = 0; i < num_of_columns; ++i){
         if(!(i % column_meta_num_per_page)){
-            record_paged_file.unpin_page(page_no - 1);
-            record_paged_file.get_page(page_no, page);
-            column_meta_on_page = (struct column_meta *)page;
+            //Unpin the previous page and pin the next column meta page.
+            record_paged_file.get_page(page_no, handle);
+            column_meta_on_page = (struct column_meta *)handle.get_page();
             page_no++;
         }
         memcpy(copy_dest, &column_meta_on_page[i % column_meta_num_per_page], sizeof(struct column_meta));
         record_length += copy_dest->length;
         copy_dest++;
     }
-    record_paged_file.unpin_page(page_no - 1);
+    handle.release();
 
     records_per_page = (PAGE_SIZE - sizeof(struct record_page_header)) / record_length;
 
@@ -245,12 +267,6 @@ i64 record::open_record(char *file_name)
     if(eff_page_size > PAGE_SIZE)
         records_per_page--;
 
-    for(int i = 0; i < num_of_columns; ++i){
-        cout<<column_meta_copy[i].name<<":"<<column_meta_copy[i].type<<":"<<column_meta_copy[i].length<<endl;
-    }cout<<record_length<<"::"<<records_per_page<<"::"<<sizeof(struct record_page_header)<<endl;
-    cout<<file_header.header_total_pages<<" "<<file_header.table_name<<" "<<file_header.total_column_number<<" "\
-        <<file_header.next_available_page_no<<" "<<file_header.next_empty_page_no<<endl;
-
     return DB_SUCCESS;
 }
 
@@ -261,10 +277,12 @@ i64 record::close_record()
         column_meta_copy = nullptr;
     }
 
-    char *page = nullptr;
-    record_paged_file.get_page(0, page);
-    memcpy(page, &file_header, sizeof(struct record_file_header));
-    record_paged_file.mark_page_dirty(0);
+    class page_handle handle;
+    if(record_paged_file.get_page(0, handle) == DB_SUCCESS){
+        memcpy(handle.get_page(), &file_header, sizeof(struct record_file_header));
+        handle.mark_dirty();
+        handle.release();
+    }
     record_paged_file.close_paged_file();
     return DB_SUCCESS;
 }
@@ -468,9 +486,32 @@ void record_index_test()
 void test_sequence()
 {
     //page_cache_test2();
+    //page_cache_policy_test();
+    //page_cache_hot_close_test();
+    //page_cache_io_test();
+    //page_cache_async_test();
+    //page_cache_async_mix_test();
+    //page_cache_flusher_test();
+    //page_cache_readahead_test();
+    //page_cache_direct_test();
+    //page_cache_lookup_test();
+    //page_cache_resize_test();
+    //page_cache_allocate_test();
+    //page_cache_stats_test();
+    //page_cache_compressed_test();
 
     //index_test();
     //index_test2();
+    //index_concurrency_test();
+    //index_concurrent_update_test();
+    //index_mmap_test();
+    //index_search_bench();
+    //index_range_test();
+    //index_bulk_load_test();
+    //index_remove_test();
+    //index_key_search_test();
+    //index_batch_search_test();
+    //index_sequential_insert_test();
 
     //record_test();
     record_index_test();
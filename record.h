@@ -106,6 +106,14 @@ public:
     i64 close_record();
     i64 insert_record(struct record_slot_attribute *record, i64 column_num_of_record, i64 &page_no, i64 &slot_no);
     i64 get_record(struct record_slot_attribute *record, i64 column_num_of_record, i64 page_no, i64 slot_no);
+    //Column 'column_no' of the table, nullptr if there is none.
+    inline struct column_meta *get_column_meta(i64 column_no)
+    {
+        return (column_no >= 0 && column_no < file_header.total_column_number) ? &column_meta_copy[column_no] : nullptr;
+    }
+    //Call 'visit' with column 'column_no' of each record, in page and slot order. A visit returning other than
+    //DB_SUCCESS stops the scan and its return value is returned.
+    i64 scan_column(i64 column_no, i64 (*visit)(void *arg, const char *content, i64 page_no, i64 slot_no), void *arg);
 };
 
 #endif
\ No newline at end of file